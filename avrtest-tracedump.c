@@ -0,0 +1,381 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* avrtest-tracedump:  Render a binary trace as written by
+   avrtest_log -trace=FILE as the text log that avrtest_log would have
+   printed, optionally filtered and annotated with function names.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "trace.h"
+
+static const char USAGE[] =
+  "usage: avrtest-tracedump [-elf=FILE] [-func=NAME] [-pc=LO:HI]\n"
+  "                         [-skip=N] [-count=N] [-cycle=N]\n"
+  "                         [-call=NAME[:K]] TRACE\n"
+  "Print the instruction log from TRACE as written by avrtest_log\n"
+  "-trace=TRACE.  TRACE may be - for standard input.\n"
+  "Options:\n"
+  "  -h            Show this help and exit.\n"
+  "  -elf=FILE     Read function symbols from ELF FILE and print a line\n"
+  "                <NAME>: whenever execution enters function NAME.\n"
+  "  -func=NAME    Only print instructions located in function NAME.\n"
+  "                Requires -elf.\n"
+  "  -pc=LO:HI     Only print instructions at byte addresses LO <= PC < HI.\n"
+  "  -skip=N       Don't print the first N lines that pass the filters.\n"
+  "  -count=N      Stop after N lines have been printed.\n"
+  "  -cycle=N      Start at the first instruction executed at cycle N\n"
+  "                or later.  Requires a trace from -trace-compress.\n"
+  "  -call=NAME[:K]  Start at the K-th call of function NAME, default\n"
+  "                for K is 1.  Requires -elf and -trace-compress.\n";
+
+static const char *s_prog = "avrtest-tracedump";
+
+void
+trace_dump_fatal (const char *fmt, ...)
+{
+  va_list args;
+  va_start (args, fmt);
+  fprintf (stderr, "%s: ", s_prog);
+  vfprintf (stderr, fmt, args);
+  fputc ('\n', stderr);
+  va_end (args);
+  exit (EXIT_FAILURE);
+}
+
+// Errors found by trace-dump.c and by us are reported alike.
+#define fatal trace_dump_fatal
+
+static void*
+xrealloc (void *p, size_t n_bytes)
+{
+  p = realloc (p, n_bytes);
+  if (!p)
+    fatal ("out of memory");
+  return p;
+}
+
+static char*
+xstrndup (const char *s, size_t len)
+{
+  char *d = xrealloc (NULL, 1 + len);
+  memcpy (d, s, len);
+  d[len] = '\0';
+  return d;
+}
+
+// ----------------------------------------------------------------------------
+//     ELF symbols
+
+typedef struct
+{
+  unsigned addr, size;
+  const char *name;
+} func_t;
+
+static func_t *funcs;
+static size_t n_funcs;
+
+static uint32_t
+get_le (const unsigned char *p, int n_bytes)
+{
+  uint32_t val = 0;
+  while (n_bytes--)
+    val = (val << 8) | p[n_bytes];
+  return val;
+}
+
+static int
+cmp_func (const void *a, const void *b)
+{
+  const func_t *f = (const func_t*) a;
+  const func_t *g = (const func_t*) b;
+  return f->addr < g->addr ? -1 : f->addr > g->addr;
+}
+
+// Read the function symbols from the symbol table of ELF32 file NAME.
+
+static void
+read_elf (const char *name)
+{
+  FILE *f = fopen (name, "rb");
+  if (!f)
+    fatal ("cannot open ELF file \"%s\"", name);
+
+  unsigned char *elf = NULL;
+  size_t len = 0, n;
+  do
+    {
+      elf = xrealloc (elf, len + (1 << 16));
+      len += n = fread (elf + len, 1, 1 << 16, f);
+    } while (n);
+  fclose (f);
+
+  if (len < 0x34 || memcmp (elf, "\177ELF", 4)
+      || elf[4] != 1 /* ELFCLASS32 */ || elf[5] != 1 /* ELFDATA2LSB */)
+    fatal ("%s: not an ELF32 little endian file", name);
+
+  uint32_t shoff = get_le (elf + 0x20, 4);
+  uint32_t shentsize = get_le (elf + 0x2e, 2);
+  uint32_t shnum = get_le (elf + 0x30, 2);
+
+  if (shoff + (uint64_t) shnum * shentsize > len)
+    fatal ("%s: bad section headers", name);
+
+  for (uint32_t i = 0; i < shnum; i++)
+    {
+      const unsigned char *sh = elf + shoff + i * shentsize;
+      if (get_le (sh + 4, 4) != 2 /* SHT_SYMTAB */)
+        continue;
+
+      uint32_t off = get_le (sh + 16, 4);
+      uint32_t size = get_le (sh + 20, 4);
+      uint32_t link = get_le (sh + 24, 4);
+      uint32_t entsize = get_le (sh + 36, 4);
+      if (link >= shnum || !entsize)
+        fatal ("%s: bad symbol table", name);
+
+      const unsigned char *strsh = elf + shoff + link * shentsize;
+      uint32_t stroff = get_le (strsh + 16, 4);
+      uint32_t strsize = get_le (strsh + 20, 4);
+      if ((uint64_t) off + size > len || (uint64_t) stroff + strsize > len)
+        fatal ("%s: bad symbol table", name);
+
+      for (uint32_t s = 0; s + entsize <= size; s += entsize)
+        {
+          const unsigned char *sym = elf + off + s;
+          uint32_t st_name = get_le (sym, 4);
+          uint32_t value = get_le (sym + 4, 4);
+          if ((sym[12] & 0xf) != 2 /* STT_FUNC */
+              || value >= 0x800000
+              || st_name >= strsize)
+            continue;
+
+          funcs = xrealloc (funcs, (n_funcs + 1) * sizeof (func_t));
+          funcs[n_funcs].addr = value;
+          funcs[n_funcs].size = get_le (sym + 8, 4);
+          funcs[n_funcs].name = (const char*) elf + stroff + st_name;
+          n_funcs++;
+        }
+    }
+
+  qsort (funcs, n_funcs, sizeof (func_t), cmp_func);
+
+  // Functions without a size extend up to the next function.
+  for (size_t i = 0; i < n_funcs; i++)
+    if (funcs[i].size == 0)
+      funcs[i].size = (i + 1 < n_funcs
+                       ? funcs[i + 1].addr - funcs[i].addr
+                       : 0x800000 - funcs[i].addr);
+}
+
+// Return the function that contains byte address ADDR, or NULL.
+
+static const func_t*
+find_func (unsigned addr)
+{
+  size_t lo = 0, hi = n_funcs;
+
+  // Find the last function that starts at or before ADDR.
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (funcs[mid].addr <= addr)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo == 0)
+    return NULL;
+  const func_t *f = & funcs[lo - 1];
+  return addr - f->addr < f->size ? f : NULL;
+}
+
+// ----------------------------------------------------------------------------
+
+static struct
+{
+  const char *elf;
+  const char *func;
+  bool have_pc;
+  unsigned pc_lo, pc_hi;
+  unsigned long long skip, count;
+  bool have_count;
+  const char *call;
+  trace_seek_t seek;
+} opt;
+
+static unsigned long long
+get_number (const char *arg, const char *s)
+{
+  char *end;
+  unsigned long long val = strtoull (s, &end, 0);
+  if (end == s || *end)
+    fatal ("%s: bad number \"%s\"", arg, s);
+  return val;
+}
+
+static const char*
+get_value (const char *arg, const char *name)
+{
+  size_t len = strlen (name);
+  return strncmp (arg, name, len) ? NULL : arg + len;
+}
+
+// Apply the filters to LINE and print it.
+
+static bool
+show_line (const char *line, bool have_pc, unsigned addr, void *ctx)
+{
+  static const func_t *cur_func;
+  const func_t *only = (const func_t*) ctx;
+
+  if (opt.have_pc || only)
+    if (!have_pc
+        || (opt.have_pc && (addr < opt.pc_lo || addr >= opt.pc_hi))
+        || (only && addr - only->addr >= only->size))
+      return true;
+
+  if (opt.skip)
+    {
+      opt.skip--;
+      return true;
+    }
+
+  if (opt.have_count && opt.count-- == 0)
+    return false;
+
+  const func_t *fn = have_pc ? find_func (addr) : cur_func;
+  if (fn && fn != cur_func)
+    printf ("<%s>:\n", fn->name);
+  cur_func = fn;
+
+  puts (line);
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *file = NULL;
+  const char *val;
+
+  for (int i = 1; i < argc; i++)
+    {
+      const char *arg = argv[i];
+      if (!strcmp (arg, "-h") || !strcmp (arg, "--help") || !strcmp (arg, "-?"))
+        {
+          fputs (USAGE, stdout);
+          return EXIT_SUCCESS;
+        }
+      else if ((val = get_value (arg, "-elf=")))
+        opt.elf = val;
+      else if ((val = get_value (arg, "-func=")))
+        opt.func = val;
+      else if ((val = get_value (arg, "-skip=")))
+        opt.skip = get_number (arg, val);
+      else if ((val = get_value (arg, "-count=")))
+        {
+          opt.count = get_number (arg, val);
+          opt.have_count = true;
+        }
+      else if ((val = get_value (arg, "-cycle=")))
+        {
+          opt.seek.cycle = get_number (arg, val);
+          opt.seek.by_cycle = true;
+        }
+      else if ((val = get_value (arg, "-call=")))
+        {
+          const char *colon = strchr (val, ':');
+          opt.call = colon ? xstrndup (val, colon - val) : val;
+          opt.seek.call = colon ? get_number (arg, colon + 1) : 1;
+          if (opt.seek.call == 0)
+            fatal ("%s: K must be at least 1", arg);
+          opt.seek.by_call = true;
+        }
+      else if ((val = get_value (arg, "-pc=")))
+        {
+          const char *colon = strchr (val, ':');
+          if (!colon)
+            fatal ("%s: expecting LO:HI", arg);
+          char *lo = xstrndup (val, colon - val);
+          opt.pc_lo = get_number (arg, lo);
+          opt.pc_hi = get_number (arg, colon + 1);
+          opt.have_pc = true;
+          free (lo);
+        }
+      else if (arg[0] == '-' && arg[1])
+        fatal ("unknown option \"%s\", try -h", arg);
+      else if (file)
+        fatal ("more than one trace file given, try -h");
+      else
+        file = arg;
+    }
+
+  if (!file)
+    fatal ("no trace file given, try -h");
+
+  if (opt.elf)
+    read_elf (opt.elf);
+
+  const func_t *only = NULL;
+  if (opt.func)
+    {
+      if (!opt.elf)
+        fatal ("-func=%s requires -elf=FILE", opt.func);
+      for (size_t i = 0; i < n_funcs && !only; i++)
+        if (!strcmp (funcs[i].name, opt.func))
+          only = & funcs[i];
+      if (!only)
+        fatal ("%s: function \"%s\" not found", opt.elf, opt.func);
+    }
+
+  if (opt.seek.by_cycle && opt.seek.by_call)
+    fatal ("-cycle and -call are mutually exclusive");
+
+  if (opt.call)
+    {
+      if (!opt.elf)
+        fatal ("-call=%s requires -elf=FILE", opt.call);
+      const func_t *fn = NULL;
+      for (size_t i = 0; i < n_funcs && !fn; i++)
+        if (!strcmp (funcs[i].name, opt.call))
+          fn = & funcs[i];
+      if (!fn)
+        fatal ("%s: function \"%s\" not found", opt.elf, opt.call);
+      opt.seek.func = fn->addr;
+    }
+
+  FILE *stream = strcmp (file, "-") ? fopen (file, "rb") : stdin;
+  if (!stream)
+    fatal ("cannot open trace file \"%s\"", file);
+
+  trace_dump (stream, NULL, 0, file, &opt.seek, show_line, (void*) only);
+
+  return EXIT_SUCCESS;
+}
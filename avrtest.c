@@ -21,6 +21,7 @@
   the Free Software Foundation, 59 Temple Place - Suite 330,
   Boston, MA 02111-1307, USA.  */
 
+#define _POSIX_C_SOURCE 200112L // fdopen
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +29,7 @@
 #include <inttypes.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <setjmp.h>
 #include <sys/time.h>
 
 #include "testavr.h"
@@ -35,6 +37,10 @@
 #include "flag-tables.h"
 #include "sreg.h"
 #include "host.h"
+#include "fuzz.h"
+#include "image-cache.h"
+#include "cores.h"
+#include "sample.h"
 
 // ---------------------------------------------------------------------------
 // register and port definitions
@@ -81,6 +87,10 @@
 #define IS_AVRTEST_LOG 0
 #endif
 
+#if defined AVRTEST_FUZZ && defined AVRTEST_LOG
+#error avrtest_fuzz does not support logging
+#endif
+
 bool log_unused = IS_AVRTEST_LOG == 0;
 
 const bool is_avrtest_log = IS_AVRTEST_LOG == 1;
@@ -101,9 +111,9 @@ const unsigned invalid_opcode = AVRTEST_INVALID_OPCODE;
 // ----------------------------------------------------------------------------
 // Symbol table
 
-void no_elf_string_table (char *stab, size_t size, int n_entries) {}
+void no_elf_string_table (const char *stab, size_t size, int n_entries) {}
 void no_elf_function_symbol (int addr, size_t offset, bool is_func) {}
-void no_elf_object_symbol (int addr, size_t offset) {}
+void no_elf_object_symbol (int addr, size_t offset, unsigned size) {}
 void no_elf_string_table_finish (void) {}
 void no_elf_symbol (const char *name, size_t stoff, unsigned pc, bool is_fun) {}
 
@@ -153,6 +163,8 @@ avrtest_set_func_symbol (int addr, size_t stoff, bool is_func)
     }
 
   sim.graph.elf_symbol (name, stoff, addr / 2, is_func);
+  log_elf_symbol (name, addr / 2, is_func);
+  hotspots_elf_symbol (name, addr / 2, is_func);
 
   s->n_funcs += is_func;
   s->n_vec += !is_func && str_prefix ("__vector_", name);
@@ -160,7 +172,7 @@ avrtest_set_func_symbol (int addr, size_t stoff, bool is_func)
 }
 
 static void
-avrtest_set_data_symbol (int addr, size_t stoff)
+avrtest_set_data_symbol (int addr, size_t stoff, unsigned size)
 {
   string_table_t *s = & string_table;
 
@@ -168,11 +180,13 @@ avrtest_set_data_symbol (int addr, size_t stoff)
     leave (LEAVE_FATAL, "symbol table is NULL");
 
   s->n_objects += 1;
+
+  watch_data_symbol (s->data + stoff, addr, size);
 }
 
 
 static void
-avrtest_set_string_table (char *data, size_t size, int n_entries)
+avrtest_set_string_table (const char *data, size_t size, int n_entries)
 {
   string_table_t *s = & string_table;
 
@@ -221,6 +235,7 @@ sim_t sim =
       no_elf_symbol,
       no_elf_string_table_finish
     },
+    .log_value = NULL,
     .function_list = NULL,
     .object_list = NULL
   };
@@ -298,26 +313,29 @@ typedef struct
   int failure;
   // Exit value with -q quiet operation, cf. README
   int quiet_value;
+  // Value of "leave" in the -result record
+  const char *key;
 } exit_status_t;
 
 static const exit_status_t exit_status[] =
   {
     // "EXIT" and "ABORTED" are keywords scanned by board descriptions.
     // -1 : Use exit_value (only set to != 0 with LEAVE_EXIT)
-    [LEAVE_EXIT]    = { "EXIT",    NULL, EXIT_SUCCESS, -1 },
-    [LEAVE_ABORTED] = { "ABORTED", NULL, EXIT_SUCCESS, EXIT_FAILURE },
-    [LEAVE_TIMEOUT] = { "TIMEOUT", NULL, EXIT_SUCCESS, 10 },
-    [LEAVE_ELF]     = { "ABORTED", NULL, EXIT_SUCCESS, 11 },
-    [LEAVE_CODE]    = { "ABORTED", NULL, EXIT_SUCCESS, 12 },
-    [LEAVE_SYMBOL]  = { "ABORTED", NULL, EXIT_SUCCESS, 13 },
-    [LEAVE_HOSTIO]  = { "ABORTED", NULL, EXIT_SUCCESS, 14 },
+    [LEAVE_EXIT]    = { "EXIT",    NULL, EXIT_SUCCESS, -1, "exit" },
+    [LEAVE_ABORTED] = { "ABORTED", NULL, EXIT_SUCCESS, EXIT_FAILURE,
+                        "aborted" },
+    [LEAVE_TIMEOUT] = { "TIMEOUT", NULL, EXIT_SUCCESS, 10, "timeout" },
+    [LEAVE_ELF]     = { "ABORTED", NULL, EXIT_SUCCESS, 11, "elf" },
+    [LEAVE_CODE]    = { "ABORTED", NULL, EXIT_SUCCESS, 12, "code" },
+    [LEAVE_SYMBOL]  = { "ABORTED", NULL, EXIT_SUCCESS, 13, "symbol" },
+    [LEAVE_HOSTIO]  = { "ABORTED", NULL, EXIT_SUCCESS, 14, "hostio" },
     // Something went badly wrong
-    [LEAVE_MEMORY]  = { "ABORTED", "memory",      EXIT_FAILURE, 20 },
-    [LEAVE_USAGE]   = { "ABORTED", "usage",       EXIT_FAILURE, 21 },
-    [LEAVE_FOPEN]   = { "ABORTED", "file open",   EXIT_FAILURE, 22 },
-    [LEAVE_IEEE32]  = { "ABORTED", "IEEE single", EXIT_FAILURE, 23 },
-    [LEAVE_IEEE64]  = { "ABORTED", "IEEE double", EXIT_FAILURE, 24 },
-    [LEAVE_FATAL]   = { "FATAL ABORTED", "fatal", EXIT_FAILURE, 42 },
+    [LEAVE_MEMORY]  = { "ABORTED", "memory",      EXIT_FAILURE, 20, "memory" },
+    [LEAVE_USAGE]   = { "ABORTED", "usage",       EXIT_FAILURE, 21, "usage" },
+    [LEAVE_FOPEN]   = { "ABORTED", "file open",   EXIT_FAILURE, 22, "fopen" },
+    [LEAVE_IEEE32]  = { "ABORTED", "IEEE single", EXIT_FAILURE, 23, "ieee32" },
+    [LEAVE_IEEE64]  = { "ABORTED", "IEEE double", EXIT_FAILURE, 24, "ieee64" },
+    [LEAVE_FATAL]   = { "FATAL ABORTED", "fatal", EXIT_FAILURE, 42, "fatal" },
   };
 
 
@@ -334,6 +352,12 @@ void qprintf (const char *fmt, ...)
 }
 
 static void print_runtime (void);
+static void print_result (const exit_status_t*, const char*, va_list);
+
+#ifdef AVRTEST_FUZZ
+// leave() jumps back to main() when a fuzzing run has finished.
+static jmp_buf fuzz_jmp;
+#endif
 
 void NOINLINE NORETURN
 leave (int n, const char *reason, ...)
@@ -341,10 +365,37 @@ leave (int n, const char *reason, ...)
   const exit_status_t *status = & exit_status[n];
   va_list args;
 
+#ifdef AVRTEST_FUZZ
+  if (fuzz.active
+      && EXIT_SUCCESS == status->failure)
+    {
+      va_start (args, reason);
+      fuzz_done (n, 2 * cpu.pc, reason, args);
+      va_end (args);
+      longjmp (fuzz_jmp, 1);
+    }
+#endif // AVRTEST_FUZZ
+
+  cores_done ();
+
   program.leave_status = n;
   // make sure we print the last log line before leaving
   if (EXIT_SUCCESS == status->failure)
     log_dump_line (NULL);
+  log_async_finish ();
+
+  if (EXIT_SUCCESS == status->failure)
+    sample_dump ();
+
+  if (n != LEAVE_EXIT || program.exit_value)
+    log_flight_dump ();
+
+  if (options.do_result)
+    {
+      va_start (args, reason);
+      print_result (status, reason, args);
+      va_end (args);
+    }
 
   qprintf ("\n");
 
@@ -377,7 +428,7 @@ leave (int n, const char *reason, ...)
       va_end (args);
       fflush (stdout);
 
-      exit (status->failure);
+      exit (cores_exit (status->failure));
     }
 
   fflush (stdout);
@@ -395,12 +446,14 @@ leave (int n, const char *reason, ...)
       va_end (args);
     }
 
-  exit (n == LEAVE_EXIT ? program.exit_value : status->quiet_value);
+  exit (cores_exit (n == LEAVE_EXIT
+                    ? program.exit_value
+                    : status->quiet_value));
 }
 
 // ---------------------------------------------------------------------------
 
-// vars used with -runtime to measure AVRtest performance
+// vars used with -runtime and -result= to measure AVRtest performance
 
 static struct timeval t_start, t_decode, t_execute, t_load;
 
@@ -464,6 +517,126 @@ print_runtime (void)
           r_sec/60, r_sec%60, r_us, r_sec, r_us/1000, 100.,
           r_ms > 0.01 ? p->n_insns/r_ms : 0.0,
           r_ms > 1e-5 ? p->n_cycles / (1000 * r_ms) : 0.0);
+
+  image_cache_print_runtime ();
+}
+
+
+// Write string S as a JSON string literal to STREAM.
+
+void
+json_string (FILE *stream, const char *s)
+{
+  putc ('"', stream);
+  for (; *s; s++)
+    {
+      unsigned char c = (unsigned char) *s;
+      if (c == '"' || c == '\\')
+        fprintf (stream, "\\%c", c);
+      else if (c == '\n')
+        fputs ("\\n", stream);
+      else if (c == '\t')
+        fputs ("\\t", stream);
+      else if (c < 0x20 || c == 0x7f)
+        fprintf (stream, "\\u%04x", c);
+      else
+        putc (c, stream);
+    }
+  putc ('"', stream);
+}
+
+
+static bool
+time_is_set (const struct timeval *t)
+{
+  return t->tv_sec != 0 || t->tv_usec != 0;
+}
+
+
+// Microseconds from T0 to T1, or 0 if the phase starting at T0 has
+// not been reached.
+
+static long long
+time_us (const struct timeval *t1, const struct timeval *t0)
+{
+  if (!time_is_set (t0))
+    return 0;
+
+  return 1000000LL * (t1->tv_sec - t0->tv_sec) + (t1->tv_usec - t0->tv_usec);
+}
+
+
+// -result=FILE:  Append a one-line JSON record describing the run to FILE.
+// FILE may also be "stderr" or the number N resp. "fd:N" of a file
+// descriptor that was opened by the caller.  The record is written independent of -q, and
+// program output to stdout is not affected.  For the fields see README.
+
+static void
+print_result (const exit_status_t *status, const char *reason, va_list args)
+{
+  const program_t *p = &program;
+  const char *fname = options.s_result;
+  FILE *out;
+
+  // A file descriptor is given as N or as fd:N.
+  const char *fd = fname;
+  if (str_prefix ("fd:", fd))
+    fd += strlen ("fd:");
+
+  if (str_eq (fname, "stderr"))
+    out = stderr;
+  else if (*fd && strspn (fd, "0123456789") == strlen (fd))
+    out = fdopen (atoi (fd), "a");
+  else
+    out = fopen (fname, "a");
+
+  if (!out)
+    {
+      fprintf (stderr, "%s: cannot open -result=%s for writing\n",
+               options.self, fname);
+      return;
+    }
+
+  char text[512];
+  vsnprintf (text, sizeof (text), reason, args);
+
+  struct timeval t_end;
+  gettimeofday (&t_end, NULL);
+
+  fprintf (out, "{\"program\":");
+  json_string (out, p->name ? p->name : "");
+  if (cores.n_cores > 1)
+    fprintf (out, ",\"core\":%d", cores.id);
+  fprintf (out, ",\"status\":\"%s\",\"leave\":\"%s\",\"exit_value\":%d"
+           ",\"reason\":",
+           p->exit_value ? exit_status[LEAVE_ABORTED].text : status->text,
+           status->key, p->exit_value);
+  json_string (out, text);
+
+  if (EXIT_SUCCESS == status->failure)
+    {
+      // A phase that has not been completed ends now.
+      const struct timeval *t_d, *t_e;
+      t_d = time_is_set (&t_decode) ? &t_decode : &t_end;
+      t_e = time_is_set (&t_execute) ? &t_execute : &t_end;
+
+      fprintf (out, ",\"entry_point\":%u,\"exit_address\":%u"
+               ",\"cycles\":%" PRIu64 ",\"instructions\":%" PRIu64
+               ",\"runtime\":{\"load_us\":%lld,\"decode_us\":%lld"
+               ",\"execute_us\":%lld,\"total_us\":%lld}",
+               p->entry_point, cpu.pc * 2, p->n_cycles, p->n_insns,
+               time_us (t_d, &t_load), time_us (t_e, &t_decode),
+               time_us (&t_end, &t_execute), time_us (&t_end, &t_start));
+
+      perf_result (out);
+    }
+
+  fprintf (out, "}\n");
+
+  if (out == stderr)
+    fflush (out);
+  else
+    fclose (out);
 }
 
 
@@ -481,6 +654,7 @@ data_read_byte_raw (int address)
 static INLINE void
 data_write_byte_raw (int address, int value)
 {
+  fuzz_dirty (address);
   cpu_data[address] = value;
 }
 
@@ -498,8 +672,8 @@ static INLINE int
 data_read_byte (int address)
 {
   int ret = cpu_data[address];
-  log_add_data_mov (address == SREG ? "(SREG)->'%s' " : "(%s)->%02x ",
-                    address, ret);
+  log_add_data_mov (address, ret, 1, false);
+  log_watch (address, ret, ret, false);
   return ret;
 }
 
@@ -508,8 +682,9 @@ data_read_byte (int address)
 static INLINE void
 data_write_byte (int address, int value)
 {
-  log_add_data_mov (address == SREG ? "(SREG)<-'%s' " : "(%s)<-%02x ",
-                    address, value & 0xff);
+  log_add_data_mov (address, value & 0xff, 1, true);
+  log_watch (address, cpu_data[address], value, true);
+  fuzz_dirty (address);
   cpu_data[address] = value;
 }
 
@@ -519,7 +694,7 @@ data_write_byte (int address, int value)
 static INLINE byte
 get_reg (int regno)
 {
-  log_append ("(R%d)->%02x ", regno, cpu_reg[regno]);
+  log_add_reg_mov (regno, cpu_reg[regno], 1, false);
 #ifdef ISA_TINY
   if (regno < 16)
     leave (LEAVE_CODE, "illegal tiny register R%d", regno);
@@ -530,7 +705,7 @@ get_reg (int regno)
 static INLINE void
 put_reg (int regno, byte value)
 {
-  log_append ("(R%d)<-%02x ", regno, value);
+  log_add_reg_mov (regno, value, 1, true);
 #ifdef ISA_TINY
   if (regno < 16)
     leave (LEAVE_CODE, "illegal tiny register R%d", regno);
@@ -548,7 +723,7 @@ static INLINE int
 get_word_reg (int regno)
 {
   int ret = get_word_reg_raw (regno);
-  log_append ("(R%d)->%04x ", regno, ret);
+  log_add_reg_mov (regno, ret, 2, false);
   return ret;
 }
 
@@ -562,7 +737,7 @@ put_word_reg_raw (int regno, int value)
 static INLINE void
 put_word_reg (int regno, int value)
 {
-  log_append ("(R%d)<-%04x ", regno, value & 0xFFFF);
+  log_add_reg_mov (regno, value & 0xFFFF, 2, true);
   put_word_reg_raw (regno, value);
 }
 
@@ -581,7 +756,9 @@ data_read_word (int address)
 {
   int ret = (data_read_byte_raw (address)
              | (data_read_byte_raw (address + 1) << 8));
-  log_add_data_mov ("(%s)->%04x ", address, ret);
+  log_add_data_mov (address, ret, 2, false);
+  log_watch (address, ret, ret, false);
+  log_watch (address + 1, ret >> 8, ret >> 8, false);
   return ret;
 }
 
@@ -591,7 +768,9 @@ static INLINE void
 data_write_word (int address, int value)
 {
   value &= 0xffff;
-  log_add_data_mov ("(%s)<-%04x ", address, value);
+  log_add_data_mov (address, value, 2, true);
+  log_watch (address, cpu_data[address], value, true);
+  log_watch (address + 1, cpu_data[address + 1], value >> 8, true);
   data_write_byte_raw (address, value & 0xFF);
   data_write_byte_raw (address + 1, value >> 8);
 }
@@ -941,6 +1120,7 @@ skip_instruction_on_condition (bool condition, int words_to_skip)
       set_pc (cpu.pc + words_to_skip);
       add_program_cycles (words_to_skip);
     }
+  fuzz_edge (cpu.pc);
 }
 
 static INLINE void
@@ -954,6 +1134,7 @@ branch_on_sreg_condition (int rd, int rr, int flag_value)
       add_pc (delta);
       add_program_cycles (1);
     }
+  fuzz_edge (cpu.pc);
 }
 
 static INLINE void
@@ -1049,6 +1230,7 @@ static OP_FUNC_TYPE func_EICALL (int rd, int rr)
 
   push_PC();
   set_pc (get_word_reg (REGZ) | (data_read_byte (EIND) << 16));
+  fuzz_edge (cpu.pc);
 }
 
 /* 1001 0100 0001 1001 | EIJMP */
@@ -1058,6 +1240,7 @@ static OP_FUNC_TYPE func_EIJMP (int rd, int rr)
     func_ILLEGAL (IL_ARCH, 1);
 
   set_pc (get_word_reg (REGZ) | (data_read_byte (EIND) << 16));
+  fuzz_edge (cpu.pc);
 }
 
 /* 1001 0101 1101 1000 | ELPM */
@@ -1078,12 +1261,14 @@ static OP_FUNC_TYPE func_ICALL (int rd, int rr)
   push_PC();
   set_pc (get_word_reg (REGZ));
   add_program_cycles (arch.pc_3bytes);
+  fuzz_edge (cpu.pc);
 }
 
 /* 1001 0100 0000 1001 | IJMP */
 static OP_FUNC_TYPE func_IJMP (int rd, int rr)
 {
   set_pc (get_word_reg (REGZ));
+  fuzz_edge (cpu.pc);
 }
 
 /* 1001 0101 1100 1000 | LPM */
@@ -1108,6 +1293,7 @@ static OP_FUNC_TYPE func_RET (int rd, int rr)
 #endif
 
   maybe_cycles_call_end ();
+  fuzz_edge (cpu.pc);
 }
 
 /* 1001 0101 0001 1000 | RETI */
@@ -1687,6 +1873,7 @@ static OP_FUNC_TYPE func_CALL (int rd, int rr)
   push_PC();
   set_pc (rr | (rd << 16));
   add_program_cycles (arch.pc_3bytes);
+  fuzz_edge (cpu.pc);
 }
 
 
@@ -1813,6 +2000,7 @@ static OP_FUNC_TYPE func_RCALL (int rd, int rr)
   push_PC();
   add_pc (delta);
   add_program_cycles (arch.pc_3bytes);
+  fuzz_edge (cpu.pc);
 }
 
 
@@ -1875,12 +2063,38 @@ void log_va (const char *fmt, va_list args)
 }
 
 
+/* Host code like set_mem_value() is about to write LEN bytes of RAM
+   at ADDR.  avrtest_fuzz then has to roll back the respective pages.
+   Supplied here because host.c and options.c don't depend on
+   AVRTEST_FUZZ.  */
+
+void fuzz_dirty_range (unsigned addr, size_t len)
+{
+#ifdef AVRTEST_FUZZ
+  if (len == 0)
+    return;
+
+  if (addr >= MAX_RAM_SIZE || len > MAX_RAM_SIZE - addr)
+    fuzz_dirty_all ();
+  else
+    for (unsigned page = addr >> FUZZ_PAGE_BITS;
+         page <= (addr + len - 1) >> FUZZ_PAGE_BITS; page++)
+      fuzz_dirty (page << FUZZ_PAGE_BITS);
+#else
+  (void) addr;
+  (void) len;
+#endif // AVRTEST_FUZZ
+}
+
+
+static int abort_2nd_hits;
+
 static void sys_abort_2nd_hit (void)
 {
-  static int hits;
+  int hits = abort_2nd_hits++;
   log_append ("abort_2nd_hit: hit #%d", 1 + hits);
 
-  if (++hits > 1)
+  if (hits > 0)
     leave (LEAVE_CODE, "avrtest_abort_2nd_hit called a 2nd time");
 }
 
@@ -1920,8 +2134,67 @@ static void sys_argc_argv (void)
 // Defined in stdio.h
 #define AVR_EOF (-1)
 
+#ifdef AVRTEST_FUZZ
+
+static int fuzz_abort_2nd_hits;
+
+// Hand the current fuzzing input over to the target.
+
+static void
+fuzz_deliver (void)
+{
+  if (fuzz.how == FUZZ_STDIN)
+    {
+      int c = fuzz.input_pos < fuzz.input_len
+        ? fuzz.input[fuzz.input_pos++]
+        : AVR_EOF;
+      put_word_reg_raw (24, c);
+    }
+  else
+    {
+      unsigned n = fuzz.input_len < fuzz.buf_size
+        ? fuzz.input_len
+        : fuzz.buf_size;
+      for (unsigned i = 0; i < n; ++i)
+        data_write_byte_raw ((fuzz.buf_addr + i) & cpu.ram_valid_mask,
+                             fuzz.input[i]);
+      put_word_reg_raw (24, n);
+    }
+}
+
+// The target requests its input for the first time.
+
+static void
+fuzz_begin (int how, unsigned buf_addr, unsigned buf_size)
+{
+  fuzz_abort_2nd_hits = abort_2nd_hits;
+  fuzz_start (how, buf_addr, buf_size);
+  fuzz_deliver ();
+}
+
+// leave() finished a run and rolled back the machine state.
+
+static void
+fuzz_restart (void)
+{
+  abort_2nd_hits = fuzz_abort_2nd_hits;
+  fuzz_deliver ();
+}
+
+#endif // AVRTEST_FUZZ
+
 static void sys_stdin (void)
 {
+#ifdef AVRTEST_FUZZ
+  if (!fuzz.active)
+    fuzz_begin (FUZZ_STDIN, 0, 0);
+  else if (fuzz.how == FUZZ_STDIN)
+    fuzz_deliver ();
+  else
+    put_word_reg_raw (24, AVR_EOF);
+  return;
+#endif // AVRTEST_FUZZ
+
   if (program.f_stdin)
     {
       log_append ("stdin ");
@@ -1936,15 +2209,73 @@ static void sys_stdin (void)
   }
 }
 
+/* Read at most R22 bytes to RAM at R24 and return the number of bytes read
+   in R24.  avrtest_fuzz supplies the input of the current fuzzing run.
+   The other flavours read from the program's stdin so that an input
+   found by fuzzing can be replayed with -stdin=crash-<N>.data.  */
+
+static void sys_fuzz_input (void)
+{
+  unsigned addr = get_word_reg_raw (24);
+  unsigned len = get_word_reg_raw (22);
+
+  log_append ("fuzz_input ");
+
+#ifdef AVRTEST_FUZZ
+  if (!fuzz.active)
+    fuzz_begin (FUZZ_BUFFER, addr, len);
+  else if (fuzz.how == FUZZ_BUFFER)
+    leave (LEAVE_EXIT, "next fuzzing input requested");
+  else
+    put_word_reg_raw (24, 0);
+#else
+  unsigned n = 0;
+  if (program.f_stdin)
+    {
+      if (IS_AVRTEST_LOG)
+        fflush (stdout);
+      for (int c; n < len && (c = getc (program.f_stdin)) != EOF; ++n)
+        data_write_byte_raw ((addr + n) & cpu.ram_valid_mask, c);
+    }
+  log_append ("%u bytes ", n);
+  put_word_reg (24, n);
+#endif // AVRTEST_FUZZ
+}
+
+/* Links between the cores of -cores=PROGS.  R26 is one of AVRTEST_LINK_*,
+   R24 is the peer core and R22 the byte to send.  Return the result
+   in R24.  */
+
+static void sys_link (uint8_t what)
+{
+  int core = cpu_reg[24];
+  int ret = -1;
+
+  switch (what)
+    {
+    case AVRTEST_LINK_id:    ret = cores.id;      break;
+    case AVRTEST_LINK_cores: ret = cores.n_cores; break;
+    case AVRTEST_LINK_send:  ret = cores_send (core, cpu_reg[22]); break;
+    case AVRTEST_LINK_recv:  ret = cores_recv (core); break;
+    case AVRTEST_LINK_poll:  ret = cores_poll (core); break;
+    }
+
+  log_append ("link %u core %d: %d", what, core, ret);
+  put_word_reg (24, ret);
+}
+
 static void sys_stdout (void)
 {
   if (program.f_stdout)
     {
       log_append ("stdout ");
       char c = (char) get_reg (24);
-      putc (c, program.f_stdout);
-      if (options.do_flush)
-        fflush (program.f_stdout);
+      if (!log_async_putc (c, program.f_stdout))
+        {
+          putc (c, program.f_stdout);
+          if (options.do_flush)
+            fflush (program.f_stdout);
+        }
       if (isprint (c))
         log_append ("'%c'", c);
     }
@@ -2005,6 +2336,7 @@ static void sys_misc (uint8_t what)
         if (options.do_verbose)
           printf (">>> %0*x: copy Flash[0x%x--0x%x] to RAM:0x%x\n", pc_len, pc,
                   rodata_lma, rodata_lma + rodata_len - 1, rodata_vma);
+        fuzz_dirty_range (rodata_vma, rodata_len);
         memcpy (cpu_data + rodata_vma, cpu_flash + rodata_lma, rodata_len);
       }
     }
@@ -2070,6 +2402,8 @@ static OP_FUNC_TYPE func_UNDEF (int id, int opcode1)
        SYSCALL 22:     emulate IEEE single functions. Signature depends on R26.
        SYSCALL 21:     Misc tasks collected in one syscall.
        SYSCALL 20:     Log GPRs, SP and SREG.
+       SYSCALL 13:     sys_link(): avrtest_core_id, avrtest_link_send etc.
+       SYSCALL 12:     size_t avrtest_fuzz_input (void*, size_t)
        SYSCALL 8:      sys_log_dump(): Log 64-bit values.
        SYSCALL 7:      sys_log_dump(): Log values.
        SYSCALL 4:      sys_ticks_cmd(): Cycles, insn. rand, prand.
@@ -2091,6 +2425,11 @@ static OP_FUNC_TYPE func_SYSCALL (int sysno, int rr)
 {
   log_append ("#%d: ", sysno);
 
+  // Syscalls other than avrtest_putchar may print to stdout:  Write
+  // out what -log-async has queued so far.
+  if (sysno != 29)
+    log_async_sync ();
+
   switch (sysno)
     {
     default:
@@ -2110,6 +2449,8 @@ static OP_FUNC_TYPE func_SYSCALL (int sysno, int rr)
     case 23: sys_emul_double (cpu_reg[26]); break;
     case 26: sys_fileio();     break;
     // ...above.
+    case 12: sys_fuzz_input(); break;
+    case 13: sys_link (cpu_reg[26]); break;
     case 21: sys_misc (cpu_reg[26]);        break;
     case 24: sys_stderr();     break;
     case 25: sys_abort_2nd_hit(); break;
@@ -2122,6 +2463,7 @@ static OP_FUNC_TYPE func_SYSCALL (int sysno, int rr)
     // Only supported by avrtest_log.
     case 0: case 1: case 2: case 3:  // Logging control
     case 5: case 6:                  // Performance metering
+    case 14:                         // Perf regions
     case 9: case 10: case 11:        // Logging push / pop
       log_do_syscall (sysno, get_word_reg_raw (24));
       break;
@@ -2143,6 +2485,24 @@ const opcode_t opcodes[] =
 // ----------------------------------------------------------------------------
 //     main execution loop
 
+// program.max_insns has been reached.  This is either -m MAXCOUNT, the
+// next lockstep sync point of -quantum=N, or a checkpoint of -sample=N.
+
+static void NOINLINE
+insns_limit_reached (void)
+{
+  if (sample_reached ())
+    return;
+
+  if (cores.sync_insns
+      && !(cores.max_insns && program.n_insns >= cores.max_insns))
+    cores_sync ();
+  else
+    leave (LEAVE_TIMEOUT, "instruction count limit reached");
+
+  sample_schedule ();
+}
+
 static INLINE void
 do_step (void)
 {
@@ -2163,7 +2523,7 @@ do_step (void)
   log_dump_line (&d);
 
   if (max_insns && program.n_insns >= max_insns)
-    leave (LEAVE_TIMEOUT, "instruction count limit reached");
+    insns_limit_reached ();
   program.n_insns++;
 }
 
@@ -2185,20 +2545,57 @@ main (int argc, char *argv[])
 
   parse_args (argc, argv);
 
-  if (options.do_runtime)
+#ifdef AVRTEST_FUZZ
+  if (options.do_cores)
+    leave (LEAVE_USAGE, "-cores=PROGS is not supported by avrtest_fuzz");
+  if (options.do_sample)
+    leave (LEAVE_USAGE, "-sample=N is not supported by avrtest_fuzz");
+#endif
+  // Fork one process per additional core.
+  cores_init ();
+
+  if (options.do_runtime || options.do_result)
     gettimeofday (&t_load, NULL);
 
-  load_to_flash (program.name, cpu_flash, cpu_data, cpu_eeprom);
+  sample_init ();
+
+  const image_t image = { cpu_flash, cpu_data, cpu_eeprom, decoded_flash };
+  bool cached = image_cache_load (&image);
 
-  if (options.do_runtime)
+  if (!cached)
+    load_to_flash (program.name, cpu_flash, cpu_data, cpu_eeprom);
+
+  if (options.do_runtime || options.do_result)
     gettimeofday (&t_decode, NULL);
 
-  decode_flash (decoded_flash, cpu_flash);
+  if (!cached)
+    {
+      decode_flash (decoded_flash, cpu_flash);
+      image_cache_store (&image);
+    }
 
-  if (options.do_runtime)
+  if (options.do_runtime || options.do_result)
     gettimeofday (&t_execute, NULL);
 
   log_init (t_start.tv_usec + t_start.tv_sec);
+
+#ifdef AVRTEST_FUZZ
+#if defined (ISA_XMEGA) || defined (ISA_TINY)
+  fuzz_init (cpu_data, cpu_reg, MAX_RAM_SIZE, t_start.tv_usec + t_start.tv_sec);
+#else
+  // The GPRs are part of RAM.
+  fuzz_init (cpu_data, NULL, MAX_RAM_SIZE, t_start.tv_usec + t_start.tv_sec);
+#endif
+
+  // leave() jumps back here to start the next fuzzing run.
+  if (setjmp (fuzz_jmp))
+    {
+      fuzz_restart ();
+      for (;;)
+        do_step();
+    }
+#endif // AVRTEST_FUZZ
+
   execute();
 
   return EXIT_SUCCESS;
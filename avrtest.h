@@ -55,6 +55,12 @@ enum
     PERF_TAG_FMT_CMD, PERF_TAG_PFMT_CMD
   };
 
+enum
+  {
+    PERF_REGION_BEGIN_CMD, PERF_REGION_PBEGIN_CMD,
+    PERF_REGION_END_CMD
+  };
+
 enum
   {
     AVRTEST_fopen, AVRTEST_fclose,
@@ -64,6 +70,12 @@ enum
     AVRTEST_fseek, AVRTEST_fflush
   };
 
+enum
+  {
+    AVRTEST_LINK_id, AVRTEST_LINK_cores,
+    AVRTEST_LINK_send, AVRTEST_LINK_recv, AVRTEST_LINK_poll
+  };
+
 enum
   {
     AVRTEST_sin, AVRTEST_asin, AVRTEST_sinh, AVRTEST_asinh,
@@ -323,6 +335,11 @@ enum
 #define PERF_START_CALL_ALL   PERF_START_CALL (0)
 #define PERF_DUMP_ALL         PERF_DUMP (0)
 
+/* Named, nested perf regions.  NAME is a string in RAM resp. flash */
+#define PERF_REGION_BEGIN(NAME)  avrtest_syscall_14_s ((NAME), PERF_REGION_BEGIN_CMD)
+#define PERF_REGION_PBEGIN(NAME) avrtest_syscall_14_s ((NAME), PERF_REGION_PBEGIN_CMD)
+#define PERF_REGION_END()        avrtest_syscall_14 (PERF_REGION_END_CMD)
+
 /* Perf-meter Min/Max on value from program */
 #define PERF_STAT_U32(n,x)   avrtest_syscall_5_u ((x), PERF_CMD_((n),STAT_U32))
 #define PERF_STAT_S32(n,x)   avrtest_syscall_5_s ((x), PERF_CMD_((n),STAT_S32))
@@ -545,6 +562,10 @@ AVRTEST_DEF_SYSCALL2 (_6_l,  6,  __INT32_TYPE__, 20, unsigned char, 24)
 AVRTEST_DEF_SYSCALL2 (_6_ul, 6, __UINT32_TYPE__, 20, unsigned char, 24)
 AVRTEST_DEF_SYSCALL2 (_6_f,  6, float, 20, unsigned char, 24)
 
+/* PERF_REGION */
+AVRTEST_DEF_SYSCALL1 (_14, 14, unsigned char, 24)
+AVRTEST_DEF_SYSCALL2 (_14_s, 14, const volatile char*, 20, unsigned char, 24)
+
 /* Logging values */
 AVRTEST_DEF_SYSCALL1 (_7, 7, unsigned char, 24)
 AVRTEST_DEF_SYSCALL2 (_7_a, 7, const volatile void*, 20, unsigned char, 24)
@@ -591,6 +612,9 @@ AVRTEST_DEF_SYSCALL2 (_8_d64, 8,          double, 18, unsigned char, 26)
 AVRTEST_DEF_SYSCALL2 (_8_l64, 8,     long double, 18, unsigned char, 26)
 #endif
 
+/* Links between cores */
+AVRTEST_DEF_SYSCALL2_1m (_13, 13, int, 24, unsigned char, 24, unsigned char, 22)
+
 /* Misc stuff all in 21 */
 AVRTEST_DEF_SYSCALL2 (_21a, 21, unsigned char, 26, unsigned char, 24)
 static AT_INLINE void avrtest_misc_flmap (unsigned char _flmap)
@@ -992,6 +1016,62 @@ avrtest_abort_2nd_hit (void)
   avrtest_syscall_25 ();
 }
 
+/* Read at most _LEN bytes to _BUF and return the number of bytes read.
+   avrtest_fuzz supplies the input of the current fuzzing run, the other
+   flavours read from -stdin.  */
+static AT_INLINE __SIZE_TYPE__
+avrtest_fuzz_input (void *_buf, __SIZE_TYPE__ _len)
+{
+  register __SIZE_TYPE__ _r24 __asm ("24") = (__SIZE_TYPE__) _buf;
+  register __SIZE_TYPE__ _r22 __asm ("22") = _len;
+  __asm __volatile__ (".long %2 ;; SYSCALL %1"
+                      : "+r" (_r24)
+                      : "n" (12), "n" (SYSCo_12), "r" (_r22)
+                      : "memory");
+  return _r24;
+}
+
+
+/* Links between the cores that are simulated with -cores=PROGS.
+   avrtest_core_id returns the number of this core, where the main
+   program runs as core 0, and avrtest_n_cores returns the number of
+   simulated cores.  */
+static AT_INLINE int
+avrtest_core_id (void)
+{
+  return avrtest_syscall_13 (AVRTEST_LINK_id, 0, 0);
+}
+
+static AT_INLINE int
+avrtest_n_cores (void)
+{
+  return avrtest_syscall_13 (AVRTEST_LINK_cores, 0, 0);
+}
+
+/* Send byte _C to core _CORE.  Blocks while the link is full.  Returns 0,
+   or -1 when _CORE is invalid or has already finished.  */
+static AT_INLINE int
+avrtest_link_send (unsigned char _core, unsigned char _c)
+{
+  return avrtest_syscall_13 (AVRTEST_LINK_send, _core, _c);
+}
+
+/* Receive a byte from core _CORE.  Blocks until a byte is available.
+   Returns -1 when _CORE is invalid, or when it has finished and there
+   are no more bytes to receive.  */
+static AT_INLINE int
+avrtest_link_recv (unsigned char _core)
+{
+  return avrtest_syscall_13 (AVRTEST_LINK_recv, _core, 0);
+}
+
+/* Return the number of bytes that avrtest_link_recv can receive from
+   core _CORE without blocking, or -1 as with avrtest_link_recv.  */
+static AT_INLINE int
+avrtest_link_poll (unsigned char _core)
+{
+  return avrtest_syscall_13 (AVRTEST_LINK_poll, _core, 0);
+}
 
 static AT_INLINE __UINT32_TYPE__
 avrtest_fileio_p (unsigned char _what, const void *_pargs)
@@ -1093,6 +1173,9 @@ avrtest_reset_all (void)
 #define AVRTEST_EXIT   avrtest_syscall 30
 #define AVRTEST_ABORT_2ND_HIT avrtest_syscall 25
 #define AVRTEST_PUTCHAR       avrtest_syscall 29
+#define AVRTEST_FUZZ_INPUT    avrtest_syscall 12
+#define AVRTEST_LINK          avrtest_syscall 13
+#define PERF_REGION           avrtest_syscall 14
 
 #endif /* ASSEMBLER */
 #endif /* AVRTEST_H */
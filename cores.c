@@ -0,0 +1,396 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* Co-simulation of several programs as with  -cores=PROGS.
+
+   Each core is simulated by its own process, which is forked from the
+   main avrtest process before the programs are loaded.  The cores talk
+   to each other over links, which are single-producer single-consumer
+   byte queues in memory that is shared between the processes.  The
+   queues are lock-free: only the producer writes the head index, only
+   the consumer writes the tail index, hence no lock is ever taken.
+
+   With -quantum=N, the cores run in lockstep:  At sync points that are
+   N/4 instructions apart, a core waits for all running cores that are
+   more than N cycles behind.  Cores that are blocked in a link operation
+   or that have finished do not hold back the others.  */
+
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#if defined (_WIN32)
+#define HAVE_FORK 0
+#else
+#define HAVE_FORK 1
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#include "testavr.h"
+#include "options.h"
+#include "cores.h"
+
+// Each core is the only writer of its own entry.
+typedef struct
+{
+  // Cycle count at the last sync point.
+  uint64_t cycles;
+  // One of CORE_RUNNING, CORE_BLOCKED or CORE_DONE.
+  int state;
+  // When CORE_BLOCKED: The core we are waiting for, and whether we wait
+  // until we can receive from it or until we can send to it.
+  int waits_for;
+  bool waits_recv;
+} __attribute__((__aligned__(64))) core_t;
+
+enum
+  {
+    CORE_RUNNING,
+    CORE_BLOCKED,
+    CORE_DONE
+  };
+
+// A link from one core to another.  The items are the sender's cycle
+// count shifted left by 8, ORed with the data byte.
+typedef struct
+{
+  // Only written by the sending core.
+  uint32_t head __attribute__((__aligned__(64)));
+  // Only written by the receiving core.
+  uint32_t tail __attribute__((__aligned__(64)));
+  uint64_t item[CORES_QUEUE_SIZE];
+} queue_t;
+
+typedef struct
+{
+  core_t core[CORES_MAX];
+  // queue[i][j] is the link from core i to core j.
+  queue_t queue[CORES_MAX][CORES_MAX];
+} shared_t;
+
+#define LOAD(X)     __atomic_load_n (&(X), __ATOMIC_ACQUIRE)
+#define STORE(X, V) __atomic_store_n (&(X), (V), __ATOMIC_RELEASE)
+#define LOAD_SC(X)  __atomic_load_n (&(X), __ATOMIC_SEQ_CST)
+#define STORE_SC(X, V) __atomic_store_n (&(X), (V), __ATOMIC_SEQ_CST)
+
+cores_t cores = { .n_cores = 1 };
+
+// Memory shared by all cores, NULL without -cores=PROGS.
+static shared_t *shared;
+
+#if HAVE_FORK
+// Process IDs of cores 1...n_cores-1 (core 0 only).
+static pid_t pids[CORES_MAX];
+#endif
+
+// First non-zero exit status of the other cores (core 0 only).
+static int others_status;
+
+
+void
+cores_init (void)
+{
+  cores.max_insns = program.max_insns;
+
+  if (!options.do_cores)
+    return;
+
+#if !HAVE_FORK
+  leave (LEAVE_USAGE, "-cores=PROGS is not supported on this host");
+#else
+  int n_progs;
+  char **progs = comma_list_to_array (options.s_cores, &n_progs);
+
+  if (n_progs < 1 || n_progs >= CORES_MAX)
+    leave (LEAVE_USAGE, "-cores=PROGS: between 1 and %d programs expected",
+           CORES_MAX - 1);
+
+  void *mem = mmap (NULL, sizeof (shared_t), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    leave (LEAVE_MEMORY, "out of memory allocating %u bytes for -cores",
+           (unsigned) sizeof (shared_t));
+  shared = (shared_t*) mem;
+
+  cores.n_cores = 1 + n_progs;
+
+  // Don't duplicate output that is still buffered.
+  fflush (NULL);
+
+  for (int i = 1; i < cores.n_cores; i++)
+    {
+      pid_t pid = fork ();
+      if (pid < 0)
+        leave (LEAVE_FATAL, "cannot fork the process for core %d", i);
+
+      if (pid == 0)
+        {
+          const char *p;
+          cores.id = i;
+          program.name = program.short_name = progs[i - 1];
+          if ((p = strrchr (program.short_name, '/')))  program.short_name = p;
+          if ((p = strrchr (program.short_name, '\\'))) program.short_name = p;
+          break;
+        }
+
+      pids[i] = pid;
+    }
+
+  if (cores.quantum)
+    {
+      cores.sync_insns = cores.quantum / 4 ? cores.quantum / 4 : 1;
+      cores_sync ();
+    }
+#endif // HAVE_FORK
+}
+
+
+static void
+relax (unsigned spin)
+{
+#if HAVE_FORK
+  if (spin >= 64)
+    sched_yield ();
+#endif
+}
+
+
+// Lockstep sync point.  Wait until no running core is more than
+// cores.quantum cycles behind us, then set the next sync point.
+
+void
+cores_sync (void)
+{
+  uint64_t now = program.n_cycles;
+  STORE_SC (shared->core[cores.id].cycles, now);
+
+  for (int j = 0; j < cores.n_cores; j++)
+    if (j != cores.id)
+      {
+        const core_t *c = &shared->core[j];
+        for (unsigned spin = 0;
+             LOAD_SC (c->state) == CORE_RUNNING
+               && LOAD_SC (c->cycles) + cores.quantum < now;
+             spin++)
+          relax (spin);
+      }
+
+  uint64_t next = program.n_insns + cores.sync_insns;
+  if (cores.max_insns && next > cores.max_insns)
+    next = cores.max_insns;
+  program.max_insns = next;
+}
+
+
+static bool
+valid_peer (int core)
+{
+  return shared && core >= 0 && core < cores.n_cores && core != cores.id;
+}
+
+
+// Whether core C, which is blocked, could proceed.
+
+static bool
+can_proceed (int c)
+{
+  const core_t *me = &shared->core[c];
+  int p = LOAD_SC (me->waits_for);
+
+  if (LOAD_SC (shared->core[p].state) == CORE_DONE)
+    return true;
+
+  if (LOAD_SC (me->waits_recv))
+    {
+      const queue_t *q = &shared->queue[p][c];
+      return LOAD_SC (q->head) != LOAD_SC (q->tail);
+    }
+  else
+    {
+      const queue_t *q = &shared->queue[c][p];
+      return LOAD_SC (q->head) - LOAD_SC (q->tail) < CORES_QUEUE_SIZE;
+    }
+}
+
+
+// We are blocked.  Follow the chain of cores that wait for each other.
+// If it leads back to us, none of them will ever proceed.
+
+static void
+check_deadlock (void)
+{
+  int c = cores.id;
+
+  for (int i = 0; i < cores.n_cores; i++)
+    {
+      int p = LOAD_SC (shared->core[c].waits_for);
+      if (LOAD_SC (shared->core[p].state) != CORE_BLOCKED
+          || can_proceed (p))
+        return;
+      if (p == cores.id)
+        leave (LEAVE_CODE, "deadlock: core %d waits for core %d which is"
+               " waiting for core %d", cores.id,
+               shared->core[cores.id].waits_for,
+               shared->core[shared->core[cores.id].waits_for].waits_for);
+      c = p;
+    }
+}
+
+
+// Block until we can receive from CORE resp. send to CORE.
+
+static void
+block (int core, bool recv)
+{
+  core_t *me = &shared->core[cores.id];
+
+  STORE_SC (me->waits_for, core);
+  STORE_SC (me->waits_recv, recv);
+  STORE_SC (me->cycles, program.n_cycles);
+  STORE_SC (me->state, CORE_BLOCKED);
+
+  for (unsigned spin = 0; !can_proceed (cores.id); spin++)
+    {
+      if (spin % 1024 == 1023)
+        check_deadlock ();
+      relax (spin);
+    }
+
+  STORE_SC (me->state, CORE_RUNNING);
+}
+
+
+// Send BYTE to CORE.  Return 0 on success and -1 if CORE is not a valid
+// peer or has finished.
+
+int
+cores_send (int core, int byte)
+{
+  if (!valid_peer (core))
+    return -1;
+
+  queue_t *q = &shared->queue[cores.id][core];
+  uint32_t head = q->head;
+
+  if (head - LOAD (q->tail) >= CORES_QUEUE_SIZE)
+    block (core, false);
+
+  if (LOAD (shared->core[core].state) == CORE_DONE)
+    return -1;
+
+  q->item[head % CORES_QUEUE_SIZE] = (program.n_cycles << 8) | (byte & 0xff);
+  STORE_SC (q->head, head + 1);
+
+  return 0;
+}
+
+
+// Receive a byte from CORE.  Return -1 if CORE is not a valid peer or if
+// it has finished and there is nothing more to receive.
+
+int
+cores_recv (int core)
+{
+  if (!valid_peer (core))
+    return -1;
+
+  queue_t *q = &shared->queue[core][cores.id];
+  uint32_t tail = q->tail;
+
+  if (LOAD (q->head) == tail)
+    {
+      block (core, true);
+      if (LOAD_SC (q->head) == tail)
+        return -1;
+    }
+
+  uint64_t item = q->item[tail % CORES_QUEUE_SIZE];
+  STORE_SC (q->tail, tail + 1);
+
+  // In lockstep, we cannot receive before the byte has been sent.
+  if (cores.quantum && (item >> 8) > program.n_cycles)
+    program.n_cycles = item >> 8;
+
+  return item & 0xff;
+}
+
+
+// Return the number of bytes that can be received from CORE without
+// blocking, or -1 if there are none and CORE has finished.
+
+int
+cores_poll (int core)
+{
+  if (!valid_peer (core))
+    return -1;
+
+  const queue_t *q = &shared->queue[core][cores.id];
+  bool done = LOAD_SC (shared->core[core].state) == CORE_DONE;
+  int n = (int) (LOAD_SC (q->head) - q->tail);
+
+  return n == 0 && done ? -1 : n;
+}
+
+
+// This core has finished.  Core 0 waits for the other cores so that
+// its exit status is printed last.
+
+void
+cores_done (void)
+{
+  if (!shared)
+    return;
+
+  STORE_SC (shared->core[cores.id].state, CORE_DONE);
+
+#if HAVE_FORK
+  if (cores.id == 0)
+    {
+      fflush (stdout);
+      for (int i = 1; i < cores.n_cores; i++)
+        {
+          int status;
+          if (waitpid (pids[i], &status, 0) == pids[i]
+              && others_status == 0)
+            others_status = WIFEXITED (status) ? WEXITSTATUS (status) : 1;
+        }
+    }
+#endif // HAVE_FORK
+}
+
+
+// Exit status of avrtest:  The one of core 0 unless that is zero.
+
+int
+cores_exit (int status)
+{
+  return status ? status : others_status;
+}
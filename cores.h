@@ -0,0 +1,59 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+#ifndef CORES_H
+#define CORES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// At most that many programs can be simulated at the same time.
+#define CORES_MAX 8
+
+// Capacity of a link in bytes.  Must be a power of 2.
+#define CORES_QUEUE_SIZE 1024
+
+typedef struct
+{
+  // Number of simulated cores; 1 if -cores=PROGS is not specified.
+  int n_cores;
+  // The core simulated by this process.  Core 0 runs the main program.
+  int id;
+  // From -quantum=N.  If non-zero, a core that gets more than QUANTUM
+  // cycles ahead of a running core waits for it.
+  uint64_t quantum;
+  // The number of instructions between two lockstep sync points.
+  uint64_t sync_insns;
+  // The instruction limit from -m MAXCOUNT, 0 means no limit.
+  uint64_t max_insns;
+} cores_t;
+
+extern cores_t cores;
+
+extern void cores_init (void);
+extern void cores_sync (void);
+extern int cores_send (int core, int byte);
+extern int cores_recv (int core);
+extern int cores_poll (int core);
+extern void cores_done (void);
+extern int cores_exit (int status);
+
+#endif // CORES_H
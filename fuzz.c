@@ -0,0 +1,540 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* Coverage guided fuzzing as performed by the avrtest_fuzz family.
+
+   The target program runs as usual until it requests its input for the
+   first time, either by avrtest_getchar() or by avrtest_fuzz_input().
+   At that point, a snapshot of the machine state is taken.  Each run then
+   feeds one input to the target until the program leaves, whereupon the
+   coverage bitmap is evaluated, the machine state is rolled back to the
+   snapshot and the next input is tried.  Only RAM pages that have been
+   written during a run are restored.
+
+   Inputs that hit new edges (or known edges with a new hit count bucket)
+   are added to the corpus.  Inputs that make the program crash or time
+   out are written to crash-<N>.data resp. timeout-<N>.data files, which
+   can be replayed with  avrtest -stdin=crash-<N>.data ...  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "testavr.h"
+#include "options.h"
+#include "host.h"
+#include "fuzz.h"
+
+#ifndef AVRTEST_FUZZ
+#error no function herein is needed without AVRTEST_FUZZ
+#endif // AVRTEST_FUZZ
+
+// Default for -fuzz-len=N.
+#define FUZZ_DEFAULT_LEN 64
+
+// Inputs are never longer than this.
+#define FUZZ_MAX_LEN 4096
+
+// Number of distinct crash signatures we are keeping track of.
+#define FUZZ_N_CRASHES 256
+
+fuzz_t fuzz;
+
+typedef struct
+{
+  byte *data;
+  unsigned len;
+} input_t;
+
+typedef struct
+{
+  int status;
+  unsigned pc;
+} crash_t;
+
+static struct
+{
+  // Machine state when the input was requested for the first time.
+  byte *data, reg[0x20];
+  program_t program;
+  ticks_port_t ticks_port;
+  unsigned pc;
+} snap;
+
+static struct
+{
+  // RAM and separate register file as handed to fuzz_init().
+  byte *data, *reg;
+  unsigned ram_size, n_pages;
+
+  uint64_t rand_state;
+  unsigned max_len;
+
+  // Edge buckets that have been seen so far.
+  byte virgin[FUZZ_MAP_SIZE];
+  unsigned n_edges;
+
+  input_t *corpus;
+  unsigned n_corpus, n_corpus_alloc;
+
+  // The input of the current run.
+  byte cur[FUZZ_MAX_LEN];
+  unsigned cur_len;
+
+  // The first N_SIGNATURES entries are in use.
+  crash_t crashes[FUZZ_N_CRASHES];
+  unsigned n_signatures, n_crashes, n_timeouts;
+  bool crashes_full;
+  uint64_t n_runs, n_crash_runs;
+
+  struct timeval t_start;
+} fz;
+
+// AFL-style classification of a hit count into a bitmask of buckets:
+// 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128-255.
+static byte count_class[256];
+
+
+static uint32_t
+fuzz_rand (void)
+{
+  // xorshift64*
+  uint64_t x = fz.rand_state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  fz.rand_state = x;
+  return (uint32_t) ((x * UINT64_C (0x2545f4914f6cdd1d)) >> 32);
+}
+
+static unsigned
+fuzz_rand_below (unsigned n)
+{
+  return n ? fuzz_rand () % n : 0;
+}
+
+
+static double
+fuzz_seconds (void)
+{
+  struct timeval t;
+  gettimeofday (&t, NULL);
+  return (double) (t.tv_sec - fz.t_start.tv_sec)
+    + 1e-6 * ((double) t.tv_usec - (double) fz.t_start.tv_usec);
+}
+
+
+static void
+add_to_corpus (const byte *data, unsigned len)
+{
+  if (fz.n_corpus == fz.n_corpus_alloc)
+    {
+      fz.n_corpus_alloc = fz.n_corpus_alloc ? 2 * fz.n_corpus_alloc : 64;
+      fz.corpus = realloc (fz.corpus, fz.n_corpus_alloc * sizeof (input_t));
+      if (!fz.corpus)
+        leave (LEAVE_MEMORY, "out of memory allocating %u corpus entries",
+               fz.n_corpus_alloc);
+    }
+
+  input_t *in = & fz.corpus[fz.n_corpus++];
+  in->len = len;
+  in->data = get_mem (len ? len : 1, 1, "fuzz input");
+  if (len)
+    memcpy (in->data, data, len);
+}
+
+
+static void
+read_corpus_file (const char *filename)
+{
+  FILE *f = fopen (filename, "rb");
+  if (!f)
+    leave (LEAVE_FOPEN, "cannot open -fuzz-corpus file '%s'", filename);
+
+  byte buf[FUZZ_MAX_LEN];
+  size_t len = fread (buf, 1, fz.max_len, f);
+  fclose (f);
+
+  add_to_corpus (buf, (unsigned) len);
+}
+
+
+void
+fuzz_init (byte *data, byte *reg, unsigned ram_size, unsigned seed)
+{
+  fz.data = data;
+  fz.reg = reg;
+  fz.ram_size = ram_size;
+  fz.n_pages = ram_size >> FUZZ_PAGE_BITS;
+  fz.rand_state = 0x9e3779b97f4a7c15ull ^ seed;
+  if (!fz.rand_state)
+    fz.rand_state = 1;
+
+  fz.max_len = fuzz_args.max_len ? fuzz_args.max_len : FUZZ_DEFAULT_LEN;
+  if (fz.max_len > FUZZ_MAX_LEN)
+    fz.max_len = FUZZ_MAX_LEN;
+
+  fuzz.dirty = get_mem (fz.n_pages, sizeof (byte), "fuzz dirty[]");
+  fuzz.dirty_list = get_mem (fz.n_pages, sizeof (unsigned),
+                             "fuzz dirty_list[]");
+
+  for (int c = 1; c < 256; ++c)
+    count_class[c] = c >= 128 ? 0x80 : c >= 32 ? 0x40 : c >= 16 ? 0x20
+      : c >= 8 ? 0x10 : c >= 4 ? 0x08 : c == 3 ? 0x04 : c == 2 ? 0x02 : 0x01;
+
+  // The empty input is always part of the corpus.
+  add_to_corpus (NULL, 0);
+
+  if (options.do_fuzz_corpus)
+    {
+      int n_files;
+      char **files = comma_list_to_array (options.s_fuzz_corpus, &n_files);
+      for (int i = n_files - 1; i >= 0; --i)
+        read_corpus_file (files[i]);
+    }
+
+  gettimeofday (&fz.t_start, NULL);
+}
+
+
+// Mutate fz.cur[] in place.
+
+static void
+mutate (void)
+{
+  static const byte interesting[] =
+    {
+      0x00, 0x01, 0x10, 0x20, 0x40, 0x7f, 0x80, 0xff
+    };
+
+  unsigned n_mutations = 1 + fuzz_rand_below (4);
+
+  for (unsigned m = 0; m < n_mutations; ++m)
+    {
+      unsigned len = fz.cur_len;
+      unsigned pos = fuzz_rand_below (len);
+
+      switch (fuzz_rand_below (len ? 8 : 1))
+        {
+        case 0: // Insert a random byte.
+          if (len < fz.max_len)
+            {
+              pos = fuzz_rand_below (len + 1);
+              memmove (fz.cur + pos + 1, fz.cur + pos, len - pos);
+              fz.cur[pos] = fuzz_rand ();
+              fz.cur_len++;
+            }
+          break;
+        case 1: // Flip a bit.
+          fz.cur[pos] ^= 1u << fuzz_rand_below (8);
+          break;
+        case 2: // Set a random byte.
+          fz.cur[pos] = fuzz_rand ();
+          break;
+        case 3: // Add or subtract a small value.
+          fz.cur[pos] += (byte) (fuzz_rand_below (35) - 17);
+          break;
+        case 4: // Set an interesting value.
+          fz.cur[pos] = interesting[fuzz_rand_below (sizeof (interesting))];
+          break;
+        case 5: // Delete a byte.
+          memmove (fz.cur + pos, fz.cur + pos + 1, len - pos - 1);
+          fz.cur_len--;
+          break;
+        case 6: // Copy a chunk within the input.
+          {
+            unsigned from = fuzz_rand_below (len);
+            unsigned n = 1 + fuzz_rand_below (len - (from > pos ? from : pos));
+            memmove (fz.cur + pos, fz.cur + from, n);
+          }
+          break;
+        case 7: // Splice with the tail of another corpus entry.
+          {
+            const input_t *in = & fz.corpus[fuzz_rand_below (fz.n_corpus)];
+            if (in->len > pos)
+              {
+                unsigned n = in->len - pos;
+                if (pos + n > fz.max_len)
+                  n = fz.max_len - pos;
+                memcpy (fz.cur + pos, in->data + pos, n);
+                fz.cur_len = pos + n;
+              }
+          }
+          break;
+        }
+    }
+}
+
+
+// Choose the input of the next run and make it the current input.
+
+static void
+next_input (void)
+{
+  // Run each corpus entry as is first.
+  bool as_is = fz.n_runs < fz.n_corpus;
+  const input_t *in = as_is
+    ? & fz.corpus[fz.n_runs]
+    : & fz.corpus[fuzz_rand_below (fz.n_corpus)];
+
+  fz.cur_len = in->len <= fz.max_len ? in->len : fz.max_len;
+  memcpy (fz.cur, in->data, fz.cur_len);
+
+  if (!as_is)
+    mutate ();
+
+  fuzz.input = fz.cur;
+  fuzz.input_len = fz.cur_len;
+  fuzz.input_pos = 0;
+}
+
+
+static void
+take_snapshot (void)
+{
+  snap.data = get_mem (fz.ram_size, sizeof (byte), "fuzz snapshot");
+  memcpy (snap.data, fz.data, fz.ram_size);
+  if (fz.reg)
+    memcpy (snap.reg, fz.reg, sizeof (snap.reg));
+  snap.program = program;
+  snap.ticks_port = ticks_port;
+  snap.pc = cpu.pc;
+
+  // Writes during start-up don't need to be rolled back.
+  memset (fuzz.dirty, 0, fz.n_pages);
+  fuzz.n_dirty = 0;
+  fuzz.all_dirty = false;
+}
+
+
+// Roll back the machine state to the snapshot.
+
+static void
+restore_snapshot (void)
+{
+  if (fuzz.all_dirty)
+    {
+      memcpy (fz.data, snap.data, fz.ram_size);
+      memset (fuzz.dirty, 0, fz.n_pages);
+      fuzz.all_dirty = false;
+    }
+  else
+    {
+      for (unsigned i = 0; i < fuzz.n_dirty; ++i)
+        {
+          unsigned page = fuzz.dirty_list[i];
+          size_t offset = (size_t) page << FUZZ_PAGE_BITS;
+          memcpy (fz.data + offset, snap.data + offset, FUZZ_PAGE_SIZE);
+          fuzz.dirty[page] = 0;
+        }
+      // Page 0 holds the GPRs on non-XMEGA, non-TINY devices and
+      // put_reg() doesn't track them.
+      memcpy (fz.data, snap.data, FUZZ_PAGE_SIZE);
+    }
+  fuzz.n_dirty = 0;
+
+  if (fz.reg)
+    memcpy (fz.reg, snap.reg, sizeof (snap.reg));
+  program = snap.program;
+  ticks_port = snap.ticks_port;
+  cpu.pc = snap.pc;
+  fuzz.prev_loc = 0;
+}
+
+
+// Merge the coverage map of the current run into fz.virgin[] and clear it.
+// Return true if the run hit an edge or an edge bucket not seen before.
+
+static bool
+evaluate_coverage (void)
+{
+  bool news = false;
+  const uint64_t *map64 = (const uint64_t*) fuzz.map;
+
+  for (unsigned i = 0; i < FUZZ_MAP_SIZE / 8; ++i)
+    {
+      if (!map64[i])
+        continue;
+
+      for (unsigned j = 8 * i; j < 8 * i + 8; ++j)
+        {
+          byte c = count_class[fuzz.map[j]];
+          if (c & ~fz.virgin[j])
+            {
+              fz.n_edges += fz.virgin[j] == 0;
+              fz.virgin[j] |= c;
+              news = true;
+            }
+        }
+    }
+
+  memset (fuzz.map, 0, sizeof (fuzz.map));
+
+  return news;
+}
+
+
+static void
+print_stats (const char *what)
+{
+  double secs = fuzz_seconds ();
+
+  qprintf ("#%" PRIu64 "\t%s cov: %u corp: %u crashes: %u timeouts: %u"
+           " exec/s: %.0f\n", fz.n_runs, what, fz.n_edges, fz.n_corpus,
+           fz.n_crashes, fz.n_timeouts,
+           secs > 0.001 ? (double) fz.n_runs / secs : 0.0);
+}
+
+
+static void
+save_input (const char *kind, unsigned n)
+{
+  char filename[300];
+  const char *prefix = options.do_fuzz_out ? options.s_fuzz_out : "";
+
+  snprintf (filename, sizeof (filename), "%s%s-%u.data", prefix, kind, n);
+
+  FILE *f = fopen (filename, "wb");
+  if (!f)
+    leave (LEAVE_FOPEN, "cannot open '%s' for writing", filename);
+  fwrite (fz.cur, 1, fz.cur_len, f);
+  fclose (f);
+
+  qprintf ("fuzz: input saved as %s\n", filename);
+}
+
+
+// Record a crashing or timing out input unless we have already seen one
+// with the same signature.  When the table of signatures is full, new
+// signatures are only counted in n_crash_runs.
+
+static void
+record_crash (int status, unsigned pc, const char *reason, va_list args)
+{
+  bool timeout = status == LEAVE_TIMEOUT;
+
+  fz.n_crash_runs++;
+
+  for (unsigned i = 0; i < fz.n_signatures; ++i)
+    if (fz.crashes[i].status == status
+        && (timeout || fz.crashes[i].pc == pc))
+      return;
+
+  if (fz.n_signatures == FUZZ_N_CRASHES)
+    {
+      if (!fz.crashes_full)
+        qprintf ("fuzz: %d crash signatures recorded, further crashes"
+                 " are not saved\n", FUZZ_N_CRASHES);
+      fz.crashes_full = true;
+      return;
+    }
+
+  crash_t *c = & fz.crashes[fz.n_signatures++];
+  c->status = status;
+  c->pc = pc;
+
+  if (!options.do_quiet)
+    {
+      printf ("fuzz: #%" PRIu64 " %s at %06x: ", fz.n_runs,
+              timeout ? "timeout" : "crash", pc);
+      vprintf (reason, args);
+      printf ("\n");
+    }
+
+  if (timeout)
+    save_input ("timeout", ++fz.n_timeouts);
+  else
+    save_input ("crash", ++fz.n_crashes);
+}
+
+
+// The target requested its input for the first time.  Take the snapshot
+// that each run will start from and choose the first input.
+
+void
+fuzz_start (int how, unsigned buf_addr, unsigned buf_size)
+{
+  fuzz.how = how;
+  fuzz.buf_addr = buf_addr;
+  fuzz.buf_size = buf_size;
+
+  if (how == FUZZ_BUFFER && buf_size < fz.max_len)
+    fz.max_len = buf_size;
+
+  if (!program.max_insns)
+    program.max_insns = program.n_insns + FUZZ_DEFAULT_MAX_INSNS;
+
+  take_snapshot ();
+
+  // Don't account edges from start-up code.
+  memset (fuzz.map, 0, sizeof (fuzz.map));
+  fuzz.prev_loc = 0;
+
+  qprintf ("fuzz: input via %s, max. length %u, %u corpus entries,"
+           " snapshot at %06x\n", how == FUZZ_STDIN
+           ? "avrtest_getchar" : "avrtest_fuzz_input",
+           fz.max_len, fz.n_corpus, 2 * cpu.pc);
+
+  fuzz.active = true;
+  next_input ();
+}
+
+
+/* Called by leave() when a run finishes with status STATUS at byte address
+   PC.  Evaluate the run, roll back the machine state and choose the next
+   input.  When all runs are done, leave for good.  */
+
+void
+fuzz_done (int status, unsigned pc, const char *reason, va_list args)
+{
+  fz.n_runs++;
+
+  if (status != LEAVE_EXIT)
+    record_crash (status, pc, reason, args);
+
+  if (evaluate_coverage ()
+      && status == LEAVE_EXIT
+      && fz.n_runs > fz.n_corpus)
+    {
+      add_to_corpus (fz.cur, fz.cur_len);
+      print_stats ("NEW ");
+    }
+  else if (exact_log2 ((unsigned) fz.n_runs) >= 14
+           && fz.n_runs <= UINT32_MAX)
+    print_stats ("pulse");
+
+  restore_snapshot ();
+
+  if (fuzz_args.runs && fz.n_runs >= fuzz_args.runs)
+    {
+      fuzz.active = false;
+      print_stats ("DONE ");
+      if (fz.n_crashes)
+        leave (LEAVE_ABORTED, "fuzzing found %u crashes in %" PRIu64 " runs",
+               fz.n_crashes, fz.n_runs);
+      leave (LEAVE_EXIT, "fuzzing done after %" PRIu64 " runs", fz.n_runs);
+    }
+
+  next_input ();
+}
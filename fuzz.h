@@ -0,0 +1,124 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stdarg.h>
+
+// Size of the edge coverage bitmap.  Must be a power of 2.
+#define FUZZ_MAP_SIZE   (1u << 16)
+
+// RAM is rolled back in chunks of 1 << FUZZ_PAGE_BITS bytes.
+#define FUZZ_PAGE_BITS  8
+#define FUZZ_PAGE_SIZE  (1u << FUZZ_PAGE_BITS)
+
+// Timeout in instructions per run when no -m MAXCOUNT is specified.
+#define FUZZ_DEFAULT_MAX_INSNS 1000000
+
+enum
+  {
+    // The target reads its input by means of avrtest_getchar (syscall 28).
+    FUZZ_STDIN = 28,
+    // The target reads its input by means of avrtest_fuzz_input (syscall 12).
+    FUZZ_BUFFER = 12
+  };
+
+typedef struct
+{
+  // Hit counts of the edges taken during the current run.
+  byte map[FUZZ_MAP_SIZE];
+  // Hashed location of the previous edge, AFL style.
+  uint32_t prev_loc;
+
+  // Whether the snapshot has been taken and the current run is a
+  // fuzzing run, i.e. leave() must start the next run.
+  bool active;
+  // FUZZ_STDIN or FUZZ_BUFFER.
+  int how;
+  // With FUZZ_BUFFER: RAM address and size of the input buffer.
+  unsigned buf_addr, buf_size;
+
+  // The current input and the read position for FUZZ_STDIN.
+  const byte *input;
+  unsigned input_len, input_pos;
+
+  // One byte per RAM page that is non-zero if the page has been written
+  // during the current run.  dirty_list[] holds the indices of the
+  // n_dirty pages marked in dirty[].
+  byte *dirty;
+  unsigned *dirty_list;
+  unsigned n_dirty;
+  // Set when host code writes a range that is not covered by dirty[],
+  // so that all of RAM has to be restored.
+  bool all_dirty;
+} fuzz_t;
+
+extern fuzz_t fuzz;
+
+extern void fuzz_init (byte *data, byte *reg, unsigned ram_size, unsigned);
+extern void fuzz_start (int how, unsigned buf_addr, unsigned buf_size);
+extern void fuzz_done (int status, unsigned pc, const char *reason, va_list);
+
+#ifdef AVRTEST_FUZZ
+
+// Account a control flow transfer to word address PC.
+
+static INLINE void
+fuzz_edge (unsigned pc)
+{
+  uint32_t cur_loc = ((uint32_t) pc * 0x9e3779b1u) >> 16;
+  fuzz.map[(cur_loc ^ fuzz.prev_loc) & (FUZZ_MAP_SIZE - 1)]++;
+  fuzz.prev_loc = cur_loc >> 1;
+}
+
+// A RAM location is about to be written.
+
+static INLINE void
+fuzz_dirty (unsigned address)
+{
+  unsigned page = address >> FUZZ_PAGE_BITS;
+  if (!fuzz.dirty[page])
+    {
+      fuzz.dirty[page] = 1;
+      fuzz.dirty_list[fuzz.n_dirty++] = page;
+    }
+}
+
+// RAM is about to be changed in a way that dirty[] cannot track.
+
+static INLINE void
+fuzz_dirty_all (void)
+{
+  fuzz.all_dirty = true;
+}
+
+#else
+
+// empty placeholders to keep the rest of the code clean
+
+#define fuzz_edge(...)      (void) 0
+#define fuzz_dirty(...)     (void) 0
+#define fuzz_dirty_all(...) (void) 0
+
+#endif // AVRTEST_FUZZ
+
+#endif // FUZZ_H
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <math.h>
 
@@ -32,6 +33,7 @@
 #include "options.h"
 #include "graph.h"
 #include "host.h"
+#include "logging.h"
 
 #ifndef AVRTEST_LOG
 #error no function herein is needed without AVRTEST_LOG
@@ -108,9 +110,55 @@ typedef struct symbol
   bool is_sub;
   bool is_hidden;
   bool is_skip;
+
+  // -profile
+  struct
+  {
+    // Own and inclusive cycles, own instructions.
+    uint64_t self, incl, insns;
+    // Number of calls and the sum and maximum of their cycles.
+    uint64_t calls, sum, max;
+    // Last walk of profile_account() that added to .incl.
+    unsigned walk;
+  } prof;
+
+  // -callgrind: Whether the name has been written resp. the fn= block.
+  struct
+  {
+    bool named, done;
+  } cg;
+
+  // -stack-report: Maximal stack usage of a call including its callees,
+  // and maximal size of the own frame.
+  struct
+  {
+    int max, self;
+  } stack;
 } symbol_t;
 
 
+// -callgrind: Inclusive costs of the calls along an edge from one call site.
+typedef struct cg_call
+{
+  struct cg_call *next;
+  // Word address of the call.
+  unsigned pc;
+  uint64_t calls, cycles, insns;
+} cg_call_t;
+
+
+// -callgrind: Own costs of a function at an instruction.  Code that is
+// executed by more than one function chains the costs via .next.
+typedef struct cg_cost
+{
+  struct cg_cost *next;
+  symbol_t *sym;
+  // Word address of the instruction.
+  unsigned pc;
+  uint64_t cycles, insns;
+} cg_cost_t;
+
+
 typedef struct edge
 {
   struct edge *next;
@@ -132,9 +180,28 @@ typedef struct edge
   // Hilit if program aborts
   int mark;
   const char *s_tail, *s_label;
+  // -callgrind: The calls along this edge per call site.
+  cg_call_t *cg_calls;
 } edge_t;
 
 
+// -flame: A call stack given by the function on top of it and the path
+// of its caller.  Paths are unique, so that a frame can be accounted
+// without walking the stack.
+typedef struct path
+{
+  // Next in the hash bucket.
+  struct path *next;
+  // The path of the caller, or NULL for the bottom of the stack.
+  struct path *up;
+  symbol_t *sym;
+  // unique id > 0
+  int id;
+  // Own cycles of .sym when called along this path.
+  uint64_t cycles;
+} path_t;
+
+
 typedef struct list
 {
   struct list *next, *prev;
@@ -144,13 +211,37 @@ typedef struct list
   int sp;
   const char *res;
   bool is_leaf, is_sub;
+  // -profile, -callgrind: Cycles and instructions when the frame has
+  // been entered, the word address of the call, and whether the call
+  // has been accounted.
+  uint64_t cycle, insn;
+  unsigned call_pc;
+  bool left;
+  // -flame: The call stack up to and including this frame.
+  path_t *path;
+  // -stack-report: SP after entering the frame, or a higher SP when the
+  // frame sets up the stack anew.  The lowest SP while the frame is on
+  // top of the call stack, and the lowest SP including callees.
+  struct
+  {
+    int top, self_min, min;
+  } stack;
 } list_t;
 
 
+// -stack-report: A frame of the call chain that used the most stack,
+// and the stack usage when it has been entered.
+typedef struct
+{
+  symbol_t *sym;
+  int depth;
+} chain_t;
+
+
 typedef struct
 {
-  // ID of current instruction.
-  int id, old_id;
+  // The instruction being processed.
+  const meter_t *m;
 
   symbol_t *entry_point, *base, *prologue_saves, *epilogue_restores;
   symbol_t *setjmp, *longjmp;
@@ -165,12 +256,29 @@ typedef struct
   } main_return;
   bool no_startup_cycles;
   bool entered;
+  // -stack-report: The maximal stack usage and the call chain that
+  // used it, from the bottom to the top.
+  struct
+  {
+    int depth, n_chain, n_alloc;
+    chain_t *chain;
+  } deepest;
 } graph_t;
 
 
 // Word address --> string_t that holds the symbol or NULL.
 static symbol_t *func_sym[MAX_FLASH_SIZE/2];
 
+// -callgrind: Word address --> own costs of the functions executing it.
+static cg_cost_t *cg_costs;
+
+// -flame: Hash table of all paths, and the paths in the order they have
+// been created.
+#define PPRIM 4099
+static path_t *pbucket[PPRIM];
+static path_t **paths;
+static int n_paths;
+
 #define EPRIM 43
 static edge_t *ebucket[EPRIM];
 
@@ -218,6 +326,36 @@ get_edge (symbol_t *from, symbol_t *to)
 }
 
 
+// -flame: Return the path for a call of SYM from path UP.
+
+static path_t*
+get_path (path_t *up, symbol_t *sym)
+{
+  unsigned hash = (unsigned) ((up ? up->id : 0) * 31u + sym->id) % PPRIM;
+
+  for (path_t *p = pbucket[hash]; p != NULL; p = p->next)
+    if (p->up == up && p->sym == sym)
+      return p;
+
+  if (n_paths % 1024 == 0)
+    {
+      paths = realloc (paths, (n_paths + 1024) * sizeof (path_t*));
+      if (!paths)
+        leave (LEAVE_MEMORY, "out of memory");
+    }
+
+  path_t *p = get_mem (1, sizeof (path_t), "-flame path");
+  p->up = up;
+  p->sym = sym;
+  p->id = 1 + n_paths;
+  p->next = pbucket[hash];
+  pbucket[hash] = p;
+  paths[n_paths++] = p;
+
+  return p;
+}
+
+
 static void
 lmark_edges (list_t *from, list_t *to, unsigned mask)
 {
@@ -273,6 +411,7 @@ lpush (list_t **head, edge_t *e)
   l->edge = e;
   if (e)
     l->sym = e->to;
+  l->left = false;
   l->prev = NULL;
   l->next = *head;
   if (l->next)
@@ -281,6 +420,10 @@ lpush (list_t **head, edge_t *e)
 }
 
 
+static void profile_leave (list_t*, const meter_t*);
+static void stack_enter (list_t*);
+static void stack_leave (const list_t*);
+
 /* Remove first element of list *HEAD and add it to the free list `yfree'.  */
 
 static void
@@ -291,6 +434,14 @@ lpop (list_t **head)
   if (!l)
     return;
 
+  if (head == &ystack
+      && (options.do_profile || options.do_callgrind || options.do_timeline))
+    profile_leave (l, graph.m);
+
+  if (head == &ystack
+      && options.do_stack_report)
+    stack_leave (l);
+
   if (l->next)
     l->next->prev = NULL;
   *head = l->next;
@@ -518,7 +669,7 @@ graph_elf_symbol (const char *name, size_t stoff, unsigned pc, bool is_func)
 /* Called from ELF reader as it is traversing the symbol table.  */
 
 static void
-graph_set_string_table (char *stab, size_t size, int n_entries)
+graph_set_string_table (const char *stab, size_t size, int n_entries)
 {
   string_table.have = get_mem (size, sizeof (bool), "string_table.have");
 
@@ -560,6 +711,16 @@ graph_finish_string_table (void)
 
   lpush (&ystack, graph.entry_edge = get_edge (graph.entry_point, entry));
   yend = ystack;
+  ystack->cycle = ystack->insn = 0;
+  ystack->call_pc = cpu.pc;
+  entry->prof.calls++;
+  if (options.do_flame)
+    ystack->path = get_path (NULL, entry);
+  stack_enter (ystack);
+
+  if (options.do_callgrind)
+    cg_costs = get_mem (MAX_FLASH_SIZE / 2, sizeof (cg_cost_t),
+                        "-callgrind costs");
 
   // -graph-base=BASE is turned on but we did not yet see a BASE function.
   // Try special value "0" which stands for program entry and integer
@@ -655,8 +816,8 @@ static void
 account_cycles (void)
 {
   static uint64_t cycle;
-  unsigned cycles = (unsigned) (program.n_cycles - cycle);
-  cycle = program.n_cycles;
+  unsigned cycles = (unsigned) (graph.m->cycles - cycle);
+  cycle = graph.m->cycles;
 
   // Find a "base" symbol from bottom of callstack as end point
   list_t *l, *base = lfind_base (true);
@@ -709,11 +870,214 @@ traverse_edge (symbol_t *from, symbol_t *to, int delta, bool back)
 }
 
 
+/* -profile:  Account the cycles and instructions since the last change of
+   the call stack to the function on top of the call stack, and to the
+   inclusive cycles of all functions on the call stack.  */
+
+static void
+profile_account (void)
+{
+  static uint64_t cycle, insn;
+  static unsigned walk;
+  uint64_t cycles = graph.m->cycles - cycle;
+  uint64_t insns = graph.m->insns - insn;
+  cycle = graph.m->cycles;
+  insn = graph.m->insns;
+
+  if (!ystack)
+    return;
+
+  ystack->sym->prof.self += cycles;
+  ystack->sym->prof.insns += insns;
+
+  // Recursive functions are on the call stack more than once.
+  walk++;
+  for (list_t *l = ystack; l; l = l->next)
+    if (l->sym->prof.walk != walk)
+      {
+        l->sym->prof.walk = walk;
+        l->sym->prof.incl += cycles;
+      }
+}
+
+
+// -profile, -callgrind, -timeline:  The call of L->sym ends after the
+// instruction described by M.
+
+static void
+profile_leave (list_t *l, const meter_t *m)
+{
+  if (l->left)
+    return;
+
+  // Frames that are resurrected, like the one of main, are only
+  // accounted once.
+  l->left = true;
+
+  uint64_t cycles = m->cycles - l->cycle;
+  l->sym->prof.sum += cycles;
+  if (cycles > l->sym->prof.max)
+    l->sym->prof.max = cycles;
+
+  if (options.do_timeline)
+    timeline_call (l->sym->name, l->cycle, cycles);
+
+  if (options.do_callgrind)
+    {
+      cg_call_t *c = l->edge->cg_calls;
+      while (c && c->pc != l->call_pc)
+        c = c->next;
+      if (!c)
+        {
+          c = get_mem (1, sizeof (cg_call_t), "-callgrind call");
+          c->pc = l->call_pc;
+          c->next = l->edge->cg_calls;
+          l->edge->cg_calls = c;
+        }
+      c->calls++;
+      c->cycles += cycles;
+      c->insns += m->insns - l->insn;
+    }
+}
+
+
+/* -callgrind:  Account the instruction described by graph.m to the own
+   costs of the function on top of the call stack.  */
+
+static void
+callgrind_account (void)
+{
+  static uint64_t cycle, insn;
+  const meter_t *m = graph.m;
+  uint64_t cycles = m->cycles - cycle;
+  uint64_t insns = m->insns - insn;
+  cycle = m->cycles;
+  insn = m->insns;
+
+  // At exit, the last instruction might have been accounted already.
+  if (!cycles && !insns)
+    return;
+
+  symbol_t *sym = ystack->sym;
+  cg_cost_t *c = & cg_costs[m->old_pc];
+
+  if (c->sym && c->sym != sym)
+    {
+      cg_cost_t *d = c->next;
+      while (d && d->sym != sym)
+        d = d->next;
+      if (!d)
+        {
+          d = get_mem (1, sizeof (cg_cost_t), "-callgrind costs");
+          d->next = c->next;
+          c->next = d;
+        }
+      c = d;
+    }
+
+  c->sym = sym;
+  c->pc = m->old_pc;
+  c->cycles += cycles;
+  c->insns += insns;
+}
+
+
+/* -stack-report:  Frame L has just been pushed.  */
+
+static void
+stack_enter (list_t *l)
+{
+  l->stack.top = l->stack.self_min = l->stack.min = l->sp;
+}
+
+
+/* -stack-report:  The call of L->sym ends.  Its callees have already
+   passed their lowest SP up to L.  */
+
+static void
+stack_leave (const list_t *l)
+{
+  int self = l->stack.top - l->stack.self_min;
+  int incl = l->stack.top - l->stack.min;
+
+  if (self > l->sym->stack.self)
+    l->sym->stack.self = self;
+  if (incl > l->sym->stack.max)
+    l->sym->stack.max = incl;
+
+  if (l->next && l->stack.min < l->next->stack.min)
+    l->next->stack.min = l->stack.min;
+}
+
+
+/* -stack-report:  SP is the stack pointer after the current instruction.
+   Account it to the frame on top of the call stack, and remember the
+   call chain when the stack is deeper than ever before.  */
+
+static void
+stack_account (int sp)
+{
+  list_t *l = ystack;
+
+  if (sp > l->stack.top)
+    {
+      // The frame sets up the stack, like the startup code does.
+      l->stack.top = l->stack.self_min = l->stack.min = sp;
+      return;
+    }
+
+  if (sp < l->stack.self_min)
+    l->stack.self_min = sp;
+  if (sp < l->stack.min)
+    l->stack.min = sp;
+
+  int depth = yend->stack.top - sp;
+  if (depth <= graph.deepest.depth)
+    return;
+
+  graph.deepest.depth = depth;
+  graph.deepest.n_chain = 0;
+  for (l = yend; l; l = l->prev)
+    {
+      if (graph.deepest.n_chain == graph.deepest.n_alloc)
+        {
+          graph.deepest.n_alloc += 64;
+          graph.deepest.chain = realloc (graph.deepest.chain,
+                                         graph.deepest.n_alloc
+                                         * sizeof (chain_t));
+          if (!graph.deepest.chain)
+            leave (LEAVE_MEMORY, "out of memory");
+        }
+      chain_t *c = & graph.deepest.chain[graph.deepest.n_chain++];
+      c->sym = l->sym;
+      c->depth = yend->stack.top - l->stack.top;
+    }
+}
+
+
+/* -flame:  Account the cycles since the last change of the call stack
+   to the path of the function on top of it.  */
+
+static void
+flame_account (void)
+{
+  static uint64_t cycle;
+  ystack->path->cycles += graph.m->cycles - cycle;
+  cycle = graph.m->cycles;
+}
+
+
 static void
 update_call_stack (symbol_t *sym, int delta, bool is_longjmp)
 {
   list_t *l;
-  int sp = get_nonglitch_SP();
+  int sp = graph.m->sp;
+
+  if (options.do_profile)
+    profile_account ();
+
+  if (options.do_flame)
+    flame_account ();
 
   account_cycles ();
 
@@ -748,7 +1112,8 @@ update_call_stack (symbol_t *sym, int delta, bool is_longjmp)
         {
           // Jumping to / calling a location that has no symbol:
           // Cook up a node that has the target address as label.
-          func_sym[cpu.pc] = sym = graph_add_symbol (NULL, cpu.pc, false);
+          unsigned pc = graph.m->pc;
+          func_sym[pc] = sym = graph_add_symbol (NULL, pc, false);
           sym->is_reserved = true;
         }
 
@@ -759,6 +1124,13 @@ update_call_stack (symbol_t *sym, int delta, bool is_longjmp)
       lpush (&ystack, e);
       ystack->depth = depth;
       ystack->sp = sp;
+      ystack->cycle = graph.m->cycles;
+      ystack->insn = graph.m->insns;
+      ystack->call_pc = graph.m->old_pc;
+      sym->prof.calls++;
+      if (options.do_flame)
+        ystack->path = get_path (l->path, sym);
+      stack_enter (ystack);
 
       // Promote some "sticky" properties to callees.
       ystack->is_leaf = (l != NULL
@@ -836,7 +1208,8 @@ update_call_stack (symbol_t *sym, int delta, bool is_longjmp)
           if (T_LONGJMP != from->type)
             {
               // The case is tedious; presumably a __builtin_longjmp.
-              if (!(sym = func_sym[old_PC]))
+              unsigned old_pc = graph.m->old_pc;
+              if (!(sym = func_sym[old_pc]))
                 {
                   // Cook up a hidden symbol so we can connect the
                   // incoming edge (code issues maybe longjmp) to the outgoing
@@ -845,9 +1218,9 @@ update_call_stack (symbol_t *sym, int delta, bool is_longjmp)
                   unsigned len = 3 + strlen (from->name) + strlen (s_longjmp);
                   char *s_name = get_mem (len, sizeof (char), s_longjmp);
                   sprintf (s_name, "%s\\n%s", s_longjmp, from->name);
-                  sym = graph_add_symbol (s_name, old_PC, false);
+                  sym = graph_add_symbol (s_name, old_pc, false);
                   sym->is_hidden = true;
-                  func_sym[old_PC] = sym;
+                  func_sym[old_pc] = sym;
                 }
 
               // Incoming edge: longjmp is a proper function, hence there
@@ -891,9 +1264,10 @@ log_transition (list_t *yold, list_t *ynew, int is_proep, const char *s_pe)
       log_append (" %s \n", s_pe);
     }
   else if (old && new
-           && (old != new || old == func_sym[cpu.pc] || d))
+           && (old != new || old == func_sym[graph.m->pc] || d))
     {
-      const char *s_lj = func_sym[old_PC] && func_sym[old_PC]->is_hidden
+      const symbol_t *old_sym = func_sym[graph.m->old_pc];
+      const char *s_lj = old_sym && old_sym->is_hidden
         ? "longjmp? <-- " : "";
 
       if (d == 0)
@@ -923,20 +1297,44 @@ log_transition (list_t *yold, list_t *ynew, int is_proep, const char *s_pe)
 }
 
 
+// The name of the function that is currently executing, or NULL.
+
+const char*
+graph_current_function (void)
+{
+  meter_async_sync ();
+  return ystack && ystack->sym ? ystack->sym->name : NULL;
+}
+
+
+// -meter-async:  Set the bits of all word addresses that have a symbol.
+
+void
+graph_function_bits (byte *bits)
+{
+  for (unsigned pc = 0; pc < MAX_FLASH_SIZE / 2; pc++)
+    if (func_sym[pc])
+      bits[pc / 8] |= 1u << (pc % 8);
+}
+
+
 /* Track the current call depth for performance metering and to display
    during instruction logging as functions are entered / left.  */
 
 int
-graph_update_call_depth (const decoded_t *deco)
+graph_update_call_depth (const meter_t *m)
 {
-  graph.old_id = graph.id;
-  int id = graph.id = deco->id;
+  int id = m->id;
   int call = 0;
+  graph.m = m;
 
   if (! need.call_depth
       || ! graph.entered)
     return 0;
 
+  if (options.do_callgrind)
+    callgrind_account ();
+
   switch (id)
     {
     case ID_RCALL:
@@ -944,7 +1342,7 @@ graph_update_call_depth (const decoded_t *deco)
       // program might use that instruction just as well for an
       // ordinary call.  We cannot decide what's going on and take
       // the case that's more likely: Offset == 0 is allocating stack.
-      call = deco->op2 != 0;
+      call = m->op2 != 0;
       break;
     case ID_ICALL: case ID_CALL: case ID_EICALL:
       call = 1;
@@ -955,14 +1353,14 @@ graph_update_call_depth (const decoded_t *deco)
     case ID_RET:
       // GCC might use push/push/ret for indirect jump,
       // don't account these for call depth
-      if (graph.old_id != ID_PUSH)
+      if (m->old_id != ID_PUSH)
         call = -1;
       break;
     }
 
-  bool maybe_longjmp = ID_RET == id && ID_PUSH == graph.old_id;
+  bool maybe_longjmp = ID_RET == id && ID_PUSH == m->old_id;
   bool jump_indirect = ID_IJMP == id || ID_EIJMP == id;
-  symbol_t *fun = func_sym[cpu.pc];
+  symbol_t *fun = func_sym[m->pc];
   symbol_t *cur = ystack->sym;
 
   // Pretty-print __prologue_saves__ and __epilogue_restores__ when logging,
@@ -975,16 +1373,16 @@ graph_update_call_depth (const decoded_t *deco)
       && (id == ID_RJMP || id == ID_JMP))
     {
       if (graph.prologue_saves
-          && (unsigned) (cpu.pc - graph.prologue_saves->pc) <= 18)
+          && (unsigned) (m->pc - graph.prologue_saves->pc) <= 18)
         pro_ep = graph.prologue_saves;
 
       if (graph.epilogue_restores
-          && (unsigned) (cpu.pc - graph.epilogue_restores->pc) <= 18)
+          && (unsigned) (m->pc - graph.epilogue_restores->pc) <= 18)
         pro_ep = graph.epilogue_restores;
 
       if ((is_proep = NULL != pro_ep))
         {
-          int n_regs = cpu.pc - pro_ep->pc;
+          int n_regs = m->pc - pro_ep->pc;
           sprintf (s_pe, "%s + 0x%x (%d regs)", pro_ep->name,
                    2 * n_regs, 18 - n_regs);
         }
@@ -1002,8 +1400,7 @@ graph_update_call_depth (const decoded_t *deco)
     maybe_longjmp = jump_indirect;
   else if (maybe_longjmp || jump_indirect)
     {
-      int sp = get_nonglitch_SP();
-      maybe_longjmp = ystack && sp > ystack->sp;
+      maybe_longjmp = ystack && m->sp > ystack->sp;
     }
 
   // Entering main.  main is somewhat special in C programs.
@@ -1011,7 +1408,7 @@ graph_update_call_depth (const decoded_t *deco)
     {
       graph.main_return.n_call ++;
       if (call == 1)
-        graph.main_return.pc = old_PC + opcodes[id].size;
+        graph.main_return.pc = m->old_pc + opcodes[id].size;
       graph.no_startup_cycles = !graph.n_cycles;
     }
 
@@ -1019,10 +1416,10 @@ graph_update_call_depth (const decoded_t *deco)
 
   if ((main_returns
        = (fun && (fun == graph.exit || fun == graph._exit)
-          && graph.old_id == ID_RET
+          && m->old_id == ID_RET
           && (id == ID_JMP || id == ID_RJMP)
           && graph.main_return.n_call == 1
-          && graph.main_return.pc == old_PC
+          && graph.main_return.pc == m->old_pc
           && yfree && yfree->sym == graph.main
           && ystack && ystack->sym == yfree->edge->from)))
     {
@@ -1042,6 +1439,9 @@ graph_update_call_depth (const decoded_t *deco)
   if (changed || maybe_longjmp)
     update_call_stack (fun, call, maybe_longjmp);
 
+  if (options.do_stack_report)
+    stack_account (m->sp);
+
   if (main_returns
       && ystack
       && (ystack->sym == graph.exit || ystack->sym == graph._exit))
@@ -1049,14 +1449,12 @@ graph_update_call_depth (const decoded_t *deco)
       // main returns.  If immediately after return from main exit or _exit
       // are entered, show an edge from main to the respective function.
       static char str[20];
-      byte *r24 = cpu_address (24, AR_REG);
-      int16_t ret_val = r24[0] | (r24[1] << 8);
-      sprintf (str, "return %d", ret_val);
+      sprintf (str, "return %d", (int16_t) m->r24);
       ystack->edge->s_label = str;
       ystack->edge->mark |= EM_MAIN_RET | EM_DASHED;
     }
 
-  if (!log_unused)
+  if (m->log)
     log_transition (yold, ystack, is_proep, s_pe);
 
   if (is_proep == 2)
@@ -1210,11 +1608,13 @@ make_dot_filename (void)
 
 
 void
-graph_write_dot (void)
+graph_write_dot (const meter_t *m)
 {
   if (!graph.entered)
     return;
 
+  graph.m = m;
+
   const char *fname = make_dot_filename ();
   FILE *fdot = fname ? fopen (fname, "w") : stdout;
 
@@ -1235,7 +1635,7 @@ graph_write_dot (void)
                   || 0 != program.exit_value);
 
   // Add artificial node and edge representing program termination.
-  symbol_t *exit_point = graph_add_symbol ("Program Stop", old_PC, false);
+  symbol_t *exit_point = graph_add_symbol ("Program Stop", m->old_pc, false);
   exit_point->type = T_TERMINATE;
   exit_point->is_reserved = true;
   update_call_stack (exit_point, 0, false);
@@ -1275,3 +1675,437 @@ graph_write_dot (void)
   if (fdot != stdout)
     fclose (fdot);
 }
+
+
+// -profile:  Sort by own cycles, then by inclusive cycles.
+
+static int
+cmp_profile (const void *a, const void *b)
+{
+  const symbol_t *s = * (const symbol_t* const*) a;
+  const symbol_t *t = * (const symbol_t* const*) b;
+
+  if (s->prof.self != t->prof.self)
+    return s->prof.self < t->prof.self ? 1 : -1;
+  if (s->prof.incl != t->prof.incl)
+    return s->prof.incl < t->prof.incl ? 1 : -1;
+  return strcmp (s->name, t->name);
+}
+
+
+static void
+write_profile_table (FILE *out, symbol_t **syms, int n_syms,
+                     const meter_t *m)
+{
+  fprintf (out, "\n--- Profile: %" PRIu64 " cycles\n\n", m->cycles);
+  fprintf (out, "%12s %6s %12s %6s %12s %9s %10s %10s  %s\n",
+           "Self", "%", "Inclusive", "%", "Instr.", "Calls",
+           "Avg/Call", "Max/Call", "Function");
+
+  double total = m->cycles ? (double) m->cycles : 1.0;
+
+  for (int i = 0; i < n_syms; i++)
+    {
+      const symbol_t *s = syms[i];
+      fprintf (out, "%12" PRIu64 " %6.2f %12" PRIu64 " %6.2f %12" PRIu64
+               " %9" PRIu64 " %10" PRIu64 " %10" PRIu64 "  %s\n",
+               s->prof.self, 100.0 * s->prof.self / total,
+               s->prof.incl, 100.0 * s->prof.incl / total,
+               s->prof.insns, s->prof.calls,
+               s->prof.calls ? s->prof.sum / s->prof.calls : 0,
+               s->prof.max, s->name);
+    }
+  fprintf (out, "\n");
+}
+
+
+static void
+write_profile_csv (FILE *out, symbol_t **syms, int n_syms)
+{
+  fprintf (out, "function,self_cycles,inclusive_cycles,self_instructions,"
+           "calls,avg_cycles_per_call,max_cycles_per_call\n");
+
+  for (int i = 0; i < n_syms; i++)
+    {
+      const symbol_t *s = syms[i];
+      fprintf (out, "%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+               ",%.2f,%" PRIu64 "\n", s->name,
+               s->prof.self, s->prof.incl, s->prof.insns, s->prof.calls,
+               s->prof.calls ? (double) s->prof.sum / s->prof.calls : 0.0,
+               s->prof.max);
+    }
+}
+
+
+static void
+write_profile_json (FILE *out, symbol_t **syms, int n_syms,
+                    const meter_t *m)
+{
+  fprintf (out, "{\"program\":");
+  json_string (out, program.name);
+  fprintf (out, ",\"cycles\":%" PRIu64 ",\"functions\":[", m->cycles);
+
+  for (int i = 0; i < n_syms; i++)
+    {
+      const symbol_t *s = syms[i];
+      fprintf (out, "%s\n{\"name\":", i ? "," : "");
+      json_string (out, s->name);
+      fprintf (out, ",\"self_cycles\":%" PRIu64
+               ",\"inclusive_cycles\":%" PRIu64
+               ",\"self_instructions\":%" PRIu64 ",\"calls\":%" PRIu64
+               ",\"avg_cycles_per_call\":%.2f"
+               ",\"max_cycles_per_call\":%" PRIu64 "}",
+               s->prof.self, s->prof.incl, s->prof.insns, s->prof.calls,
+               s->prof.calls ? (double) s->prof.sum / s->prof.calls : 0.0,
+               s->prof.max);
+    }
+  fprintf (out, "]}\n");
+}
+
+
+/* -profile[=FILE]:  Print the flat profile after the program has finished.
+   FILE with suffix .csv resp. .json gets CSV resp. JSON.  */
+
+void
+graph_profile (const meter_t *m)
+{
+  if (!graph.entered)
+    {
+      qprintf ("*** -profile: no function symbols\n");
+      return;
+    }
+
+  graph.m = m;
+  profile_account ();
+
+  // Calls that are still running end now.
+  for (list_t *l = ystack; l; l = l->next)
+    profile_leave (l, m);
+
+  int n_syms = 0;
+  symbol_t **syms = NULL;
+  for (unsigned pc = 0; pc < MAX_FLASH_SIZE / 2; pc++)
+    {
+      symbol_t *s = func_sym[pc];
+      if (s && !s->is_hidden && (s->prof.calls || s->prof.incl))
+        {
+          if (n_syms % 256 == 0)
+            {
+              syms = realloc (syms, (n_syms + 256) * sizeof (symbol_t*));
+              if (!syms)
+                leave (LEAVE_MEMORY, "out of memory");
+            }
+          syms[n_syms++] = s;
+        }
+    }
+
+  qsort (syms, n_syms, sizeof (symbol_t*), cmp_profile);
+
+  const char *fname = options.do_profile_filename
+    && !str_eq ("", options.s_profile_filename)
+    && !str_eq ("-", options.s_profile_filename)
+    ? options.s_profile_filename
+    : NULL;
+
+  FILE *out = fname ? fopen (fname, "w") : stdout;
+  if (!out)
+    leave (LEAVE_FATAL, "cannot open \"%s\" for writing", fname);
+
+  log_async_sync ();
+
+  const char *dot = fname ? strrchr (fname, '.') : NULL;
+  if (dot && str_eq (dot, ".csv"))
+    write_profile_csv (out, syms, n_syms);
+  else if (dot && str_eq (dot, ".json"))
+    write_profile_json (out, syms, n_syms, m);
+  else
+    write_profile_table (out, syms, n_syms, m);
+
+  fflush (out);
+  if (out != stdout)
+    fclose (out);
+  free (syms);
+}
+
+
+// -callgrind:  Write "(ID) NAME" for the first reference to S, else "(ID)".
+
+static void
+write_cg_name (FILE *out, const char *key, symbol_t *s)
+{
+  fprintf (out, "%s=(%d)", key, s->id);
+  if (!s->cg.named)
+    fprintf (out, " %s", s->name);
+  fprintf (out, "\n");
+  s->cg.named = true;
+}
+
+
+// -callgrind:  Write the calls from S.
+
+static void
+write_cg_calls (FILE *out, symbol_t *s)
+{
+  for (int i = 0; i < EPRIM; i++)
+    for (edge_t *e = ebucket[i]; e != NULL; e = e->next)
+      if (e->from == s)
+        for (const cg_call_t *c = e->cg_calls; c; c = c->next)
+          {
+            write_cg_name (out, "cfn", e->to);
+            fprintf (out, "calls=%" PRIu64 " 0x%x\n", c->calls, 2 * e->to->pc);
+            fprintf (out, "0x%x %" PRIu64 " %" PRIu64 "\n", 2 * c->pc,
+                     c->cycles, c->insns);
+          }
+}
+
+
+static int
+cmp_cg_cost (const void *a, const void *b)
+{
+  const cg_cost_t *c = * (const cg_cost_t* const*) a;
+  const cg_cost_t *d = * (const cg_cost_t* const*) b;
+
+  if (c->sym->id != d->sym->id)
+    return c->sym->id < d->sym->id ? -1 : 1;
+  return c->pc < d->pc ? -1 : c->pc > d->pc;
+}
+
+
+/* -callgrind=FILE:  Write the costs per function and instruction together
+   with the calls in the format of Valgrind's callgrind tool, so that
+   KCachegrind can display them.  Positions are byte addresses.  */
+
+void
+graph_callgrind (const meter_t *m)
+{
+  if (!graph.entered)
+    {
+      qprintf ("*** -callgrind: no function symbols\n");
+      return;
+    }
+
+  graph.m = m;
+
+  // The instruction that ended the program, and calls that are still
+  // running end now.
+  callgrind_account ();
+  for (list_t *l = ystack; l; l = l->next)
+    profile_leave (l, m);
+
+  // Collect the costs and sort them by function, then by address.
+  int n_costs = 0;
+  uint64_t cycles = 0, insns = 0;
+  for (unsigned pc = 0; pc < MAX_FLASH_SIZE / 2; pc++)
+    for (cg_cost_t *c = & cg_costs[pc]; c && c->sym; c = c->next)
+      n_costs++;
+
+  cg_cost_t **costs = get_mem (1 + n_costs, sizeof (cg_cost_t*),
+                               "-callgrind costs");
+  n_costs = 0;
+  for (unsigned pc = 0; pc < MAX_FLASH_SIZE / 2; pc++)
+    for (cg_cost_t *c = & cg_costs[pc]; c && c->sym; c = c->next)
+      {
+        costs[n_costs++] = c;
+        cycles += c->cycles;
+        insns += c->insns;
+      }
+
+  qsort (costs, n_costs, sizeof (cg_cost_t*), cmp_cg_cost);
+
+  const char *fname = options.s_callgrind;
+  FILE *out = str_eq ("-", fname) ? stdout : fopen (fname, "w");
+  if (!out)
+    leave (LEAVE_FATAL, "cannot open \"%s\" for writing", fname);
+
+  log_async_sync ();
+
+  fprintf (out, "# callgrind format\n"
+           "version: 1\n"
+           "creator: avrtest\n"
+           "cmd: %s\n"
+           "positions: instr\n"
+           "events: Cycles Instructions\n"
+           "summary: %" PRIu64 " %" PRIu64 "\n", program.name, cycles, insns);
+
+  symbol_t *sym = NULL;
+  for (int i = 0; i < n_costs; i++)
+    {
+      const cg_cost_t *c = costs[i];
+      if (c->sym != sym)
+        {
+          if (sym)
+            write_cg_calls (out, sym);
+          sym = c->sym;
+          sym->cg.done = true;
+          fprintf (out, "\n");
+          write_cg_name (out, "fn", sym);
+        }
+      fprintf (out, "0x%x %" PRIu64 " %" PRIu64 "\n", 2 * c->pc,
+               c->cycles, c->insns);
+    }
+  if (sym)
+    write_cg_calls (out, sym);
+
+  // Functions without own costs that call others, like "Entry Point".
+  for (int i = 0; i < EPRIM; i++)
+    for (edge_t *e = ebucket[i]; e != NULL; e = e->next)
+      if (e->cg_calls && !e->from->cg.done)
+        {
+          e->from->cg.done = true;
+          fprintf (out, "\n");
+          write_cg_name (out, "fn", e->from);
+          write_cg_calls (out, e->from);
+        }
+
+  fflush (out);
+  if (out != stdout)
+    fclose (out);
+  free (costs);
+}
+
+
+/* -flame=FILE:  Write one line per call stack with the names of the
+   functions from the bottom to the top of the stack, separated by ';',
+   followed by the own cycles of the top function along that stack.
+   This is the "folded" format as used by flamegraph.pl.  */
+
+void
+graph_flame (const meter_t *m)
+{
+  if (!graph.entered)
+    {
+      qprintf ("*** -flame: no function symbols\n");
+      return;
+    }
+
+  graph.m = m;
+  flame_account ();
+
+  const char *fname = options.s_flame;
+  FILE *out = str_eq ("-", fname) ? stdout : fopen (fname, "w");
+  if (!out)
+    leave (LEAVE_FATAL, "cannot open \"%s\" for writing", fname);
+
+  log_async_sync ();
+
+  const symbol_t **syms = NULL;
+  int n_alloc = 0;
+
+  for (int i = 0; i < n_paths; i++)
+    {
+      const path_t *p = paths[i];
+      if (!p->cycles)
+        continue;
+
+      int depth = 0;
+      for (const path_t *q = p; q; q = q->up)
+        {
+          if (depth == n_alloc)
+            {
+              n_alloc += 256;
+              syms = realloc (syms, n_alloc * sizeof (symbol_t*));
+              if (!syms)
+                leave (LEAVE_MEMORY, "out of memory");
+            }
+          syms[depth++] = q->sym;
+        }
+
+      while (depth--)
+        fprintf (out, "%s%c", syms[depth]->name, depth ? ';' : ' ');
+      fprintf (out, "%" PRIu64 "\n", p->cycles);
+    }
+
+  fflush (out);
+  if (out != stdout)
+    fclose (out);
+  free (syms);
+}
+
+
+/* -timeline=FILE:  Calls that are still running end now.  Then finish
+   the trace events.  */
+
+void
+graph_timeline (const meter_t *m)
+{
+  if (graph.entered)
+    for (list_t *l = ystack; l; l = l->next)
+      profile_leave (l, m);
+
+  timeline_finish ();
+}
+
+
+// -stack-report:  Sort by stack usage, then by size of the own frame.
+
+static int
+cmp_stack (const void *a, const void *b)
+{
+  const symbol_t *s = * (const symbol_t* const*) a;
+  const symbol_t *t = * (const symbol_t* const*) b;
+
+  if (s->stack.max != t->stack.max)
+    return s->stack.max < t->stack.max ? 1 : -1;
+  if (s->stack.self != t->stack.self)
+    return s->stack.self < t->stack.self ? 1 : -1;
+  return strcmp (s->name, t->name);
+}
+
+
+/* -stack-report:  Print the maximal stack usage per function including
+   its callees and the maximal size of its own frame, followed by the call
+   chain that used the most stack.  Usage is in bytes below the SP after
+   the function has been entered, i.e. without the return address.  */
+
+void
+graph_stack_report (const meter_t *m)
+{
+  if (!graph.entered)
+    {
+      qprintf ("*** -stack-report: no function symbols\n");
+      return;
+    }
+
+  graph.m = m;
+
+  // Calls that are still running end now.
+  for (list_t *l = ystack; l; l = l->next)
+    stack_leave (l);
+
+  int n_syms = 0;
+  symbol_t **syms = NULL;
+  for (unsigned pc = 0; pc < MAX_FLASH_SIZE / 2; pc++)
+    {
+      symbol_t *s = func_sym[pc];
+      if (s && !s->is_hidden && s->prof.calls)
+        {
+          if (n_syms % 256 == 0)
+            {
+              syms = realloc (syms, (n_syms + 256) * sizeof (symbol_t*));
+              if (!syms)
+                leave (LEAVE_MEMORY, "out of memory");
+            }
+          syms[n_syms++] = s;
+        }
+    }
+
+  qsort (syms, n_syms, sizeof (symbol_t*), cmp_stack);
+
+  log_async_sync ();
+
+  printf ("\n--- Stack report: %d bytes\n\n", graph.deepest.depth);
+  printf ("%10s %10s %9s  %s\n", "Max.Stack", "Own Frame", "Calls",
+          "Function");
+  for (int i = 0; i < n_syms; i++)
+    printf ("%10d %10d %9" PRIu64 "  %s\n", syms[i]->stack.max,
+            syms[i]->stack.self, syms[i]->prof.calls, syms[i]->name);
+
+  printf ("\n--- Deepest call chain: %d bytes\n\n", graph.deepest.depth);
+  printf ("%10s  %s\n", "Depth", "Function");
+  for (int i = 0; i < graph.deepest.n_chain; i++)
+    printf ("%10d  %*s%s\n", graph.deepest.chain[i].depth, 2 * i, "",
+            graph.deepest.chain[i].sym->name);
+  printf ("\n");
+
+  free (syms);
+}
@@ -26,7 +26,14 @@
 
 #include <stdbool.h>
 
-extern int graph_update_call_depth (const decoded_t*);
-extern void graph_write_dot (void);
+extern int graph_update_call_depth (const meter_t*);
+extern void graph_write_dot (const meter_t*);
+extern void graph_profile (const meter_t*);
+extern void graph_callgrind (const meter_t*);
+extern void graph_flame (const meter_t*);
+extern void graph_timeline (const meter_t*);
+extern void graph_stack_report (const meter_t*);
+extern void graph_function_bits (byte*);
+extern const char* graph_current_function (void);
 
 #endif // GRAPH_H
@@ -45,6 +45,18 @@
       printf (FMT, __VA_ARGS__);                                \
   } while (0)
 
+// -timeline:  Pass what LOGPRINT printed to the timeline.  VAL points to
+// the numeric value or is NULL.
+#define LOGVALUE(VAL, FMT, ...)                                 \
+  do {                                                          \
+    if (sim.log_value)                                          \
+      {                                                         \
+        char text_[LEN_LOG_STRING + 100];                       \
+        snprintf (text_, sizeof (text_), FMT, __VA_ARGS__);     \
+        sim.log_value (FMT, text_, VAL);                        \
+      }                                                         \
+  } while (0)
+
 
 ATTR_PRINTF(1,2)
 static void log_add_ (const char *fmt, ...)
@@ -62,6 +74,20 @@ static void log_add_ (const char *fmt, ...)
         log_add_ (__VA_ARGS__); \
     } while (0)
 
+// LOGPRINT as a function.
+ATTR_PRINTF(1,2)
+static void log_print_ (const char *fmt, ...)
+{
+  va_list args, args2;
+  va_start (args, fmt);
+  va_copy (args2, args);
+  vfprintf (program.log_stream, fmt, args);
+  if (!log_unused && program.log_stream != stdout)
+    vprintf (fmt, args2);
+  va_end (args2);
+  va_end (args);
+}
+
 #define str_append(str, ...)                    \
   sprintf ((str) + strlen (str), __VA_ARGS__)
 
@@ -319,6 +345,7 @@ void
 set_mem_value (int addr, int n_regs, uint64_t val)
 {
   byte *p = cpu_address (addr, AR_RAM);
+  fuzz_dirty_range (addr, n_regs);
   for (int i = 0; i < n_regs; ++i)
     {
       *p++ = val & 0xff;
@@ -377,10 +404,97 @@ int32_t get_mem_s32 (int r) { return get_mem_value (r, &layout[LOG_S32_CMD]); }
 int64_t get_mem_s64 (int r) { return get_mem_value (r, &layout[LOG_S64_CMD]); }
 
 
+// -regs-diff[=K]:  Default for K.
+#define REGS_DIFF_K 32
+
+// Register contents as of the last dump.
+typedef struct
+{
+  // The GPRs, compared 8 registers at a time.
+  uint64_t gpr[4];
+  uint16_t sp;
+  uint8_t sreg;
+  // Number of dumps since the last full dump, or 0 when a full dump
+  // is due.
+  unsigned n_dumps;
+} regs_shadow_t;
+
+// Shadows for the dumps from -regs and from LOG_REGS, which may go to
+// different streams.
+static regs_shadow_t regs_shadow_log, regs_shadow_sys;
+
+
+/* -regs-diff[=K]:  Print the registers that have changed since the last
+   dump as recorded in SH by means of PRINT, and update SH.  Returns false
+   when a full dump is due instead, which is the case for the first dump
+   and then for each K-th dump.  */
+
+static bool
+log_regs_diff (regs_shadow_t *sh, void (*print)(const char*, ...))
+{
+  if (!options.do_regs_diff)
+    return false;
+
+  const byte *reg = cpu_address (0, AR_REG);
+  uint64_t gpr[4];
+  memcpy (gpr, reg, sizeof (gpr));
+  const uint16_t sp = (cpu.f_data()[addr_SPL]
+                       | (cpu.f_data()[1 + addr_SPL] << 8));
+  const uint8_t sreg = cpu.f_data()[addr_SREG];
+
+  unsigned k = options.do_regs_diff_k ? options.do_regs_diff_k : REGS_DIFF_K;
+  bool full = sh->n_dumps == 0;
+
+  if (!full)
+    {
+      print ("%s", "~~~");
+      bool changed = false;
+
+      for (int w = 0; w < 4; w++)
+        if (gpr[w] != sh->gpr[w])
+          {
+            const byte *old = (const byte*) & sh->gpr[w];
+            for (int regno = 8 * w; regno < 8 * w + 8; regno++)
+              if (reg[regno] != old[regno - 8 * w])
+                {
+                  print (" r%d=%02x", regno, reg[regno]);
+                  changed = true;
+                }
+          }
+
+      if (sp != sh->sp)
+        {
+          print ("  SP=%04x", sp);
+          changed = true;
+        }
+
+      if (sreg != sh->sreg)
+        {
+          print ("  SREG=%02x=", sreg);
+          for (int s = 7; s >= 0; --s)
+            print ("%c", sreg & (1 << s) ? s_SREG[s] : '-');
+          changed = true;
+        }
+
+      print ("%s", changed ? "\n" : " unchanged\n");
+    }
+
+  memcpy (sh->gpr, gpr, sizeof (gpr));
+  sh->sp = sp;
+  sh->sreg = sreg;
+  sh->n_dumps = (sh->n_dumps + 1) % k;
+
+  return !full;
+}
+
+
 void log_regs (void)
 {
   int regno = 10 * is_tiny;
 
+  if (log_regs_diff (& regs_shadow_log, log_add_))
+    return;
+
   log_add ("~~~    ");
   for (int r = 0; r < 10; ++r)
     log_add (" r0%d", r);
@@ -421,6 +535,9 @@ void sys_log_regs (void)
   log_add ("log_regs");
 
   LOGPRINT ("0x%s: GPRs #%lu#\n", pc_string (-4), n_calls);
+  if (log_regs_diff (& regs_shadow_sys, log_print_))
+    return;
+
   LOGPRINT ("%s", "~~~    ");
   for (int r = 0; r < 10; ++r)
     LOGPRINT (" r0%d", r);
@@ -734,15 +851,24 @@ sys_log_dump (int what)
   switch (what)
     {
     default:
-      log_add ("log %d-byte value", lay->size);
-      LOGPRINT (fmt, val);
+      {
+        log_add ("log %d-byte value", lay->size);
+        LOGPRINT (fmt, val);
+        double v = lay->signed_p ? (double) (int) val : (double) val;
+        LOGVALUE (&v, fmt, val);
+      }
       break;
 
     case LOG_S64_CMD:
     case LOG_U64_CMD:
     case LOG_X64_CMD:
-      log_add ("log %d-byte value", lay->size);
-      LOGPRINT (fmt, get_reg_value64 (18, lay));
+      {
+        log_add ("log %d-byte value", lay->size);
+        unsigned long long val64 = get_reg_value64 (18, lay);
+        LOGPRINT (fmt, val64);
+        double v = lay->signed_p ? (double) (long long) val64 : (double) val64;
+        LOGVALUE (&v, fmt, val64);
+      }
       break;
 
     case LOG_SET_FMT_ONCE_CMD:
@@ -769,6 +895,7 @@ sys_log_dump (int what)
       log_add ("log string");
       read_string (string, val, lay->in_rom, sizeof (string));
       LOGPRINT (fmt, string);
+      LOGVALUE (NULL, fmt, string);
       break;
 
     case LOG_FLOAT_CMD:
@@ -776,6 +903,7 @@ sys_log_dump (int what)
         log_add ("log float");
         avr_float_t af = decode_avr_float (val);
         LOGPRINT (fmt, af.x);
+        LOGVALUE (&af.x, fmt, af.x);
       }
       break;
 
@@ -784,6 +912,7 @@ sys_log_dump (int what)
         log_add ("log double");
         avr_float_t af = decode_avr_double (get_reg_value64 (18, lay));
         LOGPRINT (fmt, af.x);
+        LOGVALUE (&af.x, fmt, af.x);
       }
       break;
 
@@ -831,6 +960,7 @@ sys_log_dump (int what)
         str_append (txt, "} = 0x%u.%013" PRIx64 "|%x, expo = %d }",
                     msb, mant, lsn, get_mem_s16 (addr + 1 + n_mant));
         LOGPRINT (fmt, txt);
+        LOGVALUE (NULL, fmt, txt);
       }
       break;
     }
@@ -1049,6 +1179,7 @@ emul_float_misc (uint8_t fid)
         log_add ("emulate %sf(" PRIF ", 0x%04x) = " PRIF, name, x,x, py, z,z);
         set_reg_float (22, z);
         byte *b = cpu_address (py, AR_RAM);
+        fuzz_dirty_range (py, 4);
         memcpy (b, &y, 4);
         log_add (", *0x%04x = " PRIF, py, y,y);
         break;
@@ -1549,6 +1680,7 @@ emul_double_misc (uint8_t fid)
         log_add ("emulate %sl(" PRID ", 0x%04x) = " PRID, name, x,x, py, z,z);
         set_reg_double (18, z);
         byte *b = cpu_address (py, AR_RAM);
+        fuzz_dirty_range (py, 8);
         memcpy (b, &y, 8);
         log_add (", *0x%04x = " PRID, py, y,y);
         break;
@@ -1994,6 +2126,7 @@ static dword host_fread (dword args)
   log_add (" %s (ptr)->%04x (size)->%d (nmemb)->%d", file->name,
            ptr, (int) size, (int) nmemb);
 
+  fuzz_dirty_range (ptr, size * nmemb);
   return fread (cpu_address (ptr, AR_RAM), size, nmemb, file->file);
 }
 
@@ -0,0 +1,235 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* -hotspots[=N]:  Count executions and cycles per instruction and print
+   an annotated listing of the N functions that took the most cycles.
+
+   log_dump_line() calls hotspots_count() for each instruction.  The
+   counters live in an array that is indexed by word address just like
+   decoded_flash[].  A function extends from its symbol up to the next
+   symbol in executable code.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "testavr.h"
+#include "options.h"
+#include "logging.h"
+
+#ifndef AVRTEST_LOG
+#error no function herein is needed without AVRTEST_LOG
+#endif // AVRTEST_LOG
+
+// Default for N in -hotspots=N.
+#define HOTSPOTS_N_FUNCS 10
+
+typedef struct
+{
+  // Number of executions and cycles spent.
+  uint64_t count, cycles;
+  // The instruction as executed.
+  decoded_t d;
+} hot_insn_t;
+
+typedef struct
+{
+  // Symbol name or NULL for code before the first symbol.
+  const char *name;
+  // Word address of the symbol.
+  unsigned pc;
+  bool is_func;
+  // Cycles spent in the code up to the next symbol.
+  uint64_t cycles;
+} hot_func_t;
+
+static struct
+{
+  // Counters per word address.
+  hot_insn_t *insns;
+  // program.n_cycles after the previous instruction.
+  uint64_t cycles;
+  // Symbols in executable code from the ELF file.
+  hot_func_t *funcs;
+  int n_funcs, n_funcs_alloc;
+} hot;
+
+
+/* Called by the ELF loader for each symbol in executable code at word
+   address PC.  Collect them so that the listing can be grouped.  */
+
+void
+hotspots_elf_symbol (const char *name, unsigned pc, bool is_func)
+{
+  if (!options.do_hotspots)
+    return;
+
+  if (hot.n_funcs == hot.n_funcs_alloc)
+    {
+      hot.n_funcs_alloc = hot.n_funcs_alloc ? 2 * hot.n_funcs_alloc : 256;
+      hot.funcs = realloc (hot.funcs, hot.n_funcs_alloc * sizeof (hot_func_t));
+      if (!hot.funcs)
+        leave (LEAVE_MEMORY, "out of memory allocating %u bytes for %s",
+               (unsigned) (hot.n_funcs_alloc * sizeof (hot_func_t)),
+               "-hotspots symbols");
+    }
+
+  hot_func_t *f = & hot.funcs[hot.n_funcs++];
+  f->name = name;
+  f->pc = pc;
+  f->is_func = is_func;
+  f->cycles = 0;
+}
+
+
+void
+hotspots_init (void)
+{
+  if (!options.do_hotspots)
+    return;
+
+  hot.insns = get_mem (MAX_FLASH_SIZE / 2, sizeof (hot_insn_t),
+                       "-hotspots counters");
+}
+
+
+/* The instruction D at word address PC has just been executed.  CYCLES is
+   program.n_cycles after it.  */
+
+void
+hotspots_count (const decoded_t *d, unsigned pc, uint64_t cycles)
+{
+  hot_insn_t *h = & hot.insns[pc];
+  h->count++;
+  h->cycles += cycles - hot.cycles;
+  h->d = *d;
+  hot.cycles = cycles;
+}
+
+
+// Sort symbols by address.  STT_FUNC symbols go first so they win
+// against labels at the same address.
+
+static int
+cmp_symbol (const void *a, const void *b)
+{
+  const hot_func_t *f = (const hot_func_t*) a;
+  const hot_func_t *g = (const hot_func_t*) b;
+
+  if (f->pc != g->pc)
+    return f->pc < g->pc ? -1 : 1;
+  if (f->is_func != g->is_func)
+    return f->is_func ? -1 : 1;
+  return strcmp (f->name, g->name);
+}
+
+
+// Sort functions by cycles, most expensive first.
+
+static int
+cmp_cycles (const void *a, const void *b)
+{
+  const hot_func_t *f = * (const hot_func_t* const*) a;
+  const hot_func_t *g = * (const hot_func_t* const*) b;
+
+  if (f->cycles != g->cycles)
+    return f->cycles < g->cycles ? 1 : -1;
+  return f->pc < g->pc ? -1 : f->pc > g->pc;
+}
+
+
+/* -hotspots[=N]:  Print the listing after the program has finished.  */
+
+void
+hotspots_dump (void)
+{
+  if (!hot.insns)
+    return;
+
+  // funcs[0] collects the code in front of the first symbol.
+  int n_funcs = 1;
+  hot_func_t *funcs = get_mem (1 + hot.n_funcs, sizeof (hot_func_t),
+                               "-hotspots functions");
+  qsort (hot.funcs, hot.n_funcs, sizeof (hot_func_t), cmp_symbol);
+  for (int i = 0; i < hot.n_funcs; i++)
+    if (hot.funcs[i].pc != funcs[n_funcs - 1].pc || n_funcs == 1)
+      funcs[n_funcs++] = hot.funcs[i];
+
+  // Sum up the cycles per function.
+  uint64_t total = 0;
+  for (unsigned pc = 0, i = 0; pc < MAX_FLASH_SIZE / 2; pc++)
+    {
+      while (i + 1 < (unsigned) n_funcs && funcs[i + 1].pc <= pc)
+        i++;
+      funcs[i].cycles += hot.insns[pc].cycles;
+      total += hot.insns[pc].cycles;
+    }
+
+  int n_hot = 0;
+  hot_func_t **hots = get_mem (n_funcs, sizeof (hot_func_t*),
+                               "-hotspots functions");
+  for (int i = 0; i < n_funcs; i++)
+    if (funcs[i].cycles)
+      hots[n_hot++] = & funcs[i];
+  qsort (hots, n_hot, sizeof (hot_func_t*), cmp_cycles);
+
+  int n_show = options.do_hotspots_n ? options.do_hotspots_n
+    : HOTSPOTS_N_FUNCS;
+  if (n_show > n_hot)
+    n_show = n_hot;
+
+  log_async_sync ();
+
+  printf ("\n--- Hotspots: %d of %d functions, %" PRIu64 " cycles\n",
+          n_show, n_hot, total);
+
+  double percent = total ? 100.0 / total : 0.0;
+
+  for (int i = 0; i < n_show; i++)
+    {
+      const hot_func_t *f = hots[i];
+      unsigned end = f + 1 < funcs + n_funcs ? f[1].pc : MAX_FLASH_SIZE / 2;
+
+      printf ("\n%s: %" PRIu64 " cycles, %.2f%%\n",
+              f->name ? f->name : "??", f->cycles, percent * f->cycles);
+      printf ("%12s %12s %6s  %s\n", "Count", "Cycles", "%", "Instruction");
+
+      for (unsigned pc = f->pc; pc < end; pc++)
+        {
+          const hot_insn_t *h = & hot.insns[pc];
+          if (!h->count)
+            continue;
+
+          char text[40];
+          log_disassemble (text, & h->d, pc);
+          printf ("%12" PRIu64 " %12" PRIu64 " %6.2f  %0*x: %s\n",
+                  h->count, h->cycles, percent * h->cycles,
+                  cpu.strlen_pc, 2 * pc, text);
+        }
+    }
+  printf ("\n");
+
+  free (hots);
+  free (funcs);
+}
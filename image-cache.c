@@ -0,0 +1,497 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* Prepared-image cache as enabled by -image-cache DIR.
+
+   Before a program can run, its ELF headers and notes have to be parsed,
+   its symbols have to be classified and the flash image has to be decoded.
+   For the many short runs of a testsuite, the outcome of all that is
+   stored in DIR/<key>.img, where <key> is a hash of the program file and
+   of the options that affect loading.  Subsequent runs of the same program
+   map that file and copy the prepared image into place.
+
+   A cache file consists of an image_header_t followed by the flash image,
+   the decoded flash, the initial RAM and EEPROM contents, the ELF string
+   table and the symbols in the order as the ELF loader reported them.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#if defined (_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "testavr.h"
+#include "options.h"
+#include "image-cache.h"
+
+#define IMAGE_MAGIC "AVRtest image 2"
+
+// The ELF loader only writes RAM below this address:  .data initializers
+// and flash seen in RAM address space.
+#define IMAGE_RAM_END (MAX_RAM_SIZE < 0x10000 ? MAX_RAM_SIZE : 0x10000)
+
+enum
+  {
+    SYM_FUNC,
+    SYM_LABEL,
+    SYM_OBJECT
+  };
+
+typedef struct
+{
+  int32_t addr;
+  uint32_t stoff;
+  uint32_t kind;
+  // st_size of SYM_OBJECT.
+  uint32_t size;
+} image_sym_t;
+
+typedef struct
+{
+  char magic[16];
+  uint64_t key;
+  // Time in microseconds it took to load and decode the program
+  // when this image has been created.
+  uint64_t t_uncached;
+
+  // program_t, cpu_t and arch_t values set by loading and decoding.
+  uint32_t entry_point, size, n_bytes, code_start, code_end, max_pc, pc_mask;
+  uint32_t pc, flash_pm_offset;
+
+  // Flash is stored from 0 to .size, the others from .start to .end.
+  uint32_t decoded_start, decoded_end;
+  uint32_t ram_start, ram_end;
+  uint32_t eeprom_start, eeprom_end;
+
+  // The ELF string table and symbols as passed to sim.*.
+  uint32_t have_strtab, strtab_size, strtab_n_entries;
+  uint32_t n_syms, finish_strtab;
+} image_header_t;
+
+static struct
+{
+  enum { IC_OFF, IC_HIT, IC_MISS, IC_STORED, IC_FAILED } state;
+  char *path;
+  uint64_t key;
+  struct timeval t_start;
+  // Milliseconds to get the image, and as recorded in a hit image.
+  double ms, ms_uncached;
+
+  // What the ELF loader reported to sim.* in the case of a miss.
+  bool have_strtab, finish_strtab, bad_strtab;
+  const char *strtab;
+  size_t strtab_size;
+  int strtab_n_entries;
+  image_sym_t *syms;
+  unsigned n_syms, n_syms_alloc;
+
+  // The original sim.* hooks.
+  void (*set_elf_string_table) (const char*, size_t, int);
+  void (*set_elf_function_symbol) (int, size_t, bool);
+  void (*set_elf_object_symbol) (int, size_t, unsigned);
+  void (*finish_elf_string_table) (void);
+} ic;
+
+
+static double
+ms_since (const struct timeval *t0)
+{
+  struct timeval t1;
+  gettimeofday (&t1, NULL);
+  return 1000. * (t1.tv_sec - t0->tv_sec) + 0.001 * (t1.tv_usec - t0->tv_usec);
+}
+
+
+static uint64_t
+hash_bytes (uint64_t h, const void *data, size_t len)
+{
+  const byte *p = (const byte*) data;
+
+  for (; len >= 8; len -= 8, p += 8)
+    {
+      uint64_t w;
+      memcpy (&w, p, sizeof (w));
+      h = (h ^ w) * 0x100000001b3ull;
+      h ^= h >> 29;
+    }
+
+  for (; len; --len)
+    h = (h ^ *p++) * 0x100000001b3ull;
+
+  return h;
+}
+
+
+// The key of the cached image:  Everything that affects what we'd get
+// from loading and decoding the program.  The build time of avrtest
+// stands in for the decoder's opcode numbering.
+
+static uint64_t
+image_key (void)
+{
+  char opts[200];
+  snprintf (opts, sizeof (opts),
+            "%s %s %zu xmega=%d tiny=%d log=%d sample=%d mmcu=%s pm=%u"
+            " -s=%d -d=%d -e=%d:%u", __DATE__, __TIME__, sizeof (decoded_t),
+            is_xmega, is_tiny, is_avrtest_log, !!options.do_sample, arch.name,
+            arch.flash_pm_offset, options.do_size, options.do_initialize_sram,
+            options.do_entry_point, cpu.pc);
+
+  size_t size;
+  const byte *file = map_program_file (program.name, &size);
+
+  uint64_t h = hash_bytes (0xcbf29ce484222325ull, opts, strlen (opts));
+  return hash_bytes (h, file, size) ^ size;
+}
+
+
+// Range [*pstart, *pend) of non-zero bytes in MEM[0, SIZE).
+
+static void
+non_zero_range (const byte *mem, size_t size, uint32_t *pstart,
+                uint32_t *pend)
+{
+  size_t start = 0, end = size;
+
+  while (start < end && mem[start] == 0)
+    start++;
+  while (end > start && mem[end - 1] == 0)
+    end--;
+
+  *pstart = (uint32_t) start;
+  *pend = (uint32_t) end;
+}
+
+
+// Restore the prepared image from the SIZE bytes of cache file DATA.
+// Return false if the file is not usable.
+
+static bool
+restore_image (const image_t *img, const byte *data, size_t size)
+{
+  image_header_t h;
+
+  if (size < sizeof (h))
+    return false;
+  memcpy (&h, data, sizeof (h));
+
+  if (memcmp (h.magic, IMAGE_MAGIC, sizeof (IMAGE_MAGIC))
+      || h.key != ic.key
+      || h.size > MAX_FLASH_SIZE
+      || h.decoded_start > h.decoded_end
+      || h.decoded_end > MAX_FLASH_SIZE / 2
+      || h.ram_start > h.ram_end
+      || h.ram_end > MAX_RAM_SIZE
+      || h.eeprom_start > h.eeprom_end
+      || h.eeprom_end > MAX_EEPROM_SIZE)
+    return false;
+
+  size_t n_decoded = h.decoded_end - h.decoded_start;
+  size_t n_ram = h.ram_end - h.ram_start;
+  size_t n_eeprom = h.eeprom_end - h.eeprom_start;
+
+  const byte *flash = data + sizeof (h);
+  const byte *decoded = flash + h.size;
+  const byte *ram = decoded + n_decoded * sizeof (decoded_t);
+  const byte *eeprom = ram + n_ram;
+  const char *strtab = (const char*) eeprom + n_eeprom;
+  const byte *syms = (const byte*) strtab + h.strtab_size;
+
+  if ((size_t) (syms - data) + h.n_syms * sizeof (image_sym_t) != size)
+    return false;
+
+  for (uint32_t i = 0; i < h.n_syms; ++i)
+    {
+      image_sym_t sym;
+      memcpy (&sym, syms + i * sizeof (sym), sizeof (sym));
+      if (sym.stoff >= h.strtab_size || sym.kind > SYM_OBJECT)
+        return false;
+    }
+
+  memcpy (img->flash, flash, h.size);
+  memcpy (img->decoded + h.decoded_start, decoded,
+          n_decoded * sizeof (decoded_t));
+  memcpy (img->ram + h.ram_start, ram, n_ram);
+  memcpy (img->eeprom + h.eeprom_start, eeprom, n_eeprom);
+
+  program.entry_point = h.entry_point;
+  program.size = h.size;
+  program.n_bytes = h.n_bytes;
+  program.code_start = h.code_start;
+  program.code_end = h.code_end;
+  program.max_pc = h.max_pc;
+  program.pc_mask = h.pc_mask;
+  cpu.pc = h.pc;
+  arch.flash_pm_offset = h.flash_pm_offset;
+
+  ic.ms_uncached = 0.001 * h.t_uncached;
+
+  // Replay the symbols as if they came from the ELF loader.
+  if (h.have_strtab)
+    sim.set_elf_string_table (strtab, h.strtab_size, h.strtab_n_entries);
+
+  for (uint32_t i = 0; i < h.n_syms; ++i)
+    {
+      image_sym_t sym;
+      memcpy (&sym, syms + i * sizeof (sym), sizeof (sym));
+      if (sym.kind == SYM_OBJECT)
+        sim.set_elf_object_symbol (sym.addr, sym.stoff, sym.size);
+      else
+        sim.set_elf_function_symbol (sym.addr, sym.stoff,
+                                     sym.kind == SYM_FUNC);
+    }
+
+  if (h.finish_strtab)
+    sim.finish_elf_string_table ();
+
+  return true;
+}
+
+
+// Hooks that record what the ELF loader reports to sim.* so that it can
+// be replayed from the cache.
+
+static void
+record_string_table (const char *stab, size_t size, int n_entries)
+{
+  ic.bad_strtab |= ic.have_strtab;
+  ic.have_strtab = true;
+  ic.strtab = stab;
+  ic.strtab_size = size;
+  ic.strtab_n_entries = n_entries;
+  ic.set_elf_string_table (stab, size, n_entries);
+}
+
+static void
+record_symbol (int kind, int addr, size_t stoff, unsigned size)
+{
+  if (ic.n_syms == ic.n_syms_alloc)
+    {
+      ic.n_syms_alloc = ic.n_syms_alloc ? 2 * ic.n_syms_alloc : 256;
+      ic.syms = realloc (ic.syms, ic.n_syms_alloc * sizeof (image_sym_t));
+      if (!ic.syms)
+        leave (LEAVE_MEMORY, "out of memory allocating %u bytes for %s",
+               (unsigned) (ic.n_syms_alloc * sizeof (image_sym_t)),
+               "image cache symbols");
+    }
+
+  image_sym_t *sym = & ic.syms[ic.n_syms++];
+  sym->addr = addr;
+  sym->stoff = (uint32_t) stoff;
+  sym->kind = kind;
+  sym->size = size;
+}
+
+static void
+record_function_symbol (int addr, size_t stoff, bool is_func)
+{
+  record_symbol (is_func ? SYM_FUNC : SYM_LABEL, addr, stoff, 0);
+  ic.set_elf_function_symbol (addr, stoff, is_func);
+}
+
+static void
+record_object_symbol (int addr, size_t stoff, unsigned size)
+{
+  record_symbol (SYM_OBJECT, addr, stoff, size);
+  ic.set_elf_object_symbol (addr, stoff, size);
+}
+
+static void
+record_finish_string_table (void)
+{
+  ic.finish_strtab = true;
+  ic.finish_elf_string_table ();
+}
+
+
+bool
+image_cache_load (const image_t *img)
+{
+  if (!image_cache_dir)
+    return false;
+
+  gettimeofday (&ic.t_start, NULL);
+
+  ic.key = image_key ();
+  ic.path = get_mem (strlen (image_cache_dir) + 30, 1, "image cache path");
+  sprintf (ic.path, "%s/%016" PRIx64 ".img", image_cache_dir, ic.key);
+
+  size_t size;
+  const byte *data = map_file (ic.path, &size);
+
+  if (data && restore_image (img, data, size))
+    {
+      ic.state = IC_HIT;
+      ic.ms = ms_since (&ic.t_start);
+      if (options.do_verbose)
+        printf (">>> Image cache hit: %s\n", ic.path);
+      return true;
+    }
+
+  ic.state = IC_MISS;
+  if (options.do_verbose)
+    printf (">>> Image cache miss: %s\n", ic.path);
+
+  // Record the symbols as the ELF loader is traversing them.
+  ic.set_elf_string_table = sim.set_elf_string_table;
+  ic.set_elf_function_symbol = sim.set_elf_function_symbol;
+  ic.set_elf_object_symbol = sim.set_elf_object_symbol;
+  ic.finish_elf_string_table = sim.finish_elf_string_table;
+
+  sim.set_elf_string_table = record_string_table;
+  sim.set_elf_function_symbol = record_function_symbol;
+  sim.set_elf_object_symbol = record_object_symbol;
+  sim.finish_elf_string_table = record_finish_string_table;
+
+  return false;
+}
+
+
+void
+image_cache_store (const image_t *img)
+{
+  if (ic.state != IC_MISS)
+    return;
+
+  sim.set_elf_string_table = ic.set_elf_string_table;
+  sim.set_elf_function_symbol = ic.set_elf_function_symbol;
+  sim.set_elf_object_symbol = ic.set_elf_object_symbol;
+  sim.finish_elf_string_table = ic.finish_elf_string_table;
+
+  ic.ms = ms_since (&ic.t_start);
+  ic.state = IC_FAILED;
+
+  // More than one string table:  Don't know how to replay that.
+  if (ic.bad_strtab)
+    return;
+
+  image_header_t h;
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, IMAGE_MAGIC, sizeof (IMAGE_MAGIC));
+  h.key = ic.key;
+  h.t_uncached = (uint64_t) (1000 * ic.ms);
+
+  h.entry_point = program.entry_point;
+  h.size = program.size;
+  h.n_bytes = program.n_bytes;
+  h.code_start = program.code_start;
+  h.code_end = program.code_end;
+  h.max_pc = program.max_pc;
+  h.pc_mask = program.pc_mask;
+  h.pc = cpu.pc;
+  h.flash_pm_offset = arch.flash_pm_offset;
+
+  if (program.code_start <= program.code_end)
+    {
+      h.decoded_start = program.code_start / 2;
+      h.decoded_end = 1 + program.code_end / 2;
+    }
+  non_zero_range (img->ram, IMAGE_RAM_END, &h.ram_start, &h.ram_end);
+  non_zero_range (img->eeprom, MAX_EEPROM_SIZE, &h.eeprom_start,
+                  &h.eeprom_end);
+
+  h.have_strtab = ic.have_strtab;
+  h.strtab_size = ic.have_strtab ? ic.strtab_size : 0;
+  h.strtab_n_entries = ic.strtab_n_entries;
+  h.n_syms = ic.n_syms;
+  h.finish_strtab = ic.finish_strtab;
+
+  // Write to a temporary file first so that concurrent runs never see
+  // a partial image.
+  char *tmp = get_mem (strlen (ic.path) + 20, 1, "image cache path");
+  sprintf (tmp, "%s.%u.tmp", ic.path, (unsigned) getpid ());
+
+  FILE *f = fopen (tmp, "wb");
+  if (!f)
+    {
+      if (options.do_verbose)
+        printf (">>> Image cache: cannot write %s\n", tmp);
+      free (tmp);
+      return;
+    }
+
+  bool ok = (fwrite (&h, sizeof (h), 1, f) == 1
+             && fwrite (img->flash, 1, h.size, f) == h.size
+             && fwrite (img->decoded + h.decoded_start, sizeof (decoded_t),
+                        h.decoded_end - h.decoded_start, f)
+             == h.decoded_end - h.decoded_start
+             && fwrite (img->ram + h.ram_start, 1, h.ram_end - h.ram_start, f)
+             == h.ram_end - h.ram_start
+             && fwrite (img->eeprom + h.eeprom_start, 1,
+                        h.eeprom_end - h.eeprom_start, f)
+             == h.eeprom_end - h.eeprom_start
+             && fwrite (ic.strtab, 1, h.strtab_size, f) == h.strtab_size
+             && fwrite (ic.syms, sizeof (image_sym_t), h.n_syms, f)
+             == h.n_syms);
+
+  ok &= fclose (f) == 0;
+
+  if (ok)
+    {
+      // On Windows, rename does not replace an existing file.
+      if (rename (tmp, ic.path) != 0)
+        ok = remove (ic.path) == 0 && rename (tmp, ic.path) == 0;
+    }
+
+  if (ok)
+    ic.state = IC_STORED;
+  else
+    remove (tmp);
+
+  if (options.do_verbose)
+    printf (">>> Image cache: %s %s\n", ok ? "stored" : "cannot write",
+            ic.path);
+
+  free (tmp);
+}
+
+
+void
+image_cache_print_runtime (void)
+{
+  switch (ic.state)
+    {
+    case IC_OFF:
+      break;
+
+    case IC_HIT:
+      printf (" image cache: hit, %.3f ms vs. %.3f ms uncached",
+              ic.ms, ic.ms_uncached);
+      if (ic.ms > 0.001)
+        printf (" = %.1f times faster", ic.ms_uncached / ic.ms);
+      printf ("\n");
+      break;
+
+    case IC_MISS:
+    case IC_STORED:
+    case IC_FAILED:
+      printf (" image cache: miss, %.3f ms to load and decode, image %s\n",
+              ic.ms, ic.state == IC_STORED ? "stored" : "not stored");
+      break;
+    }
+}
@@ -0,0 +1,46 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stdbool.h>
+
+// The memories that make up a prepared image.
+typedef struct
+{
+  byte *flash;
+  byte *ram;
+  byte *eeprom;
+  decoded_t *decoded;
+} image_t;
+
+// -image-cache DIR: Try to restore the prepared image of the program from
+// the cache.  Returns false on a cache miss, in which case the caller
+// loads and decodes the program as usual and then calls
+// image_cache_store() so that the next run will hit.
+extern bool image_cache_load (const image_t*);
+extern void image_cache_store (const image_t*);
+
+// Print the -runtime line of the image cache.
+extern void image_cache_print_runtime (void);
+
+#endif // IMAGE_CACHE_H
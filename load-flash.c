@@ -27,6 +27,16 @@
 #include <stdint.h>
 #include <inttypes.h>
 
+#if defined (_WIN32)
+#define HAVE_MMAP 0
+#else
+#define HAVE_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 #include "testavr.h"
 #include "options.h"
 
@@ -240,6 +250,14 @@ typedef struct
 
 static bool have_strtab;
 
+// The program file as mapped by map_program_file().  The mapping is never
+// released because the ELF string table is used in place.
+static struct
+{
+  const byte *data;
+  size_t size;
+} elf;
+
 // From .note.gnu.avr.devicename if present.
 static bool have_deviceinfo;
 static avr_deviceinfo_t avr_deviceinfo;
@@ -259,9 +277,20 @@ get_elf32_word (const Elf32_Word *v)
   return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
 }
 
-// Load and allocate a string table from SHDR with sh_type = SHT_STRTAB.
-static char*
-load_string_table (FILE *f, const Elf32_Shdr *shdr, Elf32_Word *psh_size,
+// Return a pointer to the N_BYTES at byte offset OFF of the program file,
+// or NULL if the file is too short.
+static const void*
+elf_at (size_t off, size_t n_bytes)
+{
+  return off <= elf.size && n_bytes <= elf.size - off
+    ? elf.data + off
+    : NULL;
+}
+
+// Locate a string table from SHDR with sh_type = SHT_STRTAB in the program
+// file.  The returned table is used in place.
+static const char*
+load_string_table (const Elf32_Shdr *shdr, Elf32_Word *psh_size,
                    const char *name)
 {
   Elf32_Word sh_type = get_elf32_word (&shdr->sh_type);
@@ -271,10 +300,8 @@ load_string_table (FILE *f, const Elf32_Shdr *shdr, Elf32_Word *psh_size,
   Elf32_Off sh_offset = get_elf32_word (&shdr->sh_offset);
   *psh_size = get_elf32_word (&shdr->sh_size);
 
-  char *strtab = get_mem (*psh_size, sizeof (char), name);
-
-  if (fseek (f, sh_offset, SEEK_SET) != 0
-      || fread (strtab, *psh_size, 1, f) != 1)
+  const char *strtab = elf_at (sh_offset, *psh_size);
+  if (!strtab)
     leave (LEAVE_ELF, "%s truncated", name);
 
   return strtab;
@@ -282,8 +309,7 @@ load_string_table (FILE *f, const Elf32_Shdr *shdr, Elf32_Word *psh_size,
 
 // N is the index of SYMTAB in the section headers SHDR.
 static void
-load_symbol_table (FILE *f, const Elf32_Ehdr *ehdr, const Elf32_Shdr *shdr,
-                   int n)
+load_symbol_table (const Elf32_Ehdr *ehdr, const Elf32_Shdr *shdr, int n)
 {
   Elf32_Half e_shnum = get_elf32_half (&ehdr->e_shnum);
 
@@ -296,21 +322,19 @@ load_symbol_table (FILE *f, const Elf32_Ehdr *ehdr, const Elf32_Shdr *shdr,
       || sh_size % sh_entsize != 0)
     leave (LEAVE_ELF, "ELF symbol section header invalid");
 
-  // Read symbol table
+  // Locate symbol table
   size_t n_syms = sh_size / sh_entsize;
-  Elf32_Sym *symtab = get_mem ((unsigned) n_syms, sizeof (Elf32_Sym),
-                               "ELF symbol table");
-  if (fseek (f, sh_offset, SEEK_SET) != 0
-      || fread (symtab, sizeof (Elf32_Sym), n_syms, f) != n_syms)
+  const Elf32_Sym *symtab = elf_at (sh_offset, sh_size);
+  if (!symtab)
     leave (LEAVE_ELF, "ELF symbol table truncated");
 
   // Read string table section header
   if (sh_link >= e_shnum)
     leave (LEAVE_ELF, "ELF section header truncated");
 
-  // Read string table
-  char *strtab = load_string_table (f, &shdr[sh_link], &sh_size,
-                                    "ELF string table");
+  // Locate string table
+  const char *strtab = load_string_table (&shdr[sh_link], &sh_size,
+                                          "ELF string table");
 
   sim.set_elf_string_table (strtab, (size_t) sh_size, (unsigned) n_syms);
 
@@ -341,12 +365,11 @@ load_symbol_table (FILE *f, const Elf32_Ehdr *ehdr, const Elf32_Shdr *shdr,
       else if (type == STT_OBJECT)
         {
           int value = get_elf32_word (&sym->st_value);
-          sim.set_elf_object_symbol (value, name);
+          unsigned size = get_elf32_word (&sym->st_size);
+          sim.set_elf_object_symbol (value, name, size);
         }
     }
 
-  free (symtab);
-
   sim.finish_elf_string_table();
 }
 
@@ -363,41 +386,47 @@ decode_avr_deviceinfo (avr_deviceinfo_t *info)
 // Read and decode a .note.gnu.avr.deviceinfo note.
 // Return TRUE on success.
 static bool
-load_deviceinfo_note (FILE *f, const Elf32_Shdr *shdr)
+load_deviceinfo_note (const Elf32_Shdr *shdr)
 {
   Elf32_Word sh_type = get_elf32_word (&shdr->sh_type);
   if (sh_type != SHT_NOTE)
     leave (LEAVE_FATAL, "expecting a %s section header", s_SHT[SHT_NOTE]);
 
-  // Read the head of the note that contains length information about the
+  // The head of the note contains length information about the
   // fields that follow.
-  Elf32_Off sh_offset = get_elf32_word (&shdr->sh_offset);
-  Elf32_Nhdr nhdr;
-  if (fseek (f, sh_offset, SEEK_SET) != 0
-      || fread (&nhdr, sizeof (nhdr), 1, f) != 1)
+  size_t off = get_elf32_word (&shdr->sh_offset);
+  const Elf32_Nhdr *nhdr = elf_at (off, sizeof (Elf32_Nhdr));
+  if (!nhdr)
     leave (LEAVE_ELF, "ELF note header truncated");
+  off += sizeof (Elf32_Nhdr);
 
-  Elf32_Word n_namesz = get_elf32_word (&nhdr.n_namesz);
-  Elf32_Word n_descsz = get_elf32_word (&nhdr.n_descsz);
-  // Elf32_Word n_type = get_elf32_word (&nhdr.n_type);
+  Elf32_Word n_namesz = get_elf32_word (&nhdr->n_namesz);
+  Elf32_Word n_descsz = get_elf32_word (&nhdr->n_descsz);
+  // Elf32_Word n_type = get_elf32_word (&nhdr->n_type);
 
-  char name[n_namesz];
-  if (fread (name, n_namesz, 1, f) != 1)
+  const char *name = elf_at (off, n_namesz);
+  if (!name || n_namesz == 0)
     leave (LEAVE_ELF, "ELF note name truncated");
-  if (! str_eq (name, "AVR"))
+  off += n_namesz;
+  if (n_namesz < sizeof ("AVR")
+      || memcmp (name, "AVR", sizeof ("AVR")) != 0)
     return false;
 
   avr_deviceinfo_t *info = & avr_deviceinfo;
 
   if (n_descsz <= sizeof (avr_deviceinfo_t))
     leave (LEAVE_ELF, "ELF note descript truncated");
-  if (fread (info, sizeof (avr_deviceinfo_t), 1, f) != 1)
+  const void *desc = elf_at (off, sizeof (avr_deviceinfo_t));
+  if (!desc)
     leave (LEAVE_ELF, "ELF note descript truncated");
+  off += sizeof (avr_deviceinfo_t);
+  memcpy (info, desc, sizeof (avr_deviceinfo_t));
   decode_avr_deviceinfo (info);
 
-  char info_strtab[n_descsz - sizeof (avr_deviceinfo_t)];
-  if (fread (&info_strtab, sizeof (info_strtab), 1, f) != 1
-      || info_strtab[sizeof (info_strtab) - 1] != '\0')
+  size_t info_strtab_size = n_descsz - sizeof (avr_deviceinfo_t);
+  const char *info_strtab = elf_at (off, info_strtab_size);
+  if (!info_strtab
+      || info_strtab[info_strtab_size - 1] != '\0')
     leave (LEAVE_ELF, "ELF note descript strtab truncated");
 
   if (strlen (info_strtab + info->devname_offset) < sizeof (avr_devicename))
@@ -423,20 +452,19 @@ load_deviceinfo_note (FILE *f, const Elf32_Shdr *shdr)
 // `avr_deviceinfo' is read from NOTE section .note.gnu.avr.deviceinfo as
 // provided by AVR-LibC via crt<mcu>.o from crt1/gcrt1.S.
 static void
-load_sections (FILE *f, const Elf32_Ehdr *ehdr, bool load_symtab_p)
+load_sections (const Elf32_Ehdr *ehdr, bool load_symtab_p)
 {
-  char *shstrtab = NULL;
+  const char *shstrtab = NULL;
   Elf32_Word e_shoff = get_elf32_word (&ehdr->e_shoff);
   Elf32_Half e_shnum = get_elf32_half (&ehdr->e_shnum);
   Elf32_Half e_shentsize = get_elf32_half (&ehdr->e_shentsize);
   Elf32_Half e_shstrndx = get_elf32_half (&ehdr->e_shstrndx);
 
-  // Read section headers
+  // Locate section headers
   if (e_shentsize != sizeof (Elf32_Shdr))
     leave (LEAVE_ELF, "ELF section headers invalid");
-  Elf32_Shdr shdr[e_shnum];
-  if (fseek (f, e_shoff, SEEK_SET) != 0
-      || fread (shdr, sizeof (Elf32_Shdr), e_shnum, f) != e_shnum)
+  const Elf32_Shdr *shdr = elf_at (e_shoff, e_shnum * sizeof (Elf32_Shdr));
+  if (!shdr)
     leave (LEAVE_ELF, "ELF section headers truncated");
 
   for (int n = 0; n < e_shnum; n++)
@@ -446,7 +474,7 @@ load_sections (FILE *f, const Elf32_Ehdr *ehdr, bool load_symtab_p)
       if (load_symtab_p
           && sh_type == SHT_SYMTAB)
         {
-          load_symbol_table (f, ehdr, shdr, n);
+          load_symbol_table (ehdr, shdr, n);
           have_strtab = true;
         }
 
@@ -458,7 +486,7 @@ load_sections (FILE *f, const Elf32_Ehdr *ehdr, bool load_symtab_p)
               && e_shstrndx < e_shnum)
             {
               Elf32_Word sz;
-              shstrtab = load_string_table (f, shdr + e_shstrndx, &sz,
+              shstrtab = load_string_table (shdr + e_shstrndx, &sz,
                                             "ELF section header string table");
             }
           if (shstrtab)
@@ -466,12 +494,10 @@ load_sections (FILE *f, const Elf32_Ehdr *ehdr, bool load_symtab_p)
               Elf32_Word sh_name = get_elf32_word (&shdr[n].sh_name);
               const char *name = shstrtab + sh_name;
               if (str_eq (name, NOTE_AVR_DEVICEINFO))
-                have_deviceinfo = load_deviceinfo_note (f, shdr + n);
+                have_deviceinfo = load_deviceinfo_note (shdr + n);
             }
         }
     }
-
-  free (shstrtab);
 }
 
 
@@ -566,31 +592,28 @@ phdr_flags_str (Elf32_Word flags)
 
 
 static void
-load_elf (FILE *f, byte *flash, byte *ram, byte *eeprom)
+load_elf (byte *flash, byte *ram, byte *eeprom)
 {
-  Elf32_Ehdr ehdr;
-  Elf32_Phdr phdr[16];
-
-  rewind (f);
-  if (fread (&ehdr, sizeof (ehdr), 1, f) != 1)
+  const Elf32_Ehdr *ehdr = elf_at (0, sizeof (Elf32_Ehdr));
+  if (!ehdr)
     leave (LEAVE_ELF, "can't read ELF header");
 
-  if (ehdr.e_ident[EI_CLASS] != ELFCLASS32
-      || ehdr.e_ident[EI_DATA] != ELFDATA2LSB
-      || ehdr.e_ident[EI_VERSION] != EV_CURRENT)
+  if (ehdr->e_ident[EI_CLASS] != ELFCLASS32
+      || ehdr->e_ident[EI_DATA] != ELFDATA2LSB
+      || ehdr->e_ident[EI_VERSION] != EV_CURRENT)
     leave (LEAVE_ELF, "bad ELF header");
 
-  if (get_elf32_half (&ehdr.e_type) != ET_EXEC
-      || get_elf32_half (&ehdr.e_machine) != EM_AVR
-      || get_elf32_word (&ehdr.e_version) != EV_CURRENT
-      || get_elf32_half (&ehdr.e_phentsize) != sizeof (Elf32_Phdr))
+  if (get_elf32_half (&ehdr->e_type) != ET_EXEC
+      || get_elf32_half (&ehdr->e_machine) != EM_AVR
+      || get_elf32_word (&ehdr->e_version) != EV_CURRENT
+      || get_elf32_half (&ehdr->e_phentsize) != sizeof (Elf32_Phdr))
     leave (LEAVE_ELF, "ELF file is not an AVR executable");
 
-  int elf_arch = EF_AVR_MACH & get_elf32_word (&ehdr.e_flags);
+  int elf_arch = EF_AVR_MACH & get_elf32_word (&ehdr->e_flags);
 
   if (!options.do_entry_point)
     {
-      unsigned pc = get_elf32_word (&ehdr.e_entry);
+      unsigned pc = get_elf32_word (&ehdr->e_entry);
       // Symbol 'start' is special for the GNU linker:  It is one way to
       // specify the entry point.  This would lead to an error if the
       // program defines a global variable 'start', hence only consider
@@ -607,7 +630,7 @@ load_elf (FILE *f, byte *flash, byte *ram, byte *eeprom)
         }
     }
 
-  load_sections (f, &ehdr, is_avrtest_log);
+  load_sections (ehdr, is_avrtest_log || options.do_sample);
 
   // Some devices deviate from the 0x8000 default for flash_pm_offset, all
   // in avrxmega3.
@@ -625,14 +648,13 @@ load_elf (FILE *f, byte *flash, byte *ram, byte *eeprom)
           arch.flash_pm_offset = 0x4000;
     }
 
-  int nbr_phdr = get_elf32_half (&ehdr.e_phnum);
-  if ((unsigned) nbr_phdr > sizeof (phdr) / sizeof (*phdr))
+  int nbr_phdr = get_elf32_half (&ehdr->e_phnum);
+  if (nbr_phdr > 16)
     leave (LEAVE_ELF, "ELF file contains too many PHDR");
 
-  if (fseek (f, get_elf32_word (&ehdr.e_phoff), SEEK_SET) != 0)
-    leave (LEAVE_ELF, "ELF file truncated");
-  size_t res = fread (phdr, sizeof (Elf32_Phdr), nbr_phdr, f);
-  if (res != (size_t) nbr_phdr)
+  const Elf32_Phdr *phdr = elf_at (get_elf32_word (&ehdr->e_phoff),
+                                   nbr_phdr * sizeof (Elf32_Phdr));
+  if (!phdr)
     leave (LEAVE_ELF, "can't read PHDRs of ELF file");
 
   for (int i = 0; i < nbr_phdr; i++)
@@ -658,9 +680,8 @@ load_elf (FILE *f, byte *flash, byte *ram, byte *eeprom)
           && addr + memsz > MAX_FLASH_SIZE)
         leave (LEAVE_ELF,
                "program is too big to fit in flash");
-      if (fseek (f, get_elf32_word (&phdr[i].p_offset), SEEK_SET) != 0)
-        leave (LEAVE_ELF, "ELF file truncated");
-
+      const byte *segment = elf_at (get_elf32_word (&phdr[i].p_offset),
+                                    filesz);
       program.n_bytes += filesz;
 
       // Read to eeprom
@@ -670,8 +691,9 @@ load_elf (FILE *f, byte *flash, byte *ram, byte *eeprom)
           addr -= EEPROM_VADDR;
           if (addr + filesz > MAX_EEPROM_SIZE)
             leave (LEAVE_ELF, ".eeprom too big to fit in memory");
-          if (fread (eeprom + addr, filesz, 1, f) != 1)
+          if (!segment)
             leave (LEAVE_ELF, "ELF file truncated");
+          memcpy (eeprom + addr, segment, filesz);
           continue;
         }
 
@@ -679,9 +701,10 @@ load_elf (FILE *f, byte *flash, byte *ram, byte *eeprom)
       if (addr >= DATA_VADDR)
         continue;
 
-      // Read to Flash
-      if (fread (flash + addr, filesz, 1, f) != 1)
+      // Copy to Flash
+      if (!segment)
         leave (LEAVE_ELF, "ELF file truncated");
+      memcpy (flash + addr, segment, filesz);
 
       bool is_data_for_sram_init = (vaddr >= DATA_VADDR
                                     && vaddr + filesz -1 <= DATA_VADDR_END);
@@ -742,34 +765,111 @@ load_elf (FILE *f, byte *flash, byte *ram, byte *eeprom)
   check_arch (elf_arch);
 }
 
+// Read file FILENAME in one go.  Used where mmap is not available or
+// fails, e.g. for pipes.
+static const byte*
+read_file (const char *filename, size_t *psize)
+{
+  FILE *fp = fopen (filename, "rb");
+  if (!fp)
+    return NULL;
+
+  byte *data = NULL;
+  size_t size = 0, n_alloc = 0;
+
+  for (;;)
+    {
+      if (size == n_alloc)
+        {
+          n_alloc = n_alloc ? 2 * n_alloc : 1 << 16;
+          data = realloc (data, n_alloc);
+          if (!data)
+            leave (LEAVE_MEMORY, "out of memory allocating %zu bytes for %s",
+                   n_alloc, filename);
+        }
+      size_t n = fread (data + size, 1, n_alloc - size, fp);
+      if (n == 0)
+        break;
+      size += n;
+    }
+  fclose (fp);
+
+  *psize = size;
+  return data;
+}
+
+// Map file FILENAME read-only and return its contents, or NULL if the file
+// cannot be opened.  The mapping is never released.
+const byte*
+map_file (const char *filename, size_t *psize)
+{
+#if HAVE_MMAP
+  int fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat (fd, &st) == 0
+      && S_ISREG (st.st_mode)
+      && st.st_size > 0)
+    {
+      void *p = mmap (NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE,
+                      fd, 0);
+      if (p != MAP_FAILED)
+        {
+          close (fd);
+          *psize = (size_t) st.st_size;
+          return p;
+        }
+    }
+  close (fd);
+#endif // HAVE_MMAP
+
+  return read_file (filename, psize);
+}
+
+// Map program file FILENAME to elf.data[] unless already done, and return it.
+const byte*
+map_program_file (const char *filename, size_t *psize)
+{
+  if (!elf.data)
+    {
+      elf.data = map_file (filename, &elf.size);
+      if (!elf.data)
+        leave (LEAVE_FOPEN, "can't find or read program file");
+    }
+
+  *psize = elf.size;
+  return elf.data;
+}
+
 void
 load_to_flash (const char *filename, byte *flash, byte *ram, byte *eeprom)
 {
-  char buf[EI_NIDENT];
+  size_t size;
 
   program.code_start = -1U;
 
-  FILE *fp = fopen (filename, "rb");
-  if (!fp)
-    leave (LEAVE_FOPEN, "can't find or read program file");
+  map_program_file (filename, &size);
 
-  size_t len = fread (buf, 1, sizeof (buf), fp);
-  if (len == sizeof (buf)
+  const byte *buf = elf_at (0, EI_NIDENT);
+  if (buf
       && buf[0] == 0x7f
       && buf[1] == 'E'
       && buf[2] == 'L'
       && buf[3] == 'F')
     {
-      load_elf (fp, flash, ram, eeprom);
+      load_elf (flash, ram, eeprom);
     }
   else
     {
-      rewind (fp);
-      program.size = program.n_bytes = fread (flash, 1, MAX_FLASH_SIZE, fp);
+      size_t len = elf.size < MAX_FLASH_SIZE ? elf.size : MAX_FLASH_SIZE;
+      if (len)
+        memcpy (flash, elf.data, len);
+      program.size = program.n_bytes = len;
       program.code_start = 0;
       program.code_end = program.size - 1;
     }
-  fclose (fp);
 
   if (options.do_size == -1)
     // Ignore info from .note.gnu.avr.deviceinfo even if we have it.
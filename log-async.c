@@ -0,0 +1,391 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* -log-async[=SIZE]:  Write the instruction log from a separate thread.
+
+   The simulator is the only producer of a ring buffer of SIZE bytes, and
+   the writer thread is its only consumer:  Only the simulator writes the
+   head index, only the writer writes the tail index, hence no lock is
+   ever taken.  The ring holds records of the form (fd, length, data)
+   that the writer hands to the OS with writev() in large batches.
+
+   Program output to stdout (syscall 29) passes through the same ring so
+   that it keeps its place relative to the log.  Everything else that
+   avrtest prints to stdout is printed by syscalls or by leave(), which
+   call log_async_sync() first in order to drain the ring.  */
+
+#define _DEFAULT_SOURCE // nanosleep
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined (_WIN32)
+#define HAVE_PTHREAD 0
+#define STDOUT_FILENO 1
+#else
+#define HAVE_PTHREAD 1
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#endif
+
+#include "testavr.h"
+#include "options.h"
+#include "logging.h"
+
+#ifndef AVRTEST_LOG
+#error no function herein is needed without AVRTEST_LOG
+#endif // AVRTEST_LOG
+
+// Default resp. minimal size of the ring buffer.
+#define LOG_ASYNC_SIZE     (16u << 20)
+#define LOG_ASYNC_SIZE_MIN (64u << 10)
+
+// Maximal number of records written by one writev().
+#define LOG_ASYNC_IOV 256
+
+// Records start at multiples of this.
+#define ALIGN 8
+
+typedef struct
+{
+  // File descriptor to write to, or -1 for padding up to the end of
+  // the ring.
+  int32_t fd;
+  uint32_t len;
+} record_t;
+
+typedef struct
+{
+  // Whether the writer thread is running.
+  bool active;
+  // Whether to drop log lines instead of waiting when the ring is full.
+  bool drop;
+  unsigned long n_dropped;
+  // Whether stdout may hold output that has been printed by stdio and
+  // hence must be flushed before the next record for STDOUT_FILENO.
+  bool stdio_pending;
+
+  byte *ring;
+  size_t size;
+
+  // Running byte counts.  The producer writes .head, the consumer
+  // writes .tail.
+  size_t head __attribute__((__aligned__(64)));
+  size_t tail __attribute__((__aligned__(64)));
+  // Set by the producer when no more records will come.
+  int done __attribute__((__aligned__(64)));
+
+#if HAVE_PTHREAD
+  pthread_t thread;
+#endif
+} log_async_t;
+
+static log_async_t la;
+
+#define LOAD(X)     __atomic_load_n (&(X), __ATOMIC_ACQUIRE)
+#define STORE(X, V) __atomic_store_n (&(X), (V), __ATOMIC_RELEASE)
+
+#if HAVE_PTHREAD
+
+static void
+relax (unsigned spin)
+{
+  if (spin < 64)
+    sched_yield ();
+  else
+    {
+      struct timespec ts = { 0, 50000 };
+      nanosleep (&ts, NULL);
+    }
+}
+
+
+// Write the data of records [TAIL, HEAD) as far as they have the same
+// fd, and return the new tail.
+
+static size_t
+consume (size_t tail, size_t head)
+{
+  struct iovec iov[LOG_ASYNC_IOV];
+  int n_iov = 0;
+  int fd = -1;
+
+  while (tail != head && n_iov < LOG_ASYNC_IOV)
+    {
+      const record_t *r = (const record_t*) (la.ring + (tail & (la.size - 1)));
+      size_t n_bytes = sizeof (record_t) + ((r->len + ALIGN - 1) & -ALIGN);
+
+      if (r->fd >= 0)
+        {
+          if (n_iov && r->fd != fd)
+            break;
+          fd = r->fd;
+          iov[n_iov].iov_base = (void*) (r + 1);
+          iov[n_iov].iov_len = r->len;
+          n_iov++;
+        }
+      tail += n_bytes;
+    }
+
+  struct iovec *v = iov;
+  while (n_iov)
+    {
+      ssize_t n = writev (fd, v, n_iov);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        break; // Nobody to complain to; the output is lost anyway.
+
+      for (; n_iov && (size_t) n >= v->iov_len; v++, n_iov--)
+        n -= v->iov_len;
+      if (n_iov)
+        {
+          v->iov_base = (byte*) v->iov_base + n;
+          v->iov_len -= n;
+        }
+    }
+
+  return tail;
+}
+
+
+static void*
+writer (void *arg)
+{
+  (void) arg;
+
+  for (unsigned spin = 0;; )
+    {
+      size_t head = LOAD (la.head);
+      size_t tail = la.tail;
+
+      if (head != tail)
+        {
+          STORE (la.tail, consume (tail, head));
+          spin = 0;
+        }
+      else if (LOAD (la.done))
+        return NULL;
+      else
+        relax (spin++);
+    }
+}
+
+
+// Wait until the writer has written everything.  This is also used
+// by the signal handler, so only use async-signal-safe functions.
+
+static void
+drain (void)
+{
+  for (unsigned spin = 0; LOAD (la.tail) != la.head; )
+    relax (spin++);
+}
+
+
+// On SIGINT etc. write what has been logged so far, then die.
+
+static void
+on_signal (int sig)
+{
+  if (la.active)
+    drain ();
+  signal (sig, SIG_DFL);
+  raise (sig);
+}
+
+#endif // HAVE_PTHREAD
+
+
+void
+log_async_init (void)
+{
+  if (!options.do_log_async)
+    return;
+
+#if !HAVE_PTHREAD
+  if (options.do_verbose)
+    printf (">>> -log-async ignored: not supported on this host\n");
+#else
+  size_t size = options.do_log_async_size
+    ? (size_t) options.do_log_async_size
+    : LOG_ASYNC_SIZE;
+  for (la.size = LOG_ASYNC_SIZE_MIN; la.size < size; )
+    la.size *= 2;
+
+  la.ring = get_mem (la.size, sizeof (byte), "-log-async buffer");
+  la.drop = options.do_log_drop;
+  la.stdio_pending = true;
+
+  // The writer inherits a signal mask that blocks all signals, so that
+  // on_signal() is run by the simulator.
+  sigset_t all, old;
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  if (pthread_create (&la.thread, NULL, writer, NULL))
+    leave (LEAVE_FATAL, "cannot create the -log-async thread");
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+  la.active = true;
+
+  signal (SIGINT, on_signal);
+  signal (SIGTERM, on_signal);
+#ifdef SIGHUP
+  signal (SIGHUP, on_signal);
+#endif
+
+  // Flush before any atexit function that was registered earlier,
+  // e.g. before trace_flush() closes the -trace file.
+  atexit (log_async_finish);
+#endif // HAVE_PTHREAD
+}
+
+
+// Queue LEN bytes from BUF to be written to FD.  Returns false if the
+// data has been dropped because the ring was full and MAY_DROP is set.
+
+bool
+log_async_write (int fd, const void *buf, size_t len, bool may_drop)
+{
+#if HAVE_PTHREAD
+  // Split large chunks so that they fit the ring in any case.
+  const size_t max_len = la.size / 4;
+  for (; len > max_len; len -= max_len, buf = (const byte*) buf + max_len)
+    log_async_write (fd, buf, max_len, false);
+
+  if (fd == STDOUT_FILENO && la.stdio_pending)
+    {
+      fflush (stdout);
+      la.stdio_pending = false;
+    }
+
+  size_t head = la.head;
+  size_t pos = head & (la.size - 1);
+  size_t n_bytes = sizeof (record_t) + ((len + ALIGN - 1) & -ALIGN);
+  // Records don't wrap around:  Pad up to the end of the ring if needed.
+  size_t n_pad = pos + n_bytes > la.size ? la.size - pos : 0;
+
+  for (unsigned spin = 0;
+       head + n_pad + n_bytes - LOAD (la.tail) > la.size; spin++)
+    {
+      if (may_drop && la.drop)
+        {
+          la.n_dropped++;
+          return false;
+        }
+      relax (spin);
+    }
+
+  if (n_pad)
+    {
+      record_t *pad = (record_t*) (la.ring + pos);
+      pad->fd = -1;
+      pad->len = n_pad - sizeof (record_t);
+      head += n_pad;
+      pos = 0;
+    }
+
+  record_t *r = (record_t*) (la.ring + pos);
+  r->fd = fd;
+  r->len = len;
+  memcpy (r + 1, buf, len);
+
+  STORE (la.head, head + n_bytes);
+#else
+  (void) fd; (void) buf; (void) len; (void) may_drop;
+#endif // HAVE_PTHREAD
+
+  return true;
+}
+
+
+// Log line LEN bytes at LINE, which may be modified, to stdout.
+
+void
+log_async_line (char *line, size_t len)
+{
+  line[len] = '\n';
+  log_async_write (STDOUT_FILENO, line, len + 1, true);
+}
+
+
+// syscall 29: Pass the program's output through the ring if it goes
+// to the same stream like the log.
+
+bool
+log_async_putc (char c, FILE *stream)
+{
+  if (!la.active || stream != stdout)
+    return false;
+
+  log_async_write (STDOUT_FILENO, &c, 1, false);
+  return true;
+}
+
+
+bool
+log_async_active (void)
+{
+  return la.active;
+}
+
+
+// Wait until everything queued so far has been written.  Afterwards,
+// stdio may be used to print to stdout again.
+
+void
+log_async_sync (void)
+{
+#if HAVE_PTHREAD
+  if (la.active)
+    {
+      drain ();
+      la.stdio_pending = true;
+    }
+#endif
+}
+
+
+// Write all pending data and stop the writer thread.
+
+void
+log_async_finish (void)
+{
+#if HAVE_PTHREAD
+  if (!la.active)
+    return;
+
+  STORE (la.done, 1);
+  pthread_join (la.thread, NULL);
+  la.active = false;
+  la.stdio_pending = true;
+
+  if (la.n_dropped)
+    qprintf ("*** -log-drop: %lu log lines dropped\n", la.n_dropped);
+#endif
+}
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <string.h>
 #include <stdbool.h>
@@ -67,21 +68,155 @@ typedef struct
   // Whether this instruction has been logged
   // LOG_PERF: Just log when at least one perf-meter is on
   bool perf_only;
+  // -log-func, -log-range: The current instruction is not logged
+  // because it is out of scope.
+  bool out_of_scope;
+  // -log-sample: Number of bursts so far, instructions left in the
+  // current burst, and the instruction resp. cycle count at which the
+  // next burst starts.
+  unsigned sample_n;
+  unsigned sample_left;
+  uint64_t sample_next;
 } alog_t;
 
+typedef struct
+{
+  const char *name;
+  unsigned pc;
+  bool is_func;
+} log_symbol_t;
+
+// -flight-recorder=N:  An instruction together with the registers, data
+// addresses and flags it has accessed.
+#define FLIGHT_N_MOVS 6
+#define FLIGHT_REG  (1 << 30)
+#define FLIGHT_FLAG (1 << 29)
+
+typedef struct
+{
+  // The instruction and its word address.
+  decoded_t d;
+  unsigned pc;
+  // Number of accesses, only the first FLIGHT_N_MOVS are in .mov[].
+  byte n_movs;
+  struct
+  {
+    // Data address, register number | FLIGHT_REG, or the mask of a
+    // flag that is read | FLIGHT_FLAG.
+    int addr;
+    uint16_t value;
+    byte n_bytes;
+    bool write;
+  } mov[FLIGHT_N_MOVS];
+} flight_t;
+
+// -flight-recorder=N:  The last N instructions in a ring buffer.  Only
+// the data above is recorded; the text is built when it is printed.
+typedef struct
+{
+  flight_t *ring;
+  unsigned size;
+  // Next entry of .ring[], and the entry of the current instruction.
+  unsigned pos;
+  flight_t *cur;
+  uint64_t n_insns;
+} flight_rec_t;
+
+// -log-func=NAMES, -log-range=RANGES:  Only log instructions whose word
+// address is set in .bits[].
+typedef struct
+{
+  // The bitmap, or NULL when there is no restriction.
+  byte *bits;
+  // -log-callees:  SP before the outermost CALL from within the scope,
+  // or 0.  Instructions that run with a lower SP are in scope, too.
+  unsigned callee_SP;
+  // Code symbols collected from the ELF file for -log-func.
+  log_symbol_t *syms;
+  int n_syms, n_syms_alloc;
+} scope_t;
+
 
 unsigned old_PC, old_old_PC;
 need_t need;
 static int maybe_SP_glitch;
 
 static alog_t alog;
+static scope_t scope;
+static flight_rec_t flight;
+
+// Padded mnemonics as printed by log_add_instr(), filled on first use.
+typedef struct
+{
+  // Length of the mnemonic resp. of .text[].
+  byte n_chars, len;
+  // The mnemonic as of "%-7s ".
+  char text[22];
+} mnemo_t;
+
+static mnemo_t mnemos[256];
+
+// Names of the data addresses < 256 as printed by log_add_data_mov():
+// The name of the SFR or the address as of "%02x".
+static char addr_name[256][8];
 
 int
 log_position (void)
 {
+  if (options.do_trace)
+    return trace_position ();
+
   return (int) (alog.pos - alog.data);
 }
 
+/* Hand-rolled formatting of the items that are logged for almost every
+   instruction.  They print the same like the printf formats given in the
+   comments, but they are much faster than vsprintf.  */
+
+static const char hex_digit[] = "0123456789abcdef";
+
+// "%0*x" with N_DIGITS.
+static INLINE char*
+put_hex (char *p, unsigned val, int n_digits)
+{
+  while (n_digits < 8 && (val >> (4 * n_digits)))
+    n_digits++;
+
+  for (int i = n_digits - 1; i >= 0; i--)
+    *p++ = hex_digit[(val >> (4 * i)) & 0xf];
+
+  return p;
+}
+
+// "%d" for 0 <= VAL < 100.
+static INLINE char*
+put_dec2 (char *p, unsigned val)
+{
+  if (val >= 10)
+    *p++ = '0' + val / 10;
+  *p++ = '0' + val % 10;
+
+  return p;
+}
+
+// "->" or "<-".
+static INLINE char*
+put_arrow (char *p, bool write)
+{
+  *p++ = write ? '<' : '-';
+  *p++ = write ? '-' : '>';
+
+  return p;
+}
+
+static INLINE void
+log_end (char *p)
+{
+  *p = '\0';
+  alog.pos = p;
+}
+
+
 void
 log_append (const char *fmt, ...)
 {
@@ -90,7 +225,10 @@ log_append (const char *fmt, ...)
 
   va_list args;
   va_start (args, fmt);
-  alog.pos += vsprintf (alog.pos, fmt, args);
+  if (options.do_trace)
+    trace_text (fmt, args);
+  else
+    alog.pos += vsprintf (alog.pos, fmt, args);
   va_end (args);
 }
 
@@ -100,7 +238,10 @@ log_append_va (const char *fmt, va_list args)
   if (log_unused)
     return;
 
-  alog.pos += vsprintf (alog.pos, fmt, args);
+  if (options.do_trace)
+    trace_string (fmt, args);
+  else
+    alog.pos += vsprintf (alog.pos, fmt, args);
 }
 
 static INLINE int
@@ -215,6 +356,203 @@ int get_nonglitch_SP (void)
 }
 
 
+static INLINE unsigned
+get_SP (void)
+{
+  return cpu.f_data()[addr_SPL] | (cpu.f_data()[1 + addr_SPL] << 8);
+}
+
+
+// Whether the instruction D at cpu.pc is in the scope of -log-func,
+// -log-range and -log-callees.
+
+static INLINE bool
+log_in_scope (const decoded_t *d)
+{
+  unsigned pc = cpu.pc;
+
+  if (scope.bits[pc / 8] & (1u << (pc % 8)))
+    {
+      if (options.do_log_callees
+          && (d->id == ID_CALL || d->id == ID_RCALL
+              || d->id == ID_ICALL || d->id == ID_EICALL))
+        {
+          unsigned sp = get_SP ();
+          if (! (sp < scope.callee_SP))
+            scope.callee_SP = sp;
+        }
+      return true;
+    }
+
+  if (scope.callee_SP)
+    {
+      // Still in a function called from within the scope?
+      if (get_SP () < scope.callee_SP)
+        return true;
+      scope.callee_SP = 0;
+    }
+
+  return false;
+}
+
+
+// -log-sample=P[:B]:  Return where the burst of the period that starts
+// at BASE starts.  Periods start at multiples of P.
+
+static uint64_t
+log_sample_next (uint64_t base)
+{
+  uint64_t period = log_sample_args.period;
+  uint64_t next = base;
+
+  if (options.do_log_sample_jitter)
+    {
+      uint64_t r = ((uint64_t) rand() << 31) ^ (uint64_t) rand();
+      next += r % (period - log_sample_args.burst + 1);
+    }
+
+  return next;
+}
+
+
+// -log-sample: The number of instructions resp. cycles that have been
+// executed before the current instruction.
+
+static uint64_t
+log_sample_now (void)
+{
+  return options.do_log_sample_cycles ? program.n_cycles : program.n_insns;
+}
+
+
+// -log-sample: Called by log_add_instr() before anything of the current
+// instruction has been recorded.  Log it and the next B - 1 ones, and
+// determine where the burst of the next period starts.
+
+static void
+log_sample_start (void)
+{
+  log_async_sync ();
+  qprintf ("*** sample %u at instruction %" PRIu64 ", cycle %" PRIu64 "\n",
+           ++alog.sample_n, program.n_insns, program.n_cycles);
+
+  options.do_log = 1;
+  alog.maybe_log = alog.log_this = true;
+  alog.sample_left = log_sample_args.burst;
+
+  uint64_t period = log_sample_args.period;
+  alog.sample_next = log_sample_next ((log_sample_now () / period + 1)
+                                      * period);
+}
+
+
+static INLINE void
+flight_insn (const decoded_t *d)
+{
+  flight_t *f = flight.cur = & flight.ring[flight.pos];
+  if (++flight.pos == flight.size)
+    flight.pos = 0;
+  flight.n_insns++;
+
+  f->d = *d;
+  f->pc = cpu.pc;
+  f->n_movs = 0;
+}
+
+
+static INLINE void
+flight_mov (int addr, int value, int n_bytes, bool write)
+{
+  flight_t *f = flight.cur;
+  if (f->n_movs < FLIGHT_N_MOVS)
+    {
+      f->mov[f->n_movs].addr = addr;
+      f->mov[f->n_movs].value = value;
+      f->mov[f->n_movs].n_bytes = n_bytes;
+      f->mov[f->n_movs].write = write;
+    }
+  if (f->n_movs < 0xff)
+    f->n_movs++;
+}
+
+
+// "%0*x: %-7s " for instruction D at word address PC, resp. "%0*x: "
+// for ID_UNDEF.
+
+static INLINE char*
+put_insn (char *p, const decoded_t *d, unsigned pc)
+{
+  p = put_hex (p, pc * 2, cpu.strlen_pc);
+  *p++ = ':';
+  *p++ = ' ';
+
+  if (d->id != ID_UNDEF)
+    {
+      mnemo_t *m = & mnemos[d->id];
+      if (!m->len)
+        {
+          const char *mnemo = opcodes[d->id].mnemonic;
+          m->n_chars = strlen (mnemo);
+          m->len = sprintf (m->text, "%-7s ", mnemo);
+        }
+      memcpy (p, m->text, m->len);
+      log_patch_mnemo (d, p + m->n_chars);
+      p += m->len;
+    }
+
+  return p;
+}
+
+
+// Start the log line of instruction D resp. its -trace record.
+
+static NOINLINE void
+log_add_instr_text (const decoded_t *d)
+{
+  char mnemo_[16];
+  const char *mnemo = opcodes[alog.id].mnemonic;
+
+  if (options.do_trace)
+    {
+      // The mnemonic is only needed the first time PC is executed.
+      if (trace_new_pc (cpu.pc))
+        {
+          if (alog.id == ID_UNDEF)
+            *mnemo_ = '\0';
+          else
+            {
+              strcpy (mnemo_, mnemo);
+              log_patch_mnemo (d, mnemo_ + strlen (mnemo));
+            }
+          trace_insn (cpu.pc, alog.id, mnemo_);
+        }
+      else
+        trace_insn (cpu.pc, alog.id, NULL);
+      return;
+    }
+
+  log_end (put_insn (alog.pos, d, cpu.pc));
+}
+
+
+// The per-instruction part of -flight-recorder, -log-sample and
+// -log-func etc.  Kept out of line so that log_add_instr() stays lean
+// when none of them is on.
+
+static NOINLINE void
+log_add_instr_hooks (const decoded_t *d)
+{
+  if (need.flight)
+    flight_insn (d);
+
+  if (options.do_log_sample && !alog.sample_left
+      && log_sample_now () >= alog.sample_next)
+    log_sample_start ();
+
+  alog.out_of_scope = scope.bits && !log_in_scope (d);
+}
+
+
 void
 log_add_instr (const decoded_t *d)
 {
@@ -222,6 +560,9 @@ log_add_instr (const decoded_t *d)
   old_old_PC = old_PC;
   old_PC = cpu.pc;
 
+  if (need.hooks)
+    log_add_instr_hooks (d);
+
   // We are called by do_step() for each instruction.  Decrement our
   // SP "atomicy" device.
   if (maybe_SP_glitch)
@@ -237,9 +578,6 @@ log_add_instr (const decoded_t *d)
         maybe_SP_glitch = 0;
     }
 
-  char mnemo_[16];
-  const char *mnemo = opcodes[alog.id].mnemonic;
-
   // SYSCALL 0..3, 5, 10..11 might turn on logging:
   // always log them to alog.data[].
 
@@ -247,68 +585,264 @@ log_add_instr (const decoded_t *d)
   bool maybe_used = (alog.maybe_log
                      || (alog.id == ID_SYSCALL && (sysmask & (1u << d->op1))));
 
-  if ((log_unused = !maybe_used || !need.logging))
+  if ((log_unused = alog.out_of_scope || !maybe_used || !need.logging))
     return;
 
-  if (alog.id == ID_UNDEF)
+  log_add_instr_text (d);
+}
+
+
+/* Write instruction D at word address PC as "%-7s OPERANDS" to BUF, which
+   must hold at least 40 chars.  Addressing modes that are part of the
+   mnemonic like in "LD X+" are not repeated in the operands.  */
+
+void
+log_disassemble (char *buf, const decoded_t *d, unsigned pc)
+{
+  const char *mnemo = opcodes[d->id].mnemonic;
+  char *p = buf + sprintf (buf, "%-7s ", mnemo);
+  log_patch_mnemo (d, buf + strlen (mnemo));
+
+  int rd = d->op1, rr = d->op2;
+  int n_pc = cpu.strlen_pc;
+
+  switch (d->id)
     {
-      log_append ("%0*x: ", cpu.strlen_pc, cpu.pc * 2);
+    default:
+      // No operands, or only the ones in the mnemonic.
+      break;
+
+    case ID_UNDEF:
+      sprintf (buf, ".word   0x%04x", d->op2);
       return;
+
+    case ID_SYSCALL:
+      sprintf (p, "%d", d->op1);
+      break;
+
+      // Rd, Rr
+    case ID_ADC:   case ID_ADD:   case ID_AND:   case ID_CP:    case ID_CPC:
+    case ID_CPSE:  case ID_CPSE2: case ID_EOR:   case ID_MOV:   case ID_MOVW:
+    case ID_MUL:   case ID_MULS:  case ID_MULSU: case ID_FMUL:  case ID_FMULS:
+    case ID_FMULSU: case ID_OR:   case ID_SBC:   case ID_SUB:
+      sprintf (p, "r%d, r%d", rd, rr);
+      break;
+
+      // Rd
+    case ID_ASR:   case ID_COM:   case ID_DEC:   case ID_INC:   case ID_LSR:
+    case ID_NEG:   case ID_POP:   case ID_PUSH:  case ID_ROR:   case ID_SWAP:
+    case ID_CLR:   case ID_LSL:   case ID_ROL:   case ID_TST:   case ID_XCH:
+    case ID_LAS:   case ID_LAC:   case ID_LAT:
+    case ID_BLD:   case ID_BST:
+    case ID_SBRC:  case ID_SBRC2: case ID_SBRS:  case ID_SBRS2:
+    case ID_LD_X:  case ID_LD_X_decr: case ID_LD_X_incr:
+    case ID_LD_Y_decr: case ID_LD_Y_incr: case ID_LD_Z_decr: case ID_LD_Z_incr:
+    case ID_ST_X:  case ID_ST_X_decr: case ID_ST_X_incr:
+    case ID_ST_Y_decr: case ID_ST_Y_incr: case ID_ST_Z_decr: case ID_ST_Z_incr:
+    case ID_LPM_Z: case ID_LPM_Z_incr: case ID_ELPM_Z: case ID_ELPM_Z_incr:
+      sprintf (p, "r%d", rd);
+      break;
+
+      // Rd, K
+    case ID_ANDI:  case ID_CPI:   case ID_LDI:   case ID_ORI:
+    case ID_SBCI:  case ID_SUBI:  case ID_ADIW:  case ID_SBIW:
+      sprintf (p, "r%d, 0x%02x", rd, rr);
+      break;
+
+    case ID_LDD_Y: case ID_LDD_Z:
+      sprintf (p, "r%d, %d", rd, rr);
+      break;
+    case ID_STD_Y: case ID_STD_Z:
+      sprintf (p, "%d, r%d", rr, rd);
+      break;
+
+    case ID_LDS:   case ID_LDS1:
+      sprintf (p, "r%d, 0x%04x", rd, rr);
+      break;
+    case ID_STS:   case ID_STS1:
+      sprintf (p, "0x%04x, r%d", rr, rd);
+      break;
+
+    case ID_IN:
+      sprintf (p, "r%d, %s", rd, addr_name[rr & 0xff]);
+      break;
+    case ID_OUT:
+      sprintf (p, "%s, r%d", addr_name[rr & 0xff], rd);
+      break;
+    case ID_CBI:   case ID_SBI:
+    case ID_SBIC:  case ID_SBIC2: case ID_SBIS:  case ID_SBIS2:
+      sprintf (p, "%s", addr_name[rd & 0xff]);
+      break;
+
+    case ID_DES:
+      sprintf (p, "%d", rd);
+      break;
+
+      // Targets of jumps and branches as byte addresses.
+    case ID_BRBC:  case ID_BRBS:
+      sprintf (p, "%0*x", n_pc,
+               2 * ((pc + 1 + (signed char) d->op1) & program.pc_mask));
+      break;
+    case ID_RCALL: case ID_RJMP:
+      sprintf (p, "%0*x", n_pc,
+               2 * ((pc + 1 + (int16_t) d->op2) & program.pc_mask));
+      break;
+    case ID_CALL:  case ID_JMP:
+      sprintf (p, "%0*x", n_pc, 2 * ((d->op1 << 16) | d->op2));
+      break;
     }
 
-  strcpy (mnemo_, mnemo);
-  log_patch_mnemo (d, mnemo_ + strlen (mnemo));
-  log_append ("%0*x: %-7s ", cpu.strlen_pc, cpu.pc * 2, mnemo_);
+  // No operands:  Remove the padding.
+  while (!*p && p > buf && p[-1] == ' ')
+    *--p = '\0';
+}
+
+
+// " %c->%c" for a read of the flag with MASK.
+
+static INLINE char*
+put_flag_read (char *p, int mask, int value)
+{
+  *p++ = ' ';
+  *p++ = s_SREG[mask_to_bit (mask)];
+  p = put_arrow (p, false);
+  *p++ = '0' + !!value;
+
+  return p;
+}
+
+
+// "(R%d)->%02x " etc. for a move from resp. to register REGNO.
+
+static INLINE char*
+put_reg_mov (char *p, int regno, int value, int n_bytes, bool write)
+{
+  *p++ = '(';
+  *p++ = 'R';
+  p = put_dec2 (p, regno);
+  *p++ = ')';
+  p = put_arrow (p, write);
+  p = put_hex (p, value, 2 * n_bytes);
+  *p++ = ' ';
+
+  return p;
+}
+
+
+// "(%s)->%02x " etc. with the name of data address ADDR, resp.
+// "(SREG)->'%s' " with the flags that are set.
+
+static INLINE char*
+put_data_mov (char *p, int addr, int value, int n_bytes, bool write)
+{
+  *p++ = '(';
+
+  if (addr_SREG == addr && n_bytes == 1)
+    {
+      memcpy (p, "SREG)", strlen ("SREG)"));
+      p = put_arrow (p + strlen ("SREG)"), write);
+      *p++ = '\'';
+      for (const char *f = s_SREG; *f; f++, value >>= 1)
+        if (value & 1)
+          *p++ = *f;
+      *p++ = '\'';
+      *p++ = ' ';
+      return p;
+    }
+
+  if ((unsigned) addr < 256)
+    for (const char *s = addr_name[addr]; *s; )
+      *p++ = *s++;
+  else if (addr >= 0x10000 && arch.has_rampd)
+    {
+      p = put_hex (p, addr >> 16, 2);
+      *p++ = ':';
+      p = put_hex (p, addr & 0xffff, 4);
+    }
+  else
+    p = put_hex (p, addr, 4);
+
+  *p++ = ')';
+  p = put_arrow (p, write);
+  p = put_hex (p, value, 2 * n_bytes);
+  *p++ = ' ';
+
+  return p;
 }
 
 
 void
 log_add_flag_read (int mask, int value)
 {
+  if (need.flight)
+    flight_mov (mask | FLIGHT_FLAG, value, 1, false);
+
   if (log_unused)
     return;
 
-  int bit = mask_to_bit (mask);
-  log_append (" %c->%c", s_SREG[bit], '0' + !!value);
+  if (options.do_trace)
+    {
+      log_append (" %c->%c", s_SREG[mask_to_bit (mask)], '0' + !!value);
+      return;
+    }
+
+  log_end (put_flag_read (alog.pos, mask, value));
 }
 
 
+// Log that VALUE with N_BYTES bytes is read from resp. written to
+// register REGNO.
+
 void
-log_add_data_mov (const char *format, int addr, int value)
+log_add_reg_mov (int regno, int value, int n_bytes, bool write)
 {
+  if (need.flight)
+    flight_mov (regno | FLIGHT_REG, value, n_bytes, write);
+
   if (log_unused)
     return;
 
-  char name[16];
-  const char *s_name = name;
-
-  if (addr_SREG == addr)
+  if (options.do_trace)
     {
-      char *s = name;
-      for (const char *f = s_SREG; *f; f++, value >>= 1)
-        if (value & 1)
-          *s++ = *f;
-      *s++ = '\0';
-      log_append (format, s_name);
+      static const char *const format[2][2] =
+        {
+          { "(R%d)->%02x ", "(R%d)->%04x " },
+          { "(R%d)<-%02x ", "(R%d)<-%04x " }
+        };
+      log_append (format[write][n_bytes - 1], regno, value);
       return;
     }
 
-  for (const sfr_t *sfr = named_sfr; ; sfr++)
+  log_end (put_reg_mov (alog.pos, regno, value, n_bytes, write));
+}
+
+
+// Log that VALUE with N_BYTES bytes is read from resp. written to
+// data address ADDR.
+
+void
+log_add_data_mov (int addr, int value, int n_bytes, bool write)
+{
+  if (need.flight)
+    flight_mov (addr, value, n_bytes, write);
+
+  if (log_unused)
+    return;
+
+  if (options.do_trace)
     {
-      if (addr == sfr->addr
-          && (sfr->pon == NULL || *sfr->pon))
-        s_name = sfr->name;
-      else if (sfr->name == NULL)
-        if (addr >= 0x10000 && arch.has_rampd)
-          sprintf (name, "%02x:%04x", addr >> 16, addr & 0xffff);
-        else
-          sprintf (name, addr < 256 ? "%02x" : "%04x", addr);
-      else
-        continue;
-      break;
+      static const char *const format[2][3] =
+        {
+          { "(SREG)->'%s' ", "(%s)->%02x ", "(%s)->%04x " },
+          { "(SREG)<-'%s' ", "(%s)<-%02x ", "(%s)<-%04x " }
+        };
+      bool is_SREG = addr_SREG == addr && n_bytes == 1;
+      // avrtest-tracedump knows the SFR names and flags.
+      trace_mov (format[write][is_SREG ? 0 : n_bytes], addr, value);
+      return;
     }
 
-  log_append (format, s_name, value);
+  log_end (put_data_mov (alog.pos, addr, value, n_bytes, write));
 }
 
 
@@ -434,6 +968,9 @@ sys_log_pushpop (int sysno, int what)
 void
 log_do_syscall (int sysno, int val)
 {
+  // The syscall might change or print what the meters are working on.
+  meter_async_sync ();
+
   switch (sysno)
     {
     default:
@@ -447,6 +984,7 @@ log_do_syscall (int sysno, int val)
     case 3: sys_log_config (LOG_SET_CMD, val);  break;
     case 5: sys_perf_cmd (val);     break;
     case 6: sys_perf_tag_cmd (val); break;
+    case 14: sys_perf_region_cmd (val); break;
     case  9: sys_log_pushpop (sysno, 0);    break;
     case 10: sys_log_pushpop (sysno, 1);    break;
     case 11: sys_log_pushpop (sysno, -1);   break;
@@ -454,6 +992,120 @@ log_do_syscall (int sysno, int val)
 }
 
 
+/* Called by the ELF loader for each symbol in executable code at word
+   address PC.  Collect them for -log-func.  */
+
+void
+log_elf_symbol (const char *name, unsigned pc, bool is_func)
+{
+  if (!options.do_log_func)
+    return;
+
+  if (scope.n_syms == scope.n_syms_alloc)
+    {
+      scope.n_syms_alloc = scope.n_syms_alloc ? 2 * scope.n_syms_alloc : 256;
+      scope.syms = realloc (scope.syms,
+                            scope.n_syms_alloc * sizeof (log_symbol_t));
+      if (!scope.syms)
+        leave (LEAVE_MEMORY, "out of memory allocating %u bytes for %s",
+               (unsigned) (scope.n_syms_alloc * sizeof (log_symbol_t)),
+               "-log-func symbols");
+    }
+
+  log_symbol_t *sym = & scope.syms[scope.n_syms++];
+  sym->name = name;
+  sym->pc = pc;
+  sym->is_func = is_func;
+}
+
+
+static int
+cmp_symbol (const void *a, const void *b)
+{
+  const log_symbol_t *s = (const log_symbol_t*) a;
+  const log_symbol_t *t = (const log_symbol_t*) b;
+  return s->pc < t->pc ? -1 : s->pc > t->pc;
+}
+
+
+// Add word addresses LO <= PC < HI to the scope.
+
+static void
+scope_add (unsigned lo, unsigned hi)
+{
+  for (unsigned pc = lo; pc < hi && pc <= program.pc_mask; pc++)
+    scope.bits[pc / 8] |= 1u << (pc % 8);
+}
+
+
+// Set up the bitmap for -log-func=NAMES and -log-range=RANGES.
+
+static void
+log_scope_init (void)
+{
+  if (!options.do_log_func && !options.do_log_range)
+    return;
+
+  scope.bits = get_mem (1 + program.pc_mask / 8, sizeof (byte),
+                        "-log-func bitmap");
+  int n;
+
+  if (options.do_log_range)
+    {
+      char **ranges = comma_list_to_array (options.s_log_range, &n);
+      for (int i = 0; i < n; i++)
+        {
+          char *end;
+          unsigned long lo = strtoul (ranges[i], &end, 0);
+          unsigned long hi = lo;
+          if (*end == '-')
+            hi = strtoul (end + 1, &end, 0);
+          if (*end || hi < lo)
+            leave (LEAVE_USAGE, "-log-range: invalid range '%s'", ranges[i]);
+          scope_add (lo / 2, hi / 2 + 1);
+        }
+    }
+
+  if (options.do_log_func)
+    {
+      // A function extends up to the next function or to the end of
+      // the code.
+      qsort (scope.syms, scope.n_syms, sizeof (log_symbol_t), cmp_symbol);
+
+      char **funcs = comma_list_to_array (options.s_log_func, &n);
+      for (int i = 0; i < n; i++)
+        {
+          bool found = false;
+          size_t len = strlen (funcs[i]);
+
+          for (int s = 0; s < scope.n_syms; s++)
+            {
+              const char *name = scope.syms[s].name;
+              // Also cover clones like foo.constprop.0.
+              if (! str_prefix (funcs[i], name)
+                  || (name[len] != '\0' && name[len] != '.'))
+                continue;
+
+              unsigned lo = scope.syms[s].pc;
+              unsigned hi = 1 + program.code_end / 2;
+              for (int e = s + 1; e < scope.n_syms; e++)
+                if (scope.syms[e].is_func && scope.syms[e].pc > lo)
+                  {
+                    hi = scope.syms[e].pc;
+                    break;
+                  }
+              scope_add (lo, hi > lo ? hi : lo + 1);
+              found = true;
+            }
+
+          if (!found)
+            leave (LEAVE_USAGE, "-log-func: function '%s' not found",
+                   funcs[i]);
+        }
+    }
+}
+
+
 void
 log_init (unsigned val)
 {
@@ -463,29 +1115,231 @@ log_init (unsigned val)
   alog.maybe_log = true;
   srand (val);
 
+  // The first matching entry of named_sfr[] wins.
+  bool named[256] = { false };
+  for (const sfr_t *sfr = named_sfr; sfr->name; sfr++)
+    if (sfr->addr < 256 && !named[sfr->addr]
+        && (sfr->pon == NULL || *sfr->pon))
+      {
+        strcpy (addr_name[sfr->addr], sfr->name);
+        named[sfr->addr] = true;
+      }
+  for (int addr = 0; addr < 256; addr++)
+    if (!named[addr])
+      sprintf (addr_name[addr], "%02x", addr);
+
+  if (options.do_trace && options.do_flight_recorder)
+    leave (LEAVE_USAGE, "-trace=FILE and -flight-recorder are mutually "
+           "exclusive");
+
+  if (options.do_trace)
+    trace_init (options.s_trace);
+
+  log_scope_init ();
+  watch_init ();
+  hotspots_init ();
+  timeline_init ();
+
+  log_async_init ();
+
   /**/
 
   need.perf = have_syscall[5] || have_syscall[6];
 
+  if (options.do_log_sample && options.do_flight_recorder)
+    leave (LEAVE_USAGE, "-log-sample and -flight-recorder are mutually "
+           "exclusive");
+
+  if (options.do_flight_recorder)
+    {
+      // Record the instructions in memory, and only print them when
+      // the program fails.
+      options.do_log = 0;
+      need.flight = true;
+      flight.size = options.do_flight_recorder;
+      flight.ring = get_mem (flight.size, sizeof (flight_t),
+                             "-flight-recorder");
+      flight.cur = flight.ring;
+    }
+
+  if (options.do_log_sample)
+    {
+      // Logging is turned on by the bursts.
+      options.do_log = 0;
+      alog.sample_next = log_sample_next (0);
+    }
+
   need.logging = (is_avrtest_log
                   && (options.do_log
+                      || options.do_log_sample
                       || have_syscall[1]
                       || have_syscall[10] || have_syscall[11]
                       || (have_syscall[2] && need.perf)
                       || have_syscall[3]));
 
-  need.graph_cost = options.do_graph || options.do_debug_tree;
+  need.graph_cost = (options.do_graph || options.do_debug_tree
+                     || options.do_profile || options.do_callgrind
+                     || options.do_flame || options.do_timeline
+                     || options.do_stack_report);
 
-  need.call_depth = need.graph_cost || need.logging || need.perf;
+  // -watch shows the accessing function.
+  need.call_depth = (need.graph_cost || need.logging || need.perf
+                     || options.do_watch);
   need.graph = need.call_depth;
+
+  // Optional work per instruction on top of logging and the meters.
+  need.hooks = (need.flight || options.do_log_sample || scope.bits
+                || options.do_hotspots);
+
+  meter_async_init ();
+}
+
+
+// leave() with a failure or a non-zero exit value:  Print what
+// -flight-recorder has recorded.  The lines are built by the same
+// put_*() functions like the lines of -log.
+
+void
+log_flight_dump (void)
+{
+  if (!flight.ring)
+    return;
+
+  // Don't come here again if something goes wrong.
+  flight_t *ring = flight.ring;
+  flight.ring = NULL;
+
+  unsigned n = flight.n_insns < flight.size ? flight.n_insns : flight.size;
+  unsigned i = (flight.pos + flight.size - n) % flight.size;
+
+  printf ("\n*** flight recorder: last %u instructions:\n", n);
+
+  for (unsigned k = 0; k < n; k++)
+    {
+      const flight_t *f = & ring[i];
+      char line[40 + 24 * FLIGHT_N_MOVS];
+      char *p = put_insn (line, & f->d, f->pc);
+
+      // The text that avrtest.c adds by log_append() is not recorded,
+      // only the start of the text of a SYSCALL.
+      if (f->d.id == ID_SYSCALL)
+        p += sprintf (p, "#%d: ", f->d.op1);
+
+      for (int m = 0; m < f->n_movs && m < FLIGHT_N_MOVS; m++)
+        {
+          int addr = f->mov[m].addr;
+          int value = f->mov[m].value;
+          int n_bytes = f->mov[m].n_bytes;
+          bool write = f->mov[m].write;
+
+          if (addr & FLIGHT_REG)
+            p = put_reg_mov (p, addr & ~FLIGHT_REG, value, n_bytes, write);
+          else if (addr & FLIGHT_FLAG)
+            p = put_flag_read (p, addr & ~FLIGHT_FLAG, value);
+          else
+            p = put_data_mov (p, addr, value, n_bytes, write);
+        }
+      if (f->n_movs > FLIGHT_N_MOVS)
+        p += sprintf (p, "...");
+      *p = '\0';
+      puts (line);
+
+      if (++i == flight.size)
+        i = 0;
+    }
+
+  free (ring);
+}
+
+
+// The per-instruction part of -hotspots and -log-sample.
+
+static NOINLINE void
+log_dump_line_hooks (const decoded_t *d)
+{
+  if (options.do_hotspots)
+    {
+      if (d)
+        hotspots_count (d, old_PC, program.n_cycles);
+      else
+        hotspots_dump ();
+    }
+
+  if (d && alog.sample_left && --alog.sample_left == 0)
+    {
+      // End of the burst.  The current instruction is still printed.
+      options.do_log = 0;
+    }
+}
+
+
+// Feed the state after instruction D to the graph and perf meters.
+// D = NULL: Program exit.
+
+static NOINLINE void
+log_meters (const decoded_t *d)
+{
+  static int old_id;
+  const byte *r24 = cpu_address (24, AR_REG);
+  meter_t m =
+    {
+      .id = d ? d->id : 0,
+      .old_id = old_id,
+      .op2 = d ? d->op2 : 0,
+      .pc = cpu.pc,
+      .old_pc = old_PC,
+      .sp = get_nonglitch_SP(),
+      .r24 = r24[0] | (r24[1] << 8),
+      .cycles = program.n_cycles,
+      .insns = program.n_insns + 1,
+      .log = !log_unused
+    };
+  old_id = m.id;
+
+  if (!d)
+    {
+      // Program exit:  Let the meters catch up before they are used.
+      meter_async_finish ();
+      if (options.do_profile)
+        graph_profile (&m);
+      if (options.do_callgrind)
+        graph_callgrind (&m);
+      if (options.do_flame)
+        graph_flame (&m);
+      if (options.do_timeline)
+        graph_timeline (&m);
+      if (options.do_stack_report)
+        graph_stack_report (&m);
+      if (options.do_graph)
+        graph_write_dot (&m);
+    }
+  else if (meter_async_active ())
+    {
+      meter_async_post (&m);
+      return;
+    }
+
+  int call_depth = (d && need.call_depth
+                    ? graph_update_call_depth (&m)
+                    : 0);
+
+  if (need.perf)
+    perf_instruction (&m, call_depth);
 }
 
 
 void
 log_dump_line (const decoded_t *d)
 {
+  if (need.hooks)
+    log_dump_line_hooks (d);
+
+  if (!d)
+    perf_region_dump ();
+
   if (d && alog.countdown && --alog.countdown == 0)
     {
+      log_async_sync ();
       options.do_log = 0;
       qprintf ("*** done log %u\n", alog.count_val);
     }
@@ -493,10 +1347,21 @@ log_dump_line (const decoded_t *d)
   bool log_this = (options.do_log
                    || (alog.perf_only
                        && (perf.on || perf.will_be_on)));
-  if (log_this || (log_this != alog.log_this))
+  if (alog.out_of_scope)
+    {
+      // Nothing has been recorded for this instruction.  Whether the
+      // next one needs to be recorded depends on logging being on.
+      alog.maybe_log = log_this;
+    }
+  else if (log_this || (log_this != alog.log_this))
     {
       alog.maybe_log = true;
-      puts (alog.data);
+      if (options.do_trace)
+        trace_eol (true);
+      else if (log_async_active ())
+        log_async_line (alog.data, alog.pos - alog.data);
+      else
+        puts (alog.data);
       if (log_this && log_unused)
         leave (LEAVE_FATAL, "problem in log_dump_line");
     }
@@ -505,16 +1370,11 @@ log_dump_line (const decoded_t *d)
 
   alog.log_this = log_this;
 
+  if (options.do_trace)
+    trace_eol (false);
   alog.pos = alog.data;
   *alog.pos = '\0';
 
-  int call_depth = (d && need.call_depth
-                    ? graph_update_call_depth (d)
-                    : 0);
-
-  if (!d && options.do_graph)
-    graph_write_dot();
-
-  if (need.perf)
-    perf_instruction (d ? d->id : 0, call_depth);
+  if (need.call_depth || need.perf)
+    log_meters (d);
 }
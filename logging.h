@@ -24,4 +24,34 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// -trace=FILE: Binary instruction trace from trace.c.
+extern void trace_init (const char *filename);
+extern bool trace_new_pc (unsigned pc);
+extern void trace_insn (unsigned pc, int id, const char *mnemo);
+extern void trace_text (const char *fmt, va_list);
+extern void trace_string (const char *fmt, va_list);
+extern void trace_mov (const char *fmt, int addr, int value);
+extern int trace_position (void);
+extern void trace_eol (bool dump);
+
+// -log-async: Writer thread from log-async.c.
+extern void log_async_init (void);
+extern bool log_async_active (void);
+extern bool log_async_write (int fd, const void*, size_t, bool may_drop);
+extern void log_async_line (char *line, size_t len);
+
+// -meter-async: Meter thread from meter-async.c.
+extern void meter_async_init (void);
+extern bool meter_async_active (void);
+extern void meter_async_post (const meter_t*);
+extern void meter_async_sync (void);
+extern void meter_async_finish (void);
+
+// -hotspots: Disassembly for the listing from hotspots.c.
+extern void log_disassemble (char *buf, const decoded_t*, unsigned pc);
+
 #endif // LOGGING_H
@@ -0,0 +1,303 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* -meter-async:  Run the call tracker from graph.c and the perf-meters
+   from perf.c in a separate thread.
+
+   log_dump_line() describes each instruction by a meter_t and posts it
+   to a ring of which the simulator is the only producer and the meter
+   thread is the only consumer, so that no lock is taken.  The same
+   scheme is used by log-async.c.
+
+   Most instructions are of no concern to the call tracker:  Unless a
+   perf-meter is running, only calls, returns, jumps and instructions
+   that enter a location with a symbol are posted.
+
+   Perf commands from syscalls 5 and 6 are synchronization points:  The
+   simulator waits until the meter thread has processed them, because
+   they print and read the state of the simulation.  Everything else
+   that uses the meters calls meter_async_sync() first.  */
+
+#define _DEFAULT_SOURCE // nanosleep
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined (_WIN32)
+#define HAVE_PTHREAD 0
+#else
+#define HAVE_PTHREAD 1
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#endif
+
+#include "testavr.h"
+#include "options.h"
+#include "logging.h"
+#include "graph.h"
+#include "perf.h"
+
+#ifndef AVRTEST_LOG
+#error no function herein is needed without AVRTEST_LOG
+#endif // AVRTEST_LOG
+
+// Number of meter_t in the ring.  A power of 2.
+#define METER_ASYNC_SIZE (1u << 16)
+
+typedef struct
+{
+  // Whether the meter thread is running.
+  bool active;
+  // perf.on as of the last perf command.
+  bool perf_on;
+
+  meter_t *ring;
+
+  // Bit N is set if word address N might have a symbol in the call
+  // tracker:  Functions from the ELF file and all targets of calls,
+  // returns and indirect jumps seen so far.
+  byte *pc_bits;
+
+  // Running counts of events.  The producer writes .head, the consumer
+  // writes .tail.
+  size_t head __attribute__((__aligned__(64)));
+  size_t tail __attribute__((__aligned__(64)));
+  // Set by the producer when no more events will come.
+  int done __attribute__((__aligned__(64)));
+
+#if HAVE_PTHREAD
+  pthread_t thread;
+#endif
+} meter_async_t;
+
+static meter_async_t ma;
+
+#define LOAD(X)     __atomic_load_n (&(X), __ATOMIC_ACQUIRE)
+#define STORE(X, V) __atomic_store_n (&(X), (V), __ATOMIC_RELEASE)
+
+#define PC_BIT(PC) (ma.pc_bits[(PC) / 8] & (1u << ((PC) % 8)))
+#define SET_PC_BIT(PC) (ma.pc_bits[(PC) / 8] |= 1u << ((PC) % 8))
+
+#if HAVE_PTHREAD
+
+static void
+relax (unsigned spin)
+{
+  if (spin < 64)
+    sched_yield ();
+  else
+    {
+      struct timespec ts = { 0, 50000 };
+      nanosleep (&ts, NULL);
+    }
+}
+
+
+// What log_dump_line() would do with M.
+
+static void
+meter (const meter_t *m)
+{
+  int call_depth = need.call_depth ? graph_update_call_depth (m) : 0;
+
+  if (need.perf)
+    perf_instruction (m, call_depth);
+}
+
+
+static void*
+consumer (void *arg)
+{
+  (void) arg;
+
+  for (unsigned spin = 0;; )
+    {
+      size_t head = LOAD (ma.head);
+      size_t tail = ma.tail;
+
+      if (head != tail)
+        {
+          for (; tail != head; tail++)
+            {
+              meter (& ma.ring[tail & (METER_ASYNC_SIZE - 1)]);
+              STORE (ma.tail, tail + 1);
+            }
+          spin = 0;
+        }
+      else if (LOAD (ma.done))
+        return NULL;
+      else
+        relax (spin++);
+    }
+}
+
+
+// Wait until the meter thread has processed everything.
+
+static void
+drain (void)
+{
+  for (unsigned spin = 0; LOAD (ma.tail) != ma.head; )
+    relax (spin++);
+}
+
+
+// Whether M may change what graph_update_call_depth() is tracking.
+
+static bool
+need_graph (const meter_t *m)
+{
+  switch (m->id)
+    {
+    case ID_CALL:
+    case ID_RCALL:
+    case ID_ICALL:
+    case ID_EICALL:
+    case ID_RET:
+    case ID_RETI:
+    case ID_IJMP:
+    case ID_EIJMP:
+      // The call tracker might add a symbol for the target.
+      SET_PC_BIT (m->pc);
+      return true;
+
+    case ID_RJMP:
+    case ID_JMP:
+      return true;
+    }
+
+  // Any other instruction only makes a difference when it enters a
+  // location that has a symbol.
+  return PC_BIT (m->pc);
+}
+
+#endif // HAVE_PTHREAD
+
+
+void
+meter_async_init (void)
+{
+  if (!options.do_meter_async)
+    return;
+
+#if !HAVE_PTHREAD
+  if (options.do_verbose)
+    printf (">>> -meter-async ignored: not supported on this host\n");
+#else
+  if (need.logging || options.do_debug_tree
+      || (!need.graph_cost && !need.perf))
+    {
+      if (options.do_verbose)
+        printf (">>> -meter-async ignored: %s\n",
+                need.graph_cost || need.perf
+                ? "needs -no-log and -graph without -debug-tree"
+                : "no meters in use");
+      return;
+    }
+
+  ma.ring = get_mem (METER_ASYNC_SIZE, sizeof (meter_t), "-meter-async ring");
+  ma.pc_bits = get_mem (MAX_FLASH_SIZE / 2 / 8, sizeof (byte),
+                        "-meter-async pc bits");
+  graph_function_bits (ma.pc_bits);
+
+  // The meter thread blocks all signals like the -log-async writer.
+  sigset_t all, old;
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  if (pthread_create (&ma.thread, NULL, consumer, NULL))
+    leave (LEAVE_FATAL, "cannot create the -meter-async thread");
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+  ma.active = true;
+#endif // HAVE_PTHREAD
+}
+
+
+bool
+meter_async_active (void)
+{
+  return ma.active;
+}
+
+
+// Queue M for the meter thread provided it might make a difference.
+
+void
+meter_async_post (const meter_t *m)
+{
+#if HAVE_PTHREAD
+  bool cmd = need.perf && perf.pmask;
+
+  // -callgrind and -stack-report account every instruction.
+  if (!cmd && !ma.perf_on
+      && !(need.call_depth && (options.do_callgrind
+                               || options.do_stack_report
+                               || need_graph (m))))
+    return;
+
+  size_t head = ma.head;
+  for (unsigned spin = 0; head - LOAD (ma.tail) >= METER_ASYNC_SIZE; spin++)
+    relax (spin);
+
+  ma.ring[head & (METER_ASYNC_SIZE - 1)] = *m;
+  STORE (ma.head, head + 1);
+
+  if (cmd)
+    {
+      drain ();
+      ma.perf_on = perf.on;
+    }
+#else
+  (void) m;
+#endif // HAVE_PTHREAD
+}
+
+
+// Wait until the meters are up to date.
+
+void
+meter_async_sync (void)
+{
+#if HAVE_PTHREAD
+  if (ma.active)
+    drain ();
+#endif
+}
+
+
+// Process all pending events and stop the meter thread.
+
+void
+meter_async_finish (void)
+{
+#if HAVE_PTHREAD
+  if (!ma.active)
+    return;
+
+  STORE (ma.done, 1);
+  pthread_join (ma.thread, NULL);
+  ma.active = false;
+#endif
+}
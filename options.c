@@ -28,17 +28,28 @@
 
 #include "testavr.h"
 #include "options.h"
+#include "cores.h"
 
 // ----------------------------------------------------------------------------
 //     parse command line arguments
 
 static const char USAGE[] =
   "  usage: avrtest [-d] [-e ENTRY] [-m MAXCOUNT] [-mmcu=ARCH] [-s SIZE]\n"
-  "                 [-no-log] [-no-stdin] [-no-stdout] [-no-stderr]\n"
-  "                 [-log=FILE] [-stdin=FILE] [-stdout=FILE] [-stderr=FILE]\n"
-  "                 [-q] [-flush] [-regs] [-runtime] [-v]\n"
-  "                 [-graph[=FILE]] [-sbox=FOLDER]\n"
-  "                 program [-args [...]]\n"
+  "                 [-no-log] [-no-stdin] [-no-stdout] [-no-stderr] [-log=FILE]\n"
+  "                 [-stdin=FILE] [-stdout=FILE] [-stderr=FILE] [-q] [-flush]\n"
+  "                 [-regs] [-regs-diff[=K]] [-runtime] [-result=FILE] [-v]\n"
+  "                 [-graph[=FILE]] [-profile[=FILE]] [-hotspots[=N]]\n"
+  "                 [-callgrind=FILE] [-flame=FILE] [-timeline=FILE]\n"
+  "                 [-timeline-min=K] [-stack-report] [-perf-hist[=FILE]]\n"
+  "                 [-meter-async] [-trace=FILE] [-trace-compress]\n"
+  "                 [-log-async[=SIZE]] [-log-drop] [-log-sample=P[:B]]\n"
+  "                 [-log-sample-cycles] [-log-sample-jitter] [-flight-recorder=N]\n"
+  "                 [-log-func=NAMES] [-log-range=RANGES] [-log-callees]\n"
+  "                 [-watch=ITEMS] [-watch-read] [-watch-abort] [-sbox=FOLDER]\n"
+  "                 [-image-cache DIR] [-fuzz-runs=N] [-fuzz-len=N]\n"
+  "                 [-fuzz-corpus=FILES] [-fuzz-out=PREFIX] [-cores=PROGS]\n"
+  "                 [-quantum=N] [-sample=N] [-sample-flame=FILE] program\n"
+  "                 [-args [...]]\n"
   "         avrtest --help\n"
   "Options:\n"
   "  -h            Show this help and exit.\n"
@@ -57,7 +68,13 @@ static const char USAGE[] =
   "  -v            Verbose mode.  Print the loaded ELF program headers\n"
   "                and the used streams.\n"
   "  -regs         Show register contents in the instruction log.\n"
+  "  -regs-diff[=K]  With -regs and LOG_REGS: Only show the registers that\n"
+  "                changed since the last dump, and all registers every\n"
+  "                K-th dump.  The default for K is 32.\n"
   "  -runtime      Print avrtest execution time.\n"
+  "  -result=FILE  Append a one-line JSON record with the exit status,\n"
+  "                cycles and run times to FILE.  FILE may be stderr, or\n"
+  "                N resp. fd:N for the open file descriptor N.\n"
   "  -no-log       Disable instruction logging in avrtest_log.  Logging\n"
   "                can still be turned on with LOG_ON etc., see README.\n"
   "  -log=FILE     Commands like LOG_U8 will print to FILE on the host.\n"
@@ -71,9 +88,80 @@ static const char USAGE[] =
   "  -flush        Flush stdout resp. stderr after each character.\n"
   "  -sbox SANDBOX Provide the path to SANDBOX, which is a folder that the\n"
   "                target program can access via file I/O (syscall 26).\n"
+  "  -image-cache DIR  Cache the loaded and decoded program in folder DIR\n"
+  "                and use it in subsequent runs of the same program.\n"
+  "  -cores=PROGS  Simulate the programs from the comma separated list\n"
+  "                PROGS as cores 1, 2, ... that can talk to the program\n"
+  "                (core 0) and to each other over links.\n"
+  "  -quantum=N    Run the cores in lockstep such that no core gets more\n"
+  "                than about N cycles ahead of another one.\n";
+
+// Sampling, and options that are only used by some flavours of avrtest.
+// Separate from USAGE[] because C99 only guarantees string literals of
+// 4095 characters.
+static const char USAGE_FLAVOURS[] =
+  "  -sample=N     Take a sample of the PC every N cycles and print a flat\n"
+  "                profile of the functions.  Supported suffixes are k\n"
+  "                for 1000 and M for a million.\n"
+  "  -sample-flame=FILE  With -sample: Also take the return addresses\n"
+  "                from the stack, and write the folded call stacks to\n"
+  "                FILE for flame graphs.\n"
+  "  -trace=FILE   avrtest_log: Write the instruction log to FILE in a\n"
+  "                compact binary format.  Use avrtest-tracedump to view it.\n"
+  "  -trace-compress  With -trace: Compress the trace and add an index that\n"
+  "                allows avrtest-tracedump to seek by cycle or call.\n"
+  "  -log-async[=SIZE]  avrtest_log: Write the instruction log from a\n"
+  "                separate thread through a buffer of SIZE bytes.\n"
+  "  -log-drop     With -log-async: Drop log lines when the buffer is full\n"
+  "                instead of waiting for the writer.\n"
+  "  -log-sample=P[:B]  avrtest_log: Only log bursts of B instructions\n"
+  "                every P instructions.  Default for B is 100.\n"
+  "  -log-sample-cycles  With -log-sample: Count P in cycles.\n"
+  "  -log-sample-jitter  With -log-sample: Start the bursts at random\n"
+  "                positions within their periods.\n"
+  "  -flight-recorder=N  avrtest_log: Don't log, but print the last N\n"
+  "                instructions when the program fails.\n"
+  "  -log-func=NAMES  avrtest_log: Only log instructions in the functions\n"
+  "                from the comma separated list NAMES.\n"
+  "  -log-range=RANGES  avrtest_log: Only log instructions in the comma\n"
+  "                separated list of byte address ranges LO-HI.\n"
+  "  -log-callees  With -log-func or -log-range: Also log the functions\n"
+  "                that are called from there.\n"
+  "  -watch=ITEMS  avrtest_log: Report writes to the data objects from the\n"
+  "                comma separated list ITEMS of SYMBOLs or ADDR:LEN.\n"
+  "  -watch-read   With -watch: Also report reads.\n"
+  "  -watch-abort  With -watch: Abort at the first report.\n"
   "  -graph[=FILE] Write a .dot FILE representing the dynamic call graph.\n"
   "                For the dot tool see  http://graphviz.org\n"
   "  -graph-help   Show more options to control graph generation and exit.\n"
+  "  -profile[=FILE]  avrtest_log: Print a flat profile with the cycles\n"
+  "                per function.  Write it to FILE in CSV resp. JSON format\n"
+  "                if FILE ends in .csv resp. .json.\n"
+  "  -hotspots[=N]  avrtest_log: Print the instructions of the N functions\n"
+  "                that took the most cycles with their execution counts\n"
+  "                and cycles.  Default for N is 10.\n"
+  "  -callgrind=FILE  avrtest_log: Write the call graph with the costs per\n"
+  "                function and instruction to FILE in callgrind format.\n"
+  "  -flame=FILE  avrtest_log: Write the cycles per call stack to FILE\n"
+  "                as folded stacks for flame graphs.\n"
+  "  -timeline=FILE  avrtest_log: Write calls, perf-meter rounds and LOG\n"
+  "                values to FILE as Chrome / Perfetto trace events with\n"
+  "                time stamps in cycles.\n"
+  "  -timeline-min=K  With -timeline: Skip calls shorter than K cycles.\n"
+  "  -stack-report  avrtest_log: Print the maximal stack usage and own\n"
+  "                frame size per function, and the deepest call chain.\n"
+  "  -perf-hist[=FILE]  avrtest_log: Show percentiles of the Ticks per\n"
+  "                round resp. of the PERF_STAT values in PERF_DUMP, and\n"
+  "                write the histogram buckets to FILE in CSV format.\n"
+  "  -meter-async  avrtest_log: Run the call graph and the perf-meters in\n"
+  "                a separate thread when no instructions are logged.\n"
+  "  -fuzz-runs=N  avrtest_fuzz: Stop fuzzing after N runs.  Default is to\n"
+  "                fuzz until interrupted.\n"
+  "  -fuzz-len=N   avrtest_fuzz: Maximal length of inputs, default is 64.\n"
+  "  -fuzz-corpus=FILES  avrtest_fuzz: A comma separated list of files\n"
+  "                that are added to the initial corpus.\n"
+  "  -fuzz-out=PREFIX  avrtest_fuzz: Prefix for crash-N.data and\n"
+  "                timeout-N.data files with crashing resp. hanging inputs.\n"
   "  -mmcu=ARCH    Select instruction set for ARCH\n"
   "    ARCH is one of:\n";
 
@@ -151,6 +239,13 @@ args_t args;
 
 const char *fileio_sandbox;
 
+// From -image-cache DIR.
+const char *image_cache_dir;
+
+// -fuzz-runs=N etc. (avrtest_fuzz only)
+fuzz_args_t fuzz_args;
+log_sample_args_t log_sample_args;
+
 typedef struct
 {
   // unique id
@@ -179,7 +274,7 @@ usage (const char *fmt, ...)
   if (!fmt)
     options.do_quiet = 0;
 
-  qprintf ("%s", USAGE);
+  qprintf ("%s%s", USAGE, USAGE_FLAVOURS);
   for (const arch_t *d = arch_desc; d->name; d++)
     if (is_xmega == d->is_xmega
         && is_tiny == d->is_tiny)
@@ -419,7 +514,7 @@ maybe_open_file (file_t *f)
 
       bool is_data = str_suffix (".data", *f->pfilename);
 
-      if (!is_txt_filename (*f->pfilename))
+      if (!is_data && !is_txt_filename (*f->pfilename))
         {
           if (verb)
             printf (" ignored: illegal file name (not *.txt or *.data)"
@@ -652,6 +747,12 @@ parse_args (int argc, char *argv[])
           fileio_sandbox = on ? argv[i] : NULL;
           break; // -sbox SANDBOX
 
+        case OPT_image_cache:
+          if (++i >= argc)
+            usage ("missing DIR after '%s'", argv[i-1]);
+          image_cache_dir = on ? argv[i] : NULL;
+          break; // -image-cache DIR
+
         case OPT_args:
           args.argc = on ? argc : i;
           args.argv = argv;
@@ -673,6 +774,89 @@ parse_args (int argc, char *argv[])
             options.do_size = get_valid_kilo (argv[i], "-s SIZE");
           break; // -s SIZE
 
+        case OPT_fuzz_runs:
+          fuzz_args.runs = on
+            ? get_valid_numberKME (options.s_fuzz_runs, "-fuzz-runs=N")
+            : 0;
+          break;
+
+        case OPT_fuzz_len:
+          fuzz_args.max_len = on
+            ? (unsigned) get_valid_number (options.s_fuzz_len, "-fuzz-len=N")
+            : 0;
+          break;
+
+        case OPT_quantum:
+          cores.quantum = on
+            ? get_valid_numberKME (options.s_quantum, "-quantum=N")
+            : 0;
+          break;
+
+        case OPT_flight_recorder:
+          options.do_flight_recorder = on
+            ? get_valid_numberKME (options.s_flight_recorder,
+                                   "-flight-recorder=N")
+            : 0;
+          break;
+
+        case OPT_log_sample:
+          if (on)
+            {
+              // P[:B] with a default of 100 for B.
+              const char *s = options.s_log_sample;
+              const char *colon = strchr (s, ':');
+              char s_period[40];
+              snprintf (s_period, sizeof (s_period), "%.*s",
+                        colon ? (int) (colon - s) : (int) strlen (s), s);
+              log_sample_args.period
+                = get_valid_numberKME (s_period, "-log-sample=P[:B]");
+              log_sample_args.burst = colon
+                ? (unsigned) get_valid_numberKME (colon + 1,
+                                                  "-log-sample=P[:B]")
+                : 100;
+              if (log_sample_args.burst == 0
+                  || log_sample_args.period < log_sample_args.burst)
+                usage ("expecting 0 < B <= P in '-log-sample=%s'", s);
+            }
+          break;
+
+        case OPT_regs_diff_k:
+          options.do_regs_diff = on;
+          options.do_regs_diff_k = on
+            ? get_valid_number (options.s_regs_diff_k, "-regs-diff=K")
+            : 0;
+          break;
+
+        case OPT_hotspots_n:
+          options.do_hotspots = on;
+          options.do_hotspots_n = on
+            ? get_valid_number (options.s_hotspots_n, "-hotspots=N")
+            : 0;
+          if (on && options.do_hotspots_n == 0)
+            usage ("expecting N > 0 in '-hotspots=%s'", options.s_hotspots_n);
+          break;
+
+        case OPT_sample:
+          options.do_sample = on
+            ? get_valid_numberKME (options.s_sample, "-sample=N")
+            : 0;
+          if (on && options.do_sample == 0)
+            usage ("expecting N > 0 in '-sample=%s'", options.s_sample);
+          break;
+
+        case OPT_timeline_min:
+          options.do_timeline_min = on
+            ? get_valid_numberKME (options.s_timeline_min, "-timeline-min=K")
+            : 0;
+          break;
+
+        case OPT_log_async_size:
+          options.do_log_async = on;
+          options.do_log_async_size = on
+            ? get_valid_numberKME (options.s_log_async_size, "-log-async=SIZE")
+            : 0;
+          break;
+
         case OPT_graph:
           options.do_graph_filename &= on;
           break;
@@ -680,6 +864,22 @@ parse_args (int argc, char *argv[])
         case OPT_graph_filename:
           options.do_graph = on;
           break;
+
+        case OPT_profile:
+          options.do_profile_filename &= on;
+          break;
+
+        case OPT_profile_filename:
+          options.do_profile = on;
+          break;
+
+        case OPT_perf_hist:
+          options.do_perf_hist_file &= on;
+          break;
+
+        case OPT_perf_hist_file:
+          options.do_perf_hist = on;
+          break;
         }
     }
 
@@ -760,6 +960,7 @@ put_argv (int args_addr, byte *b)
     qprintf ("*** (%04x) <-- argv[%d] = NULL\n", a, argc);
   *b++ = 0;
   *b++ = 0;
+  fuzz_dirty_range (args_addr, a + 2 - args_addr);
 
   // set argc, argc: picked up by exit.c:avrtest_init_argc_argv() in .init8
   if (is_avrtest_log)
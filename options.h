@@ -25,6 +25,7 @@
 #define OPTIONS_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct
 {
@@ -77,12 +78,30 @@ typedef struct
   int avr_argc, avr_argv;
 } args_t;
 
+typedef struct
+{
+  // From -fuzz-runs=N, 0 means no limit.
+  uint64_t runs;
+  // From -fuzz-len=N, 0 means the default.
+  unsigned max_len;
+} fuzz_args_t;
+
+typedef struct
+{
+  // From -log-sample=P[:B].
+  uint64_t period;
+  unsigned burst;
+} log_sample_args_t;
+
 extern void parse_args (int argc, char *argv[]);
 extern char** comma_list_to_array (const char *tokens, int *n);
 
 extern options_t options;
 extern args_t args;
+extern fuzz_args_t fuzz_args;
+extern log_sample_args_t log_sample_args;
 extern arch_t arch;
 extern const char *fileio_sandbox;
+extern const char *image_cache_dir;
 
 #endif // OPTIONS_H
@@ -0,0 +1,325 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* Named perf regions as started by PERF_REGION_BEGIN (NAME) and ended by
+   PERF_REGION_END().  Regions nest, and each region as entered from its
+   parent region is a node in a tree that is printed when the program
+   exits.
+
+   A name is read from the program only the first time its address is
+   used.  After that, finding the node of a region takes two lookups in
+   hash tables, hence the costs per event do not depend on the number
+   of regions.  Nothing is done for instructions that are not
+   PERF_REGION syscalls.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "testavr.h"
+#include "options.h"
+#include "logging.h"
+#include "host.h"
+
+#define IN_AVRTEST
+#include "avrtest.h"
+
+#ifndef AVRTEST_LOG
+#error no function herein is needed without AVRTEST_LOG
+#endif // AVRTEST_LOG
+
+#define LEN_REGION_NAME 100
+
+// Number of buckets of the hash tables.
+#define RPRIM 4099
+
+// A region name.
+typedef struct name_t
+{
+  struct name_t *next;
+  const char *name;
+  int id;
+} name_t;
+
+// Where a region name is located in the program:  RAM address, or
+// flash address with bit 24 set.
+typedef struct addr_t
+{
+  struct addr_t *next;
+  unsigned key;
+  name_t *name;
+} addr_t;
+
+// A region as entered from its parent region UP.
+typedef struct node_t
+{
+  struct node_t *next, *up;
+  // Sub-regions, linked by SIBLING.
+  struct node_t *kids, *sibling;
+  const name_t *name;
+  int id;
+  uint64_t count, cycles, insns, self_cycles, self_insns;
+} node_t;
+
+// An open region.
+typedef struct
+{
+  node_t *node;
+  uint64_t cycle, insn;
+  // Costs of the regions that ran inside this one.
+  uint64_t kid_cycles, kid_insns;
+} frame_t;
+
+static struct
+{
+  name_t *names[RPRIM];
+  addr_t *addrs[RPRIM];
+  node_t *nodes[RPRIM];
+  int n_names, n_nodes;
+  // Parent of the regions at the outermost level.
+  node_t root;
+  // Open regions, the innermost one last.
+  frame_t *stack;
+  int depth, n_alloc;
+} reg;
+
+
+static name_t*
+get_name (const char *s)
+{
+  unsigned h = 0;
+  for (const char *c = s; *c; c++)
+    h = h * 31 + (unsigned char) *c;
+
+  name_t **pn = & reg.names[h % RPRIM];
+  for (name_t *n = *pn; n; n = n->next)
+    if (str_eq (n->name, s))
+      return n;
+
+  name_t *n = get_mem (1, sizeof (name_t), "perf region name");
+  n->name = strcpy (get_mem (1 + strlen (s), sizeof (char),
+                             "perf region name"), s);
+  n->id = ++reg.n_names;
+  n->next = *pn;
+  *pn = n;
+  return n;
+}
+
+
+// The name at address ADDR in RAM resp. flash.  It is only read once.
+
+static name_t*
+get_name_at (unsigned addr, bool in_rom)
+{
+  unsigned key = addr | (in_rom << 24);
+  addr_t **pa = & reg.addrs[key % RPRIM];
+  for (addr_t *a = *pa; a; a = a->next)
+    if (a->key == key)
+      return a->name;
+
+  char s[LEN_REGION_NAME];
+  read_string (s, addr, in_rom, sizeof (s));
+
+  addr_t *a = get_mem (1, sizeof (addr_t), "perf region address");
+  a->key = key;
+  a->name = get_name (s);
+  a->next = *pa;
+  *pa = a;
+  return a->name;
+}
+
+
+// The node for region NAME as entered from UP.
+
+static node_t*
+get_node (node_t *up, const name_t *name)
+{
+  node_t **pn = & reg.nodes[((unsigned) up->id * 31 + name->id) % RPRIM];
+  for (node_t *n = *pn; n; n = n->next)
+    if (n->up == up && n->name == name)
+      return n;
+
+  node_t *n = get_mem (1, sizeof (node_t), "perf region");
+  n->up = up;
+  n->name = name;
+  n->id = ++reg.n_nodes;
+  n->next = *pn;
+  *pn = n;
+  n->sibling = up->kids;
+  up->kids = n;
+  return n;
+}
+
+
+static void
+region_begin (const name_t *name)
+{
+  node_t *up = reg.depth ? reg.stack[reg.depth - 1].node : & reg.root;
+
+  if (reg.depth == reg.n_alloc)
+    {
+      reg.n_alloc = reg.n_alloc ? 2 * reg.n_alloc : 64;
+      reg.stack = realloc (reg.stack, reg.n_alloc * sizeof (frame_t));
+      if (!reg.stack)
+        leave (LEAVE_MEMORY, "out of memory");
+    }
+
+  frame_t *f = & reg.stack[reg.depth++];
+  f->node = get_node (up, name);
+  f->cycle = program.n_cycles;
+  f->insn = program.n_insns;
+  f->kid_cycles = f->kid_insns = 0;
+}
+
+
+static void
+region_end (void)
+{
+  const frame_t *f = & reg.stack[--reg.depth];
+  node_t *n = f->node;
+  uint64_t cycles = program.n_cycles - f->cycle;
+  uint64_t insns = program.n_insns - f->insn;
+
+  n->count++;
+  n->cycles += cycles;
+  n->insns += insns;
+  n->self_cycles += cycles - f->kid_cycles;
+  n->self_insns += insns - f->kid_insns;
+
+  if (reg.depth)
+    {
+      reg.stack[reg.depth - 1].kid_cycles += cycles;
+      reg.stack[reg.depth - 1].kid_insns += insns;
+    }
+
+  if (options.do_timeline)
+    timeline_region (n->name->name, f->cycle, cycles);
+}
+
+
+/* SYSCALL 14:  PERF_REGION_BEGIN (NAME), PERF_REGION_PBEGIN (NAME) and
+   PERF_REGION_END().  NAME is the address in R20.  */
+
+void
+sys_perf_region_cmd (int x)
+{
+  switch (x & 0xff)
+    {
+    default:
+      log_append ("PERF_REGION: invalid cmd %d", x & 0xff);
+      break;
+
+    case PERF_REGION_BEGIN_CMD:
+    case PERF_REGION_PBEGIN_CMD:
+      {
+        bool in_rom = (x & 0xff) == PERF_REGION_PBEGIN_CMD;
+        unsigned addr = get_reg_value (20, & layout[LOG_ADDR_CMD]);
+        const name_t *name = get_name_at (addr, in_rom);
+        log_append ("PERF_REGION_BEGIN \"%s\"", name->name);
+        region_begin (name);
+      }
+      break;
+
+    case PERF_REGION_END_CMD:
+      if (!reg.depth)
+        {
+          log_append ("PERF_REGION_END ignored");
+          qprintf ("\n--- PERF_REGION_END ignored: no region is open\n");
+          break;
+        }
+      log_append ("PERF_REGION_END \"%s\"",
+                  reg.stack[reg.depth - 1].node->name->name);
+      region_end ();
+      break;
+    }
+}
+
+
+// Sort the sub-regions of a region by their cycles, most expensive first.
+
+static int
+cmp_node (const void *a, const void *b)
+{
+  const node_t *m = * (const node_t* const*) a;
+  const node_t *n = * (const node_t* const*) b;
+
+  if (m->cycles != n->cycles)
+    return m->cycles < n->cycles ? 1 : -1;
+  return m->id - n->id;
+}
+
+
+static void
+dump_node (const node_t *n, node_t **nodes, int depth, double percent)
+{
+  if (depth)
+    {
+      printf ("%10" PRIu64 " %12" PRIu64 " %6.2f %12" PRIu64
+              " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "  %*s%s\n",
+              n->count, n->cycles, percent * n->cycles, n->self_cycles,
+              n->insns, n->self_insns,
+              n->count ? n->cycles / n->count : 0,
+              2 * (depth - 1), "", n->name->name);
+    }
+
+  // NODES has room for all nodes, and the kids of N go to its front.
+  // The kids of the kids then use the space after them.
+  int n_kids = 0;
+  for (node_t *k = n->kids; k; k = k->sibling)
+    nodes[n_kids++] = k;
+  qsort (nodes, n_kids, sizeof (node_t*), cmp_node);
+
+  for (int i = 0; i < n_kids; i++)
+    dump_node (nodes[i], nodes + n_kids, depth + 1, percent);
+}
+
+
+/* Program exit:  Regions that are still open end now.  Then print the
+   tree of regions with their inclusive and exclusive costs.  */
+
+void
+perf_region_dump (void)
+{
+  if (!reg.n_nodes)
+    return;
+
+  while (reg.depth)
+    region_end ();
+
+  log_async_sync ();
+
+  uint64_t total = program.n_cycles;
+  double percent = total ? 100.0 / total : 0.0;
+
+  printf ("\n--- Perf regions: %d regions, %" PRIu64 " cycles\n",
+          reg.n_nodes, total);
+  printf ("%10s %12s %6s %12s %12s %12s %12s  %s\n", "Count", "Cycles", "%",
+          "Self", "Instr", "Self Instr", "Mean", "Region");
+
+  node_t **nodes = get_mem (reg.n_nodes, sizeof (node_t*),
+                            "perf regions");
+  dump_node (& reg.root, nodes, 0, percent);
+  printf ("\n");
+  free (nodes);
+}
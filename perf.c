@@ -47,6 +47,18 @@
 
 #define NUM_PERFS 8
 
+/* -perf-hist:  Log-linear histogram of the Ticks per round resp. of the
+   PERF_STAT values.  A magnitude m * 2^e with 1/2 <= m < 1 goes to one of
+   HIST_N_SUB buckets of the same width for that e, hence integers up to
+   127 get exact buckets and the relative error is below 1 / HIST_N_SUB.
+   Buckets are ordered by value:  Negative values, 0, positive values.  */
+#define HIST_N_SUB 64
+#define HIST_EXP_MIN (-32)
+#define HIST_EXP_MAX 64
+#define HIST_N_HALF ((HIST_EXP_MAX - HIST_EXP_MIN) * HIST_N_SUB)
+#define HIST_N_BUCKETS (2 * HIST_N_HALF + 1)
+#define HIST_ZERO HIST_N_HALF
+
 // Min / Max values can be tagged to show the tag in LOG_DUMP
 typedef struct
 {
@@ -106,12 +118,30 @@ typedef struct
   } call_only;
   // PERF_LABEL
   char label[LEN_PERF_LABEL];
+  // -perf-hist:  HIST_N_BUCKETS counters or NULL.
+  unsigned *hist;
 } perfs_t;
 
 
+// Extremal values since the last perf command and where they occurred.
+typedef struct
+{
+  long min, min_at, max, max_at;
+} extremes_t;
+
 perf_t perf;
 static perfs_t perfs[NUM_PERFS];
 
+/* Instructions without a perf command only track the extremal SP and
+   call depth.  All perfs that are on see the same values, so the next
+   perf command folds them into each of these perfs.  */
+static struct
+{
+  extremes_t sp, calls;
+  // Perfs that are on in PERF_START_CALL mode.
+  unsigned call_only;
+} track;
+
 
 void
 sys_perf_cmd (int x)
@@ -247,21 +277,142 @@ print_tags (const minmax_t *mm, const char *text)
 static INLINE void
 minmax_update (minmax_t *mm, long x, const perfs_t *p)
 {
+  unsigned at = perf.old_pc;
   if (x < mm->min && p->tag.cmd >= 0) mm->tag_min = p->tag;
   if (x > mm->max && p->tag.cmd >= 0) mm->tag_max = p->tag;
-  if (x < mm->min) { mm->min = x; mm->min_at = old_PC; mm->r_min = p->n; }
-  if (x > mm->max) { mm->max = x; mm->max_at = old_PC; mm->r_max = p->n; }
+  if (x < mm->min) { mm->min = x; mm->min_at = at; mm->r_min = p->n; }
+  if (x > mm->max) { mm->max = x; mm->max_at = at; mm->r_max = p->n; }
 }
 
 static INLINE void
 minmax_update_double (minmax_t *mm, double x, const perfs_t *p)
 {
+  unsigned at = perf.old_pc;
   if (x < mm->dmin && p->tag.cmd >= 0) mm->tag_min = p->tag;
   if (x > mm->dmax && p->tag.cmd >= 0) mm->tag_max = p->tag;
-  if (x < mm->dmin) { mm->dmin = x; mm->min_at = old_PC; mm->r_min = p->n; }
-  if (x > mm->dmax) { mm->dmax = x; mm->max_at = old_PC; mm->r_max = p->n; }
+  if (x < mm->dmin) { mm->dmin = x; mm->min_at = at; mm->r_min = p->n; }
+  if (x > mm->dmax) { mm->dmax = x; mm->max_at = at; mm->r_max = p->n; }
+}
+
+// Same as minmax_update() for all the values that made up X.
+
+static INLINE void
+minmax_merge (minmax_t *mm, const extremes_t *x, const perfs_t *p)
+{
+  if (x->min < mm->min && p->tag.cmd >= 0) mm->tag_min = p->tag;
+  if (x->max > mm->max && p->tag.cmd >= 0) mm->tag_max = p->tag;
+  if (x->min < mm->min)
+    { mm->min = x->min; mm->min_at = x->min_at; mm->r_min = p->n; }
+  if (x->max > mm->max)
+    { mm->max = x->max; mm->max_at = x->max_at; mm->r_max = p->n; }
+}
+
+static INLINE void
+extremes_init (extremes_t *x)
+{
+  x->min = LONG_MAX;
+  x->max = LONG_MIN;
 }
 
+static INLINE void
+extremes_update (extremes_t *x, long val)
+{
+  if (val < x->min) { x->min = val; x->min_at = perf.old_pc; }
+  if (val > x->max) { x->max = val; x->max_at = perf.old_pc; }
+}
+
+// -perf-hist:  The bucket for value X.
+
+static int
+hist_index (double x)
+{
+  int e;
+  double m = frexp (fabs (x), &e);
+
+  if (m == 0.0 || e < HIST_EXP_MIN)
+    return HIST_ZERO;
+
+  int k = e >= HIST_EXP_MAX
+    ? HIST_N_HALF - 1
+    : (e - HIST_EXP_MIN) * HIST_N_SUB + (int) ((m - 0.5) * 2 * HIST_N_SUB);
+
+  return x < 0 ? HIST_ZERO - 1 - k : HIST_ZERO + 1 + k;
+}
+
+
+// Lower and upper bound of bucket IDX.
+
+static void
+hist_bounds (int idx, double *lo, double *hi)
+{
+  int k = idx > HIST_ZERO ? idx - HIST_ZERO - 1 : HIST_ZERO - 1 - idx;
+  int e = k / HIST_N_SUB + HIST_EXP_MIN;
+  int sub = k % HIST_N_SUB;
+
+  if (idx == HIST_ZERO)
+    *lo = *hi = 0.0;
+  else if (idx > HIST_ZERO)
+    {
+      *lo = ldexp (0.5 + 0.5 * sub / HIST_N_SUB, e);
+      *hi = ldexp (0.5 + 0.5 * (sub + 1) / HIST_N_SUB, e);
+    }
+  else
+    {
+      *lo = -ldexp (0.5 + 0.5 * (sub + 1) / HIST_N_SUB, e);
+      *hi = -ldexp (0.5 + 0.5 * sub / HIST_N_SUB, e);
+    }
+}
+
+
+static INLINE void
+hist_add (perfs_t *p, double x)
+{
+  if (p->hist)
+    p->hist[hist_index (x)]++;
+}
+
+
+static INLINE void
+hist_clear (perfs_t *p)
+{
+  if (p->hist)
+    memset (p->hist, 0, HIST_N_BUCKETS * sizeof (unsigned));
+}
+
+
+/* The value below which PERCENT percent of the N values in the
+   histogram of P are, clipped to the extremal values MM.  Buckets of
+   width 1 or less yield their bound with the smaller magnitude, which is
+   exact for integers, other buckets yield their middle.  */
+
+static double
+hist_percentile (const perfs_t *p, int n, double percent, const minmax_t *mm,
+                 bool is_double)
+{
+  double min = is_double ? mm->dmin : mm->min;
+  double max = is_double ? mm->dmax : mm->max;
+  unsigned rank = (unsigned) ceil (n * percent / 100.0);
+  unsigned sum = 0;
+  int idx = 0;
+  double lo, hi;
+
+  if (rank < 1)
+    rank = 1;
+
+  while (idx < HIST_N_BUCKETS - 1
+         && (sum += p->hist[idx]) < rank)
+    idx++;
+  hist_bounds (idx, &lo, &hi);
+
+  // The bound with the smaller magnitude.
+  double x = hi - lo <= 1.0
+    ? (idx < HIST_ZERO ? hi : lo)
+    : (lo + hi) / 2;
+
+  return x < min ? min : x > max ? max : x;
+}
+
+
 static INLINE void
 minmax_init (minmax_t *mm, long at_start)
 {
@@ -326,6 +477,7 @@ perf_stat (perfs_t *p, int i, int cmd)
       p->n = 0;
       p->val_ev = 0.0;
       minmax_init (& p->val, 0);
+      hist_clear (p);
     }
 
   double dval;
@@ -342,6 +494,7 @@ perf_stat (perfs_t *p, int i, int cmd)
   minmax_update_double (& p->val, dval, p);
   p->val.ev2 += dval * dval;
   p->val_ev += dval;
+  hist_add (p, dval);
 
   if (!options.do_quiet)
     {
@@ -374,6 +527,7 @@ perf_start (perfs_t *p, int i, int call_depth)
       minmax_init (& p->calls, call_depth);
       minmax_init (& p->sp,    perf.sp);
       minmax_init (& p->pc,    p->pc_start = cpu.pc);
+      hist_clear (p);
     }
 
   // (Re)start
@@ -442,6 +596,11 @@ perf_stop (perfs_t *p, int i, bool dump_all, int cmd, int call_depth, int sp)
       p->insns += insns;
       minmax_update (& p->insn, insns, p);
       minmax_update (& p->tick, ticks, p);
+      hist_add (p, ticks);
+
+      if (options.do_timeline)
+        timeline_perf (i, p->label, p->tick.at_start,
+                       p->tick.at_end - p->tick.at_start);
 
       qprintf ("%sStop T%d (round %d",
                dump_all ? "  " : "\n--- ", i, p->n);
@@ -454,6 +613,42 @@ perf_stop (perfs_t *p, int i, bool dump_all, int cmd, int call_depth, int sp)
 }
 
 
+static const double hist_percents[] = { 50, 90, 99, 99.9 };
+
+// -perf-hist[=FILE]:  Print percentiles and write the buckets to FILE.
+
+static void
+perf_dump_hist (const perfs_t *p, int i)
+{
+  bool is_stat = p->valid == PERF_STAT_CMD;
+  const minmax_t *mm = is_stat ? & p->val : & p->tick;
+
+  printf ("\n   %s", is_stat ? " Values" : " Ticks ");
+  for (size_t k = 0; k < sizeof (hist_percents) / sizeof (double); k++)
+    {
+      double x = hist_percentile (p, p->n, hist_percents[k], mm, is_stat);
+      printf ("  p%g: ", hist_percents[k]);
+      printf (is_stat ? "%g" : "%.0f", x);
+    }
+  printf ("\n");
+
+  if (!perf.hist_file)
+    return;
+
+  for (int idx = 0; idx < HIST_N_BUCKETS; idx++)
+    if (p->hist[idx])
+      {
+        double lo, hi;
+        hist_bounds (idx, &lo, &hi);
+        fprintf (perf.hist_file, "%d,%d,", perf.n_dumps, i);
+        json_string (perf.hist_file, p->label);
+        fprintf (perf.hist_file, ",%s,%.17g,%.17g,%u\n",
+                 is_stat ? "stat" : "ticks", lo, hi, p->hist[idx]);
+      }
+  fflush (perf.hist_file);
+}
+
+
 // PERF_DUMP (i)
 static void
 perf_dump (perfs_t *p, int i, bool dump_all)
@@ -530,6 +725,9 @@ perf_dump (perfs_t *p, int i, bool dump_all)
       printf ("\n");
     }
 
+  if (p->hist && p->n)
+    perf_dump_hist (p, i);
+
   printf ("\n");
 
   p->valid = 0;
@@ -537,22 +735,75 @@ perf_dump (perfs_t *p, int i, bool dump_all)
 }
 
 
+// -result=FILE: Add the perf-meters that hold data, i.e. that have not
+// been dumped by PERF_DUMP, to the JSON record.
+
 void
-perf_instruction (int id, int call_depth)
+perf_result (FILE *out)
 {
-  perf.will_be_on = false;
+  const char *sep = "";
+
+  fprintf (out, ",\"perf\":[");
+
+  for (int i = 1; i < NUM_PERFS; i++)
+    {
+      const perfs_t *p = &perfs[i];
+      if (!p->valid)
+        continue;
 
-  int sp = get_nonglitch_SP();
+      fprintf (out, "%s{\"id\":%d,\"label\":", sep, i);
+      json_string (out, p->label);
+
+      if (p->valid == PERF_START_CMD)
+        {
+          fprintf (out, ",\"kind\":\"timer\",\"rounds\":%d"
+                   ",\"instructions\":%u,\"ticks\":%u"
+                   ",\"pc_start\":%u,\"pc_end\":%u",
+                   p->n, p->insns, p->ticks, 2 * p->pc_start, 2 * p->pc_end);
+          // Extremal values of the completed rounds.
+          if (p->n - p->on > 0)
+            fprintf (out, ",\"instructions_min\":%ld"
+                     ",\"instructions_max\":%ld"
+                     ",\"ticks_min\":%ld,\"ticks_max\":%ld",
+                     p->insn.min, p->insn.max, p->tick.min, p->tick.max);
+        }
+      else /* PERF_STAT */
+        fprintf (out, ",\"kind\":\"stat\",\"values\":%d"
+                 ",\"mean\":%.17g,\"min\":%.17g,\"max\":%.17g",
+                 p->n, p->val_ev / p->n, p->val.dmin, p->val.dmax);
 
-  // actions requested by perf SYSCALLs 5..6
+      fprintf (out, "}");
+      sep = ",";
+    }
 
-  int pmask = perf.pmask;
+  fprintf (out, "]");
+}
 
-  if (!perf.on && !pmask)
-    goto done;
+
+// PERF_START_CALL:  Only account costs (including CALL+RET) if we have
+// a call depth > 0 relative to the starting point.
+
+static INLINE void
+perf_call_only (perfs_t *p, const meter_t *m, int sp)
+{
+  if (sp < p->call_only.sp || perf.sp < p->call_only.sp)
+    {
+      p->call_only.insns += 1;
+      p->call_only.ticks += m->cycles - perf.tick;
+    }
+}
+
+
+// Actions requested by perf SYSCALLs 5..6
+
+static void
+perf_command (const meter_t *m, int call_depth, int pmask)
+{
+  int sp = m->sp;
 
   perf.pmask = 0;
   perf.on = false;
+  track.call_only = 0;
 
   int cmd = perf.cmd;
   if (cmd == PERF_DUMP_CMD)
@@ -579,14 +830,14 @@ perf_instruction (int id, int call_depth)
 
       perfs_t *p = &perfs[i];
 
-      if (p->on
-          // PERF_START_CALL:  Only account costs (including CALL+RET)
-          // if we have a call depth > 0 relative to the starting point.
-          && p->call_only.sp < INT_MAX
-          && (sp < p->call_only.sp || perf.sp < p->call_only.sp))
+      if (p->on)
         {
-          p->call_only.insns += 1;
-          p->call_only.ticks += program.n_cycles - perf.tick;
+          // Catch up with the instructions since the previous command.
+          minmax_merge (& p->sp, & track.sp, p);
+          minmax_merge (& p->calls, & track.calls, p);
+
+          if (p->call_only.sp < INT_MAX)
+            perf_call_only (p, m, sp);
         }
 
       if (stop || dump)
@@ -611,14 +862,50 @@ perf_instruction (int id, int call_depth)
         perf_stat (p, i, cmd);
 
       perf.on |= p->on;
+      if (p->on && p->call_only.sp < INT_MAX)
+        track.call_only |= 1u << i;
+    }
+
+  extremes_init (& track.sp);
+  extremes_init (& track.calls);
+}
+
+
+/* Called after each instruction.  Perfs are only visited by instructions
+   that issue a perf command.  Costs are the differences of the global
+   cycle and instruction counters between START and STOP, hence the other
+   instructions only have to track extremal SP and call depth, and the
+   costs for PERF_START_CALL.  */
+
+void
+perf_instruction (const meter_t *m, int call_depth)
+{
+  perf.will_be_on = false;
+  perf.old_pc = m->old_pc;
+
+  int sp = m->sp;
+  int pmask = perf.pmask;
+
+  if (pmask)
+    perf_command (m, call_depth, pmask);
+  else if (perf.on)
+    {
+      extremes_update (& track.sp, sp);
+      extremes_update (& track.calls, call_depth);
+
+      for (unsigned i = 1, mask = track.call_only; mask; i++)
+        if (mask & (1u << i))
+          {
+            mask &= ~(1u << i);
+            perf_call_only (&perfs[i], m, sp);
+          }
     }
 
- done:;
   // Store for the next call of ours.  Needed because log_dump_line()
   // must run after the instruction has performed and we might need
   // the values from before the instruction.
   perf.sp  = sp;
-  perf.tick = (dword) program.n_cycles;
+  perf.tick = (dword) m->cycles;
 }
 
 
@@ -627,4 +914,26 @@ perf_init (void)
 {
   for (int i = 1; i < NUM_PERFS; i++)
     perfs[i].tag_for_start.cmd = -1;
+
+  if (options.do_perf_hist)
+    {
+      for (int i = 1; i < NUM_PERFS; i++)
+        perfs[i].hist = get_mem (HIST_N_BUCKETS, sizeof (unsigned),
+                                 "-perf-hist buckets");
+
+      const char *fname = options.do_perf_hist_file
+        && !str_eq ("", options.s_perf_hist_file)
+        ? options.s_perf_hist_file
+        : NULL;
+      if (fname)
+        {
+          perf.hist_file = str_eq ("-", fname) ? stdout : fopen (fname, "w");
+          if (!perf.hist_file)
+            leave (LEAVE_FATAL, "cannot open \"%s\" for writing", fname);
+          fprintf (perf.hist_file, "dump,meter,label,kind,low,high,count\n");
+        }
+    }
+
+  extremes_init (& track.sp);
+  extremes_init (& track.calls);
 }
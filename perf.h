@@ -24,6 +24,7 @@
 #ifndef PERF_H
 #define PERF_H
 
+#include <stdio.h>
 #include <stdbool.h>
 
 typedef struct
@@ -44,12 +45,16 @@ typedef struct
   // From PERF_STOP_XXX()
   double dval;
   bool pending_LOG_TAG_FMT;
+  // old_PC of the instruction processed by perf_instruction().
+  unsigned old_pc;
+  // -perf-hist=FILE
+  FILE *hist_file;
 } perf_t;
 
 extern void perf_init (void);
 extern void sys_perf_cmd (int x);
 extern void sys_perf_tag_cmd (int x);
-extern void perf_instruction (int id, int call_depth);
+extern void perf_instruction (const meter_t*, int call_depth);
 
 extern perf_t perf;
 
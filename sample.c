@@ -0,0 +1,478 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* -sample=N:  A statistical profiler that also works with the fast
+   flavours of avrtest.  Each time another N cycles have passed, the PC
+   and, with -sample-flame=FILE, the return addresses on the stack are
+   recorded.  Equal stacks are counted in a hash
+   table.  At exit, the samples are attributed to functions by means of
+   the ELF symbols, and printed as flat profile resp. written as folded
+   stacks for flame graphs.
+
+   There is no call tracking:  The stack walk takes each value on the
+   stack that would return right after a CALL, RCALL, ICALL or EICALL as
+   a return address, hence a local variable with such a value adds a
+   bogus frame.
+
+   There is no per-instruction cost:  The sampler lowers program.max_insns
+   to the first instruction that might reach the next sample cycle, which
+   is the mechanism that -m MAXCOUNT and -quantum=N are using.  The gaps
+   get smaller as the sample cycle is approaching, hence the samples are
+   taken at the same instructions as with a check after each one.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "testavr.h"
+#include "options.h"
+#include "sample.h"
+
+// Number of buckets of the hash tables.
+#define SPRIM 4099
+
+// At most that many return addresses are taken from the stack.
+#define SAMPLE_MAX_DEPTH 64
+
+// The stack walk ends that many bytes above the highest SP of a sample.
+#define SAMPLE_SLACK 64
+
+// An upper bound for the cycles of one instruction, including the
+// extra cycles for 3-byte PCs and for skips.
+#define SAMPLE_MAX_CYCLES 6
+
+// A call stack together with the number of samples that have seen it.
+typedef struct sample
+{
+  struct sample *next;
+  unsigned hash;
+  uint64_t count;
+  int n;
+  // Word addresses, innermost first.  sample_dump() reuses the type
+  // for the stacks of functions, with the indices of func[] as keys.
+  unsigned key[];
+} sample_t;
+
+// A symbol in executable code.  A function extends up to the next one.
+typedef struct
+{
+  // Symbol name or NULL for the code before the first symbol.
+  const char *name;
+  // Word address of the symbol.
+  unsigned pc;
+  bool is_func;
+  // Samples in the function resp. with the function on the stack.
+  uint64_t self, incl;
+  // Last stack that added to .incl.
+  const sample_t *seen;
+} func_t;
+
+static struct
+{
+  // Cycle at which to take the next sample.
+  uint64_t cycle;
+  // Instruction count of the next checkpoint, and program.max_insns as
+  // set by -m MAXCOUNT or -quantum=N.
+  uint64_t check_insns, max_insns;
+  // Whether to walk the stack.
+  bool walk;
+  // Highest SP as seen by a sample.
+  unsigned sp_max;
+  uint64_t n_samples;
+  sample_t *stacks[SPRIM];
+  int n_stacks;
+  // The ELF string table and the symbols in executable code.  func[0]
+  // is for code in front of the first symbol.
+  const char *strtab;
+  func_t *func;
+  int n_funcs, n_alloc;
+  // The hooks of the ELF loader that we are chaining to.
+  void (*set_string_table) (const char*, size_t, int);
+  void (*function_symbol) (int, size_t, bool);
+  void (*finish_string_table) (void);
+} smp;
+
+
+static void
+sample_string_table (const char *stab, size_t size, int n_entries)
+{
+  smp.strtab = stab;
+  smp.set_string_table (stab, size, n_entries);
+}
+
+
+static void
+sample_function_symbol (int addr, size_t stoff, bool is_func)
+{
+  smp.function_symbol (addr, stoff, is_func);
+
+  const char *name = smp.strtab + stoff;
+  if (addr % 2 != 0
+      || addr >= MAX_FLASH_SIZE
+      // Internal labels
+      || name[0] == '.'
+      || (name[0] && name[1] && name[2] && name[2] < 0x20))
+    return;
+
+  if (smp.n_funcs == smp.n_alloc)
+    {
+      smp.n_alloc *= 2;
+      smp.func = realloc (smp.func, smp.n_alloc * sizeof (func_t));
+      if (!smp.func)
+        leave (LEAVE_MEMORY, "out of memory");
+    }
+
+  func_t *f = & smp.func[smp.n_funcs++];
+  memset (f, 0, sizeof (func_t));
+  f->name = name;
+  f->pc = addr / 2;
+  f->is_func = is_func;
+}
+
+
+// Sort symbols by address.  STT_FUNC symbols go first so they win
+// against labels at the same address.
+
+static int
+cmp_symbol (const void *a, const void *b)
+{
+  const func_t *f = (const func_t*) a;
+  const func_t *g = (const func_t*) b;
+
+  if (f->pc != g->pc)
+    return f->pc < g->pc ? -1 : 1;
+  if (f->is_func != g->is_func)
+    return f->is_func ? -1 : 1;
+  return strcmp (f->name, g->name);
+}
+
+
+// Sort the symbols and only keep one per address.
+
+static void
+sample_finish_string_table (void)
+{
+  smp.finish_string_table ();
+
+  qsort (smp.func + 1, smp.n_funcs - 1, sizeof (func_t), cmp_symbol);
+
+  int n = 1;
+  for (int i = 1; i < smp.n_funcs; i++)
+    if (n == 1 || smp.func[i].pc != smp.func[n - 1].pc)
+      smp.func[n++] = smp.func[i];
+  smp.n_funcs = n;
+}
+
+
+void
+sample_schedule (void)
+{
+  if (!options.do_sample)
+    return;
+
+  smp.max_insns = program.max_insns;
+  if (!smp.max_insns || smp.check_insns < smp.max_insns)
+    program.max_insns = smp.check_insns;
+}
+
+
+// The earliest instruction after which program.n_cycles might have
+// reached smp.cycle.  INSN is the count of the next instruction.
+
+static void
+set_checkpoint (uint64_t insn)
+{
+  uint64_t cycles = smp.cycle - program.n_cycles;
+  smp.check_insns = insn + (cycles - 1) / SAMPLE_MAX_CYCLES;
+}
+
+
+// Must run after cores_init() which records -m MAXCOUNT.
+
+void
+sample_init (void)
+{
+  if (!options.do_sample)
+    return;
+
+  smp.cycle = options.do_sample;
+  set_checkpoint (program.n_insns);
+  // program.max_insns = 0 means "no limit", hence a small N might take
+  // the very first sample one instruction late.
+  if (!smp.check_insns)
+    smp.check_insns = 1;
+  sample_schedule ();
+
+  smp.walk = options.do_sample_flame;
+  smp.n_alloc = 256;
+  smp.n_funcs = 1;
+  smp.func = get_mem (smp.n_alloc, sizeof (func_t), "-sample symbols");
+
+  smp.set_string_table = sim.set_elf_string_table;
+  smp.function_symbol = sim.set_elf_function_symbol;
+  smp.finish_string_table = sim.finish_elf_string_table;
+
+  sim.set_elf_string_table = sample_string_table;
+  sim.set_elf_function_symbol = sample_function_symbol;
+  sim.finish_elf_string_table = sample_finish_string_table;
+}
+
+
+// Whether word address PC follows a call.  "RCALL .+0" only allocates
+// stack.
+
+static bool
+is_return_address (unsigned pc)
+{
+  if (pc < 1 || pc > program.max_pc)
+    return false;
+
+  const decoded_t *d = & cpu.decoded_flash[pc - 1];
+  if (d->id == ID_ICALL || d->id == ID_EICALL
+      || (d->id == ID_RCALL && d->op2 != 0))
+    return true;
+
+  return pc >= 2 && d[-1].id == ID_CALL;
+}
+
+
+// The stack with the N word addresses KEY in TAB[], added if needed.
+
+static sample_t*
+get_sample (sample_t **tab, const unsigned *key, int n)
+{
+  unsigned h = 2166136261u;
+  for (int i = 0; i < n; i++)
+    h = (h ^ key[i]) * 16777619u;
+
+  sample_t **ps = & tab[h % SPRIM];
+  for (sample_t *s = *ps; s; s = s->next)
+    if (s->hash == h && s->n == n
+        && !memcmp (s->key, key, n * sizeof (unsigned)))
+      return s;
+
+  sample_t *s = get_mem (1, sizeof (sample_t) + n * sizeof (unsigned),
+                         "-sample stack");
+  s->hash = h;
+  s->n = n;
+  memcpy (s->key, key, n * sizeof (unsigned));
+  s->next = *ps;
+  *ps = s;
+  return s;
+}
+
+
+static void
+sample_take (void)
+{
+  do
+    smp.cycle += options.do_sample;
+  while (smp.cycle <= program.n_cycles);
+
+  unsigned pcs[SAMPLE_MAX_DEPTH];
+  int n = 0;
+  pcs[n++] = cpu.pc;
+
+  const byte *ram = cpu.f_data ();
+  unsigned sp = ram[addr_SPL] | (ram[addr_SPL + 1] << 8);
+  if (sp > smp.sp_max)
+    smp.sp_max = sp;
+
+  if (smp.walk)
+    {
+      // Return addresses are stored big-endian above SP.
+      unsigned n_bytes = 2 + arch.pc_3bytes;
+      unsigned end = smp.sp_max + SAMPLE_SLACK;
+      if (end > cpu.ram_valid_mask)
+        end = cpu.ram_valid_mask;
+
+      for (unsigned a = sp + 1; a + n_bytes - 1 <= end; a++)
+        {
+          unsigned pc = (ram[a] << 8) | ram[a + 1];
+          if (arch.pc_3bytes)
+            pc = (pc << 8) | ram[a + 2];
+          if (is_return_address (pc))
+            {
+              pcs[n++] = pc;
+              if (n == SAMPLE_MAX_DEPTH)
+                break;
+              a += n_bytes - 1;
+            }
+        }
+    }
+
+  smp.n_samples++;
+  if (!get_sample (smp.stacks, pcs, n)->count++)
+    smp.n_stacks++;
+}
+
+
+bool
+sample_reached (void)
+{
+  if (!options.do_sample
+      || program.n_insns < smp.check_insns)
+    return false;
+
+  program.max_insns = smp.max_insns;
+
+  if (program.n_cycles >= smp.cycle)
+    sample_take ();
+
+  set_checkpoint (program.n_insns + 1);
+  sample_schedule ();
+
+  return !(smp.max_insns && program.n_insns >= smp.max_insns);
+}
+
+
+// The index into func[] of the function that contains word address PC.
+
+static unsigned
+func_index (unsigned pc)
+{
+  unsigned lo = 0, hi = smp.n_funcs;
+  while (hi - lo > 1)
+    {
+      unsigned mid = (lo + hi) / 2;
+      if (smp.func[mid].pc <= pc)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+
+static const char*
+func_name (unsigned i)
+{
+  return smp.func[i].name ? smp.func[i].name : "??";
+}
+
+
+// Sort functions by own samples, then by inclusive samples.
+
+static int
+cmp_samples (const void *a, const void *b)
+{
+  const func_t *f = * (const func_t* const*) a;
+  const func_t *g = * (const func_t* const*) b;
+
+  if (f->self != g->self)
+    return f->self < g->self ? 1 : -1;
+  if (f->incl != g->incl)
+    return f->incl < g->incl ? 1 : -1;
+  return f->pc < g->pc ? -1 : f->pc > g->pc;
+}
+
+
+/* -sample-flame=FILE:  Write one line per call stack of functions, from
+   the bottom to the top of the stack and separated by ';', followed by
+   the number of samples.  */
+
+static void
+write_folded (sample_t **by_func)
+{
+  const char *fname = options.s_sample_flame;
+  FILE *out = str_eq ("-", fname) ? stdout : fopen (fname, "w");
+  if (!out)
+    leave (LEAVE_FATAL, "cannot open \"%s\" for writing", fname);
+
+  for (int i = 0; i < SPRIM; i++)
+    for (const sample_t *s = by_func[i]; s; s = s->next)
+      {
+        for (int k = s->n - 1; k >= 0; k--)
+          fprintf (out, "%s%c", func_name (s->key[k]), k ? ';' : ' ');
+        fprintf (out, "%" PRIu64 "\n", s->count);
+      }
+
+  fflush (out);
+  if (out != stdout)
+    fclose (out);
+}
+
+
+void
+sample_dump (void)
+{
+  if (!options.do_sample)
+    return;
+
+  // Attribute the samples to functions.  With -sample-flame, also merge
+  // the stacks that have the same functions.
+  sample_t **by_func = smp.walk
+    ? get_mem (SPRIM, sizeof (sample_t*), "-sample stacks")
+    : NULL;
+
+  for (int i = 0; i < SPRIM; i++)
+    for (const sample_t *s = smp.stacks[i]; s; s = s->next)
+      {
+        unsigned funcs[SAMPLE_MAX_DEPTH];
+        for (int k = 0; k < s->n; k++)
+          {
+            func_t *f = & smp.func[funcs[k] = func_index (s->key[k])];
+            if (f->seen != s)
+              {
+                f->seen = s;
+                f->incl += s->count;
+              }
+          }
+        smp.func[funcs[0]].self += s->count;
+
+        if (by_func)
+          get_sample (by_func, funcs, s->n)->count += s->count;
+      }
+
+  if (by_func)
+    write_folded (by_func);
+
+  int n_hot = 0;
+  func_t **hots = get_mem (smp.n_funcs, sizeof (func_t*), "-sample");
+  for (int i = 0; i < smp.n_funcs; i++)
+    if (smp.func[i].incl)
+      hots[n_hot++] = & smp.func[i];
+  qsort (hots, n_hot, sizeof (func_t*), cmp_samples);
+
+  double percent = smp.n_samples ? 100.0 / smp.n_samples : 0.0;
+
+  printf ("\n--- Samples: %" PRIu64 " every %d cycles, %d stacks\n\n",
+           smp.n_samples, options.do_sample, smp.n_stacks);
+  printf ("%10s %6s", "Self", "%");
+  if (smp.walk)
+    printf (" %10s %6s", "Inclusive", "%");
+  printf ("  %s\n", "Function");
+
+  for (int i = 0; i < n_hot; i++)
+    {
+      const func_t *f = hots[i];
+      printf ("%10" PRIu64 " %6.2f", f->self, percent * f->self);
+      if (smp.walk)
+        printf (" %10" PRIu64 " %6.2f", f->incl, percent * f->incl);
+      printf ("  %s\n", func_name (f - smp.func));
+    }
+  printf ("\n");
+
+  free (hots);
+}
@@ -0,0 +1,42 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdbool.h>
+
+// -sample=N: Hook into the ELF loader to collect the function symbols.
+extern void sample_init (void);
+
+// -sample=N: program.max_insns has been reached.  Take a sample when
+// another N cycles have passed.  Return true when this was only a
+// checkpoint of the sampler and not -m MAXCOUNT or -quantum=N.
+extern bool sample_reached (void);
+
+// -sample=N: Lower program.max_insns to the next checkpoint after -m
+// MAXCOUNT or -quantum=N have set it.
+extern void sample_schedule (void);
+
+// -sample=N: Print the flat profile and write the folded stacks.
+extern void sample_dump (void);
+
+#endif // SAMPLE_H
@@ -24,6 +24,7 @@
 #ifndef TESTAVR_H
 #define TESTAVR_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -204,7 +205,9 @@ ATTR_PRINTF(2,3)
 extern void NOINLINE NORETURN leave (int status, const char *reason, ...);
 ATTR_PRINTF(1,2)
 extern void qprintf (const char *fmt, ...);
+extern void json_string (FILE*, const char*);
 extern byte* cpu_address (int, int);
+extern void fuzz_dirty_range (unsigned, size_t);
 extern void* get_mem (unsigned, size_t, const char*);
 extern unsigned peek_return_PC (void);
 
@@ -246,11 +249,18 @@ extern bool log_unused;
 #define log_append_va(...)     (void) 0
 #define log_add_instr(...)     (void) 0
 #define log_add_data_mov(...)  (void) 0
+#define log_add_reg_mov(...)   (void) 0
 #define log_add_flag_read(...) (void) 0
 #define log_dump_line(...)     (void) 0
 #define log_do_syscall(...)    (void) 0
 #define log_maybe_change_SP(...)  (void) 0
 #define log_position()         0
+#define perf_result(...)       (void) 0
+#define log_async_putc(...)    false
+#define log_async_sync(...)    (void) 0
+#define log_async_finish(...)  (void) 0
+#define log_flight_dump(...)   (void) 0
+#define log_watch(...)         (void) 0
 
 #else
 
@@ -260,13 +270,53 @@ ATTR_PRINTF(1,2)
 extern void log_append (const char *fmt, ...);
 extern void log_append_va (const char *fmt, va_list);
 extern void log_add_instr (const decoded_t *op);
-extern void log_add_data_mov (const char *format, int addr, int value);
+extern void log_add_data_mov (int addr, int value, int n_bytes, bool write);
 extern void log_add_flag_read (int mask, int value);
-extern void log_add_reg_mov (const char *format, int regno, int value);
+extern void log_add_reg_mov (int regno, int value, int n_bytes, bool write);
 extern void log_dump_line (const decoded_t*);
 extern void log_do_syscall (int x, int val);
 extern void log_maybe_change_SP (int);
 extern int log_position (void);
+extern void perf_result (FILE*);
+extern bool log_async_putc (char, FILE*);
+extern void log_async_sync (void);
+extern void log_async_finish (void);
+extern void log_flight_dump (void);
+extern void log_elf_symbol (const char*, unsigned, bool);
+
+// -watch=ITEMS from watch.c.
+#define WATCH_PAGE_SHIFT 8
+extern byte watch_pages[];
+extern void watch_init (void);
+extern void watch_data_symbol (const char*, int addr, unsigned size);
+extern void watch_hit (int addr, int old, int value, bool write);
+
+// -hotspots[=N] from hotspots.c.
+extern void hotspots_init (void);
+extern void hotspots_elf_symbol (const char*, unsigned pc, bool is_func);
+extern void hotspots_count (const decoded_t*, unsigned pc, uint64_t cycles);
+extern void hotspots_dump (void);
+
+// PERF_REGION_BEGIN etc. from perf-region.c.
+extern void sys_perf_region_cmd (int);
+extern void perf_region_dump (void);
+
+// -timeline=FILE from timeline.c.
+extern void timeline_init (void);
+extern void timeline_call (const char*, uint64_t start, uint64_t cycles);
+extern void timeline_perf (int, const char*, long start, long ticks);
+extern void timeline_region (const char*, uint64_t start, uint64_t cycles);
+extern void timeline_finish (void);
+
+// Data address ADDR is accessed.  Only pay one bit test unless ADDR
+// is located on a page that holds a watched object.
+static INLINE void
+log_watch (int addr, int old, int value, bool write)
+{
+  unsigned page = (unsigned) addr >> WATCH_PAGE_SHIFT;
+  if (watch_pages[page / 8] & (1u << (page % 8)))
+    watch_hit (addr, old, value, write);
+}
 
 typedef struct
 {
@@ -274,9 +324,31 @@ typedef struct
   bool logging;
   bool graph, graph_cost;
   bool call_depth;
+  bool flight;
+  // -flight-recorder, -log-sample, -log-func etc. or -hotspots.
+  bool hooks;
 } need_t;
 
 
+// The state after an instruction as seen by the meters from graph.c and
+// perf.c.  Built by log_dump_line().  With -meter-async, the meter thread
+// works on a copy while the simulation moves on.
+typedef struct
+{
+  // IDs of the instruction and of the one executed before it.
+  int id, old_id;
+  // The 2nd operand of the instruction.
+  int op2;
+  // cpu.pc after the instruction, and old_PC.
+  unsigned pc, old_pc;
+  // get_nonglitch_SP() and R25:R24 after the instruction.
+  int sp, r24;
+  // Cycles and instructions so far, including this instruction.
+  uint64_t cycles, insns;
+  // Whether the instruction is being logged, i.e. !log_unused.
+  bool log;
+} meter_t;
+
 // Some data shared by logging modules logging.c, perf.c, graph.c.
 // Objects hosted by logging.c.
 extern need_t need;
@@ -287,9 +359,9 @@ extern int get_nonglitch_SP (void);
 
 extern const char s_SREG[8];
 
-void no_elf_string_table (char *stab, size_t size, int n_entries);
+void no_elf_string_table (const char *stab, size_t size, int n_entries);
 void no_elf_function_symbol (int addr, size_t offset, bool is_func);
-void no_elf_object_symbol (int addr, size_t offset);
+void no_elf_object_symbol (int addr, size_t offset, unsigned size);
 void no_elf_string_table_finish (void);
 void no_elf_symbol (const char *name, size_t stoff, unsigned pc, bool is_func);
 
@@ -309,18 +381,22 @@ typedef struct object_t
 
 typedef struct
 {
-  void (*set_elf_string_table) (char *stab, size_t size, int n_entries);
+  void (*set_elf_string_table) (const char *stab, size_t size, int n_entries);
   void (*set_elf_function_symbol) (int addr, size_t offset, bool is_func);
-  void (*set_elf_object_symbol) (int addr, size_t offset);
+  void (*set_elf_object_symbol) (int addr, size_t offset, unsigned size);
   void (*finish_elf_string_table) (void);
 
   struct
   {
-    void (*set_string_table) (char*, size_t, int);
+    void (*set_string_table) (const char*, size_t, int);
     void (*elf_symbol) (const char*, size_t, unsigned, bool);
     void (*finish_string_table) (void);
   } graph;
 
+  // -timeline:  LOG_XXX printed TEXT by means of format FMT.  VALUE
+  // points to the numeric value or is NULL for strings.
+  void (*log_value) (const char *fmt, const char *text, const double *value);
+
   function_t *function_list;
   object_t *object_list;
 } sim_t;
@@ -348,6 +424,8 @@ extern string_table_t string_table;
 
 
 extern void load_to_flash (const char*, byte[], byte[], byte[]);
+extern const byte* map_file (const char*, size_t*);
+extern const byte* map_program_file (const char*, size_t*);
 extern void decode_flash (decoded_t[], const byte[]);
 extern void put_argv (int, byte*);
 
@@ -0,0 +1,47 @@
+/* avrtest_fuzz_input from syscall 12:  At most LEN bytes are read, and the
+   bytes after them are left alone.  run-avrtest.sh runs with -no-stdin
+   where no bytes are read.  With avrtest_fuzz this is a small harness
+   that must not go haywire for any input.  */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "avrtest.h"
+
+#define LEN 12
+#define GUARD 4
+
+static uint8_t buf[LEN + GUARD];
+
+static volatile uint8_t sum;
+
+// Sum of the data bytes of a record:  Length byte, then the data.
+__attribute__((__noinline__,__noclone__))
+static uint8_t parse (const uint8_t *p, size_t n)
+{
+    if (n == 0 || p[0] > n - 1)
+        return 0;
+
+    uint8_t s = 0;
+    for (uint8_t i = 1; i <= p[0]; ++i)
+        s += p[i];
+    return s;
+}
+
+int main (void)
+{
+    for (size_t i = 0; i < sizeof (buf); ++i)
+        buf[i] = 0xa5;
+
+    size_t n = avrtest_fuzz_input (buf, LEN);
+    if (n > LEN)
+        exit (__LINE__);
+
+    for (size_t i = LEN; i < sizeof (buf); ++i)
+        if (buf[i] != 0xa5)
+            exit (__LINE__);
+
+    sum = parse (buf, n);
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/* Links between cores from syscall 13.  run-avrtest.sh simulates one core
+   where all links are invalid.  With  AARGS=-cores=link.elf,link.elf
+   the program also runs as cores 1 and 2, which echo what core 0 sends
+   them, incremented by 1.  */
+
+#include <stdlib.h>
+
+#include "avrtest.h"
+
+#define N_BYTES 20
+
+static void single (void)
+{
+    if (avrtest_link_send (1, 'x') != -1) exit (__LINE__);
+    if (avrtest_link_recv (1) != -1)      exit (__LINE__);
+    if (avrtest_link_poll (1) != -1)      exit (__LINE__);
+}
+
+// Core 0:  Send bytes to the other cores and check their answers.
+static void master (int n_cores)
+{
+    for (int core = 1; core < n_cores; ++core)
+    {
+        if (avrtest_link_send (core, core) != 0)
+            exit (__LINE__);
+        for (int i = 0; i < N_BYTES; ++i)
+            if (avrtest_link_send (core, i) != 0)
+                exit (__LINE__);
+    }
+
+    for (int core = 1; core < n_cores; ++core)
+        for (int i = 0; i < N_BYTES; ++i)
+            if (avrtest_link_recv (core) != i + 1)
+                exit (__LINE__);
+}
+
+// Cores 1, 2, ...:  Echo to core 0.
+static void echo (int id)
+{
+    if (avrtest_link_recv (0) != id)
+        exit (__LINE__);
+
+    for (int i = 0; i < N_BYTES; ++i)
+    {
+        int c = avrtest_link_recv (0);
+        if (c < 0 || avrtest_link_send (0, c + 1) != 0)
+            exit (__LINE__);
+    }
+}
+
+int main (void)
+{
+    int id = avrtest_core_id ();
+    int n_cores = avrtest_n_cores ();
+
+    if (id < 0 || n_cores < 1 || id >= n_cores)
+        exit (__LINE__);
+
+    // A core has no link to itself.
+    if (avrtest_link_send (id, 'x') != -1) exit (__LINE__);
+    if (avrtest_link_poll (id) != -1)      exit (__LINE__);
+
+    if (n_cores == 1)
+        single ();
+    else if (id == 0)
+        master (n_cores);
+    else
+        echo (id);
+
+    return 0;
+}
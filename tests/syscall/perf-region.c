@@ -0,0 +1,70 @@
+/* Perf regions from syscall 14:  END without open region, nesting,
+   names that are used more than once and a region that is still open
+   when the program exits.  Run with avrtest=avrtest_log in order to get
+   the region tree.  */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "avrtest.h"
+
+#ifndef __AVR_TINY__
+#include <avr/pgmspace.h>
+
+static const char outer_p[] PROGMEM = "outer";
+#endif
+
+static char inner_copy[8];
+
+__attribute__((__noinline__,__noclone__))
+static uint16_t fib (uint8_t n)
+{
+    PERF_REGION_BEGIN ("fib");
+    uint16_t f = n < 2 ? n : fib (n - 1) + fib (n - 2);
+    PERF_REGION_END ();
+    return f;
+}
+
+__attribute__((__noinline__,__noclone__))
+static uint16_t inner (uint8_t n, const char *name)
+{
+    PERF_REGION_BEGIN (name);
+    uint16_t f = fib (n);
+    PERF_REGION_END ();
+    return f;
+}
+
+int main (void)
+{
+    // Nothing is open yet:  Must be ignored.
+    PERF_REGION_END ();
+
+    strcpy (inner_copy, "inner");
+
+    for (uint8_t i = 0; i < 10; ++i)
+    {
+        // The same address each time:  The name is only read once.
+#ifndef __AVR_TINY__
+        PERF_REGION_PBEGIN (outer_p);
+#else
+        PERF_REGION_BEGIN ("outer");
+#endif
+
+        // Same name at two different addresses:  One region.
+        if (inner (i, "inner") != inner (i, inner_copy))
+            exit (__LINE__);
+
+        PERF_REGION_END ();
+    }
+
+    if (fib (10) != 55)
+        exit (__LINE__);
+
+    // One END too many, and the region that is still open at exit
+    // ends with the program.
+    PERF_REGION_END ();
+    PERF_REGION_BEGIN ("exit");
+
+    return 0;
+}
@@ -0,0 +1,289 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* -timeline=FILE:  Write the function calls, the perf-meter rounds and
+   the LOG_XXX values as trace events in the JSON format of Chrome's
+   about:tracing and of ui.perfetto.dev.  Time stamps are in cycles, hence
+   one microsecond in the viewer is one cycle of the program.
+
+   graph.c calls timeline_call() when a call ends, perf.c calls
+   timeline_perf() when a Start/Stop round ends, and perf-region.c calls
+   timeline_region() when a perf region ends.  LOG_XXX values arrive
+   from host.c by means of sim.log_value.  The events are collected in a
+   large buffer that is written to FILE when it is full.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "testavr.h"
+#include "options.h"
+#include "logging.h"
+
+#ifndef AVRTEST_LOG
+#error no function herein is needed without AVRTEST_LOG
+#endif // AVRTEST_LOG
+
+#define TIMELINE_BUFSIZE (1 << 20)
+
+// Thread IDs as shown by the viewer.  Perf-meter Ti gets TID_PERF + i.
+enum
+  {
+    TID_CALLS = 1,
+    TID_LOG = 2,
+    TID_REGIONS = 3,
+    TID_PERF = 10
+  };
+
+static struct
+{
+  FILE *out;
+  char *buf;
+  size_t pos;
+  // Separator in front of the next event.
+  const char *sep;
+  // Bit i is set when Ti got its thread name.
+  unsigned perf_named;
+} tl;
+
+
+static void
+tl_flush (void)
+{
+  if (tl.pos && fwrite (tl.buf, 1, tl.pos, tl.out) != tl.pos)
+    leave (LEAVE_FATAL, "-timeline: cannot write \"%s\"", options.s_timeline);
+  tl.pos = 0;
+}
+
+
+// Make room for N more bytes.
+
+static INLINE void
+tl_need (size_t n)
+{
+  if (tl.pos + n > TIMELINE_BUFSIZE)
+    tl_flush ();
+}
+
+
+// Only for short, fixed-size output:  Strings go through tl_string().
+
+ATTR_PRINTF(1,2)
+static void
+tl_printf (const char *fmt, ...)
+{
+  va_list args;
+  tl_need (200);
+  va_start (args, fmt);
+  tl.pos += vsnprintf (tl.buf + tl.pos, TIMELINE_BUFSIZE - tl.pos, fmt, args);
+  va_end (args);
+}
+
+
+// Write the first LEN chars of S as a JSON string literal.
+
+static void
+tl_string (const char *s, size_t len)
+{
+  tl_need (1);
+  tl.buf[tl.pos++] = '"';
+  for (size_t i = 0; i < len && s[i]; i++)
+    {
+      unsigned char c = (unsigned char) s[i];
+      tl_need (6 + 1);
+      if (c == '"' || c == '\\')
+        tl.pos += sprintf (tl.buf + tl.pos, "\\%c", c);
+      else if (c == '\n')
+        tl.pos += sprintf (tl.buf + tl.pos, "\\n");
+      else if (c < 0x20 || c == 0x7f)
+        tl.pos += sprintf (tl.buf + tl.pos, "\\u%04x", c);
+      else
+        tl.buf[tl.pos++] = c;
+    }
+  tl_need (1);
+  tl.buf[tl.pos++] = '"';
+}
+
+
+// Write S without leading and trailing white space as a JSON string.
+
+static void
+tl_trimmed_string (const char *s)
+{
+  while (isspace ((unsigned char) *s))
+    s++;
+  size_t len = strlen (s);
+  while (len && isspace ((unsigned char) s[len - 1]))
+    len--;
+  tl_string (s, len);
+}
+
+
+// Start an event with "name":NAME.
+
+static void
+tl_event (const char *name)
+{
+  tl_printf ("%s{\"name\":", tl.sep);
+  tl.sep = ",\n";
+  tl_trimmed_string (name);
+}
+
+
+static void
+tl_thread_name (int tid, const char *name)
+{
+  tl_event ("thread_name");
+  tl_printf (",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", tid);
+  tl_string (name, strlen (name));
+  tl_printf ("}}");
+}
+
+
+/* -timeline:  LOG_XXX has printed TEXT by means of format FMT.  VALUE
+   points to the numeric value, or is NULL for strings.  Numbers become
+   counter events named after FMT, anything else becomes an instant
+   event.  */
+
+static void
+timeline_log_value (const char *fmt, const char *text, const double *value)
+{
+  // With -meter-async, the meter thread might be writing events.
+  meter_async_sync ();
+
+  uint64_t ts = program.n_cycles;
+
+  if (value && isfinite (*value))
+    {
+      tl_event (fmt);
+      tl_printf (",\"cat\":\"log\",\"ph\":\"C\",\"ts\":%" PRIu64
+                 ",\"pid\":1,\"args\":{\"value\":%.17g}}", ts, *value);
+    }
+  else
+    {
+      tl_event (text);
+      tl_printf (",\"cat\":\"log\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64
+                 ",\"pid\":1,\"tid\":%d}", ts, TID_LOG);
+    }
+}
+
+
+void
+timeline_init (void)
+{
+  if (!options.do_timeline)
+    return;
+
+  const char *fname = options.s_timeline;
+  tl.out = str_eq ("-", fname) ? stdout : fopen (fname, "w");
+  if (!tl.out)
+    leave (LEAVE_FATAL, "cannot open \"%s\" for writing", fname);
+
+  tl.buf = get_mem (TIMELINE_BUFSIZE, sizeof (char), "-timeline buffer");
+  tl.sep = "[\n";
+
+  tl_event ("process_name");
+  tl_printf (",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":");
+  const char *name = program.name ? program.name : "avrtest";
+  tl_string (name, strlen (name));
+  tl_printf ("}}");
+  tl_thread_name (TID_CALLS, "Calls");
+  tl_thread_name (TID_LOG, "LOG");
+  tl_thread_name (TID_REGIONS, "Regions");
+
+  sim.log_value = timeline_log_value;
+}
+
+
+/* The call of function NAME that started at cycle START ends after
+   CYCLES cycles.  */
+
+void
+timeline_call (const char *name, uint64_t start, uint64_t cycles)
+{
+  if (cycles < (uint64_t) options.do_timeline_min)
+    return;
+
+  tl_event (name);
+  tl_printf (",\"cat\":\"call\",\"ph\":\"X\",\"ts\":%" PRIu64
+             ",\"dur\":%" PRIu64 ",\"pid\":1,\"tid\":%d}",
+             start, cycles, TID_CALLS);
+}
+
+
+/* Perf region NAME that started at cycle START ends after CYCLES
+   cycles.  */
+
+void
+timeline_region (const char *name, uint64_t start, uint64_t cycles)
+{
+  tl_event (name);
+  tl_printf (",\"cat\":\"region\",\"ph\":\"X\",\"ts\":%" PRIu64
+             ",\"dur\":%" PRIu64 ",\"pid\":1,\"tid\":%d}",
+             start, cycles, TID_REGIONS);
+}
+
+
+/* Round of perf-meter Ti with label LABEL has started at cycle START and
+   took TICKS cycles.  */
+
+void
+timeline_perf (int i, const char *label, long start, long ticks)
+{
+  char name[20];
+  sprintf (name, "T%d", i);
+
+  if (!(tl.perf_named & (1u << i)))
+    {
+      tl.perf_named |= 1u << i;
+      tl_thread_name (TID_PERF + i, name);
+    }
+
+  tl_event (*label ? label : name);
+  tl_printf (",\"cat\":\"perf\",\"ph\":\"X\",\"ts\":%ld,\"dur\":%ld"
+             ",\"pid\":1,\"tid\":%d}", start, ticks, TID_PERF + i);
+}
+
+
+// Program exit:  Close the JSON array and write the rest of the events.
+
+void
+timeline_finish (void)
+{
+  if (!tl.out)
+    return;
+
+  sim.log_value = NULL;
+  tl_printf ("\n]\n");
+  tl_flush ();
+
+  fflush (tl.out);
+  if (tl.out != stdout)
+    fclose (tl.out);
+  tl.out = NULL;
+  free (tl.buf);
+}
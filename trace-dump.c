@@ -0,0 +1,915 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* Rendering of a binary trace from trace.h as the text log that
+   avrtest_log would have printed.  Used by avrtest-tracedump.  */
+
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200112L // fseeko
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "trace.h"
+
+static void*
+xrealloc (void *p, size_t n_bytes)
+{
+  p = realloc (p, n_bytes);
+  if (!p)
+    trace_dump_fatal ("out of memory");
+  return p;
+}
+
+static char*
+xstrndup (const char *s, size_t len)
+{
+  char *d = xrealloc (NULL, 1 + len);
+  memcpy (d, s, len);
+  d[len] = '\0';
+  return d;
+}
+
+// ----------------------------------------------------------------------------
+//     Reading the trace
+
+static struct
+{
+  // Read the file from .stream, or from the .mem_len bytes at .mem[]
+  // if .stream is NULL.
+  FILE *stream;
+  const char *name;
+  const unsigned char *mem;
+  size_t mem_pos, mem_len;
+
+  // The records being read:  Either a part of the file, or the unpacked
+  // chunk of a compressed trace.
+  const unsigned char *buf;
+  size_t pos, len;
+
+  // Whether the file is a compressed trace.
+  bool lz;
+  // PC and cycles of the last TR_INSN_DELTA.
+  unsigned pc;
+  uint64_t cycles;
+
+  // File offsets of chunks to be read before reading on sequentially.
+  uint64_t *plan;
+  size_t n_plan, i_plan;
+} in;
+
+static bool refill (void);
+
+// Return the next byte or EOF.
+
+static inline int
+get_byte_or_eof (void)
+{
+  while (in.pos == in.len)
+    if (!refill ())
+      return EOF;
+  return in.buf[in.pos++];
+}
+
+static inline unsigned
+get_byte (void)
+{
+  int c = get_byte_or_eof ();
+  if (c == EOF)
+    trace_dump_fatal ("%s: unexpected end of trace", in.name);
+  return (unsigned) c;
+}
+
+static uint64_t
+get_varint (void)
+{
+  uint64_t val = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+    {
+      unsigned c = get_byte ();
+      val |= (uint64_t) (c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return val;
+    }
+  trace_dump_fatal ("%s: bad varint", in.name);
+}
+
+static int64_t
+unzigzag (uint64_t val)
+{
+  return (int64_t) (val >> 1) ^ -(int64_t) (val & 1);
+}
+
+static int64_t
+get_svarint (void)
+{
+  return unzigzag (get_varint ());
+}
+
+// Read a string into *BUF with room for *SIZE bytes.
+
+static char*
+get_string (char **buf, size_t *size)
+{
+  size_t len = get_varint ();
+  if (len + 1 > *size)
+    {
+      *size = len + 1;
+      *buf = xrealloc (*buf, *size);
+    }
+  for (size_t i = 0; i < len; i++)
+    (*buf)[i] = (char) get_byte ();
+  (*buf)[len] = '\0';
+  return *buf;
+}
+
+static char*
+get_new_string (void)
+{
+  char *buf = NULL;
+  size_t size = 0;
+  return get_string (&buf, &size);
+}
+
+// ----------------------------------------------------------------------------
+//     Reading the file and compressed chunks
+
+static size_t
+raw_read (void *dst, size_t n_bytes)
+{
+  if (in.stream)
+    return fread (dst, 1, n_bytes, in.stream);
+
+  if (n_bytes > in.mem_len - in.mem_pos)
+    n_bytes = in.mem_len - in.mem_pos;
+  memcpy (dst, in.mem + in.mem_pos, n_bytes);
+  in.mem_pos += n_bytes;
+  return n_bytes;
+}
+
+static void
+raw_read_all (void *dst, size_t n_bytes)
+{
+  if (raw_read (dst, n_bytes) != n_bytes)
+    trace_dump_fatal ("%s: unexpected end of trace", in.name);
+}
+
+static uint64_t
+raw_varint (void)
+{
+  uint64_t val = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+    {
+      unsigned char c;
+      raw_read_all (&c, 1);
+      val |= (uint64_t) (c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return val;
+    }
+  trace_dump_fatal ("%s: bad varint", in.name);
+}
+
+static bool
+raw_seek (int64_t offset, int whence)
+{
+  if (!in.stream)
+    return false;
+#ifdef _WIN32
+  return 0 == _fseeki64 (in.stream, (__int64) offset, whence);
+#else
+  return 0 == fseeko (in.stream, (off_t) offset, whence);
+#endif
+}
+
+
+// Unpack the LEN bytes at SRC to the N_DST bytes at DST, see trace.h.
+
+static void
+unpack_lz (unsigned char *dst, size_t n_dst,
+           const unsigned char *src, size_t len)
+{
+  const unsigned char *end = src + len;
+  size_t pos = 0;
+
+#define CORRUPT trace_dump_fatal ("%s: corrupt chunk", in.name)
+
+  while (src < end)
+    {
+      unsigned token = *src++;
+      size_t n_lit = token >> 4;
+      if (n_lit == 15)
+        for (unsigned c = 255; c == 255; n_lit += c)
+          {
+            if (src == end)
+              CORRUPT;
+            c = *src++;
+          }
+
+      if (n_lit > (size_t) (end - src) || n_lit > n_dst - pos)
+        CORRUPT;
+      memcpy (dst + pos, src, n_lit);
+      src += n_lit;
+      pos += n_lit;
+
+      if (src == end)
+        break;
+
+      if (end - src < 2)
+        CORRUPT;
+      size_t offset = src[0] | (src[1] << 8);
+      src += 2;
+      size_t n_match = (token & 0xf);
+      if (n_match == 15)
+        for (unsigned c = 255; c == 255; n_match += c)
+          {
+            if (src == end)
+              CORRUPT;
+            c = *src++;
+          }
+      n_match += TRACE_LZ_MIN_MATCH;
+
+      if (offset == 0 || offset > pos || n_match > n_dst - pos)
+        CORRUPT;
+      // The match may overlap the bytes it produces.
+      for (size_t i = 0; i < n_match; i++, pos++)
+        dst[pos] = dst[pos - offset];
+    }
+
+  if (pos != n_dst)
+    CORRUPT;
+
+#undef CORRUPT
+}
+
+
+// Read the next chunk of a compressed trace, or the next chunk from the
+// plan.  Returns false at the end.
+
+static bool
+read_chunk (void)
+{
+  static unsigned char *packed, *chunk;
+  static size_t packed_size, chunk_size;
+
+  if (in.i_plan < in.n_plan
+      && !raw_seek (in.plan[in.i_plan++], SEEK_SET))
+    trace_dump_fatal ("%s: cannot seek", in.name);
+
+  unsigned char kind;
+  if (raw_read (&kind, 1) != 1
+      || kind == TZ_INDEX)
+    return false;
+  if (kind != TZ_DEFS && kind != TZ_DATA)
+    trace_dump_fatal ("%s: bad chunk 0x%02x", in.name, kind);
+
+  size_t len = raw_varint ();
+  size_t n_packed = raw_varint ();
+  if (kind == TZ_DATA)
+    {
+      in.pc = raw_varint ();
+      in.cycles = raw_varint ();
+    }
+
+  if (n_packed > packed_size)
+    packed = xrealloc (packed, packed_size = n_packed);
+  if (len > chunk_size)
+    chunk = xrealloc (chunk, chunk_size = len);
+
+  raw_read_all (packed, n_packed);
+  unpack_lz (chunk, len, packed, n_packed);
+
+  in.buf = chunk;
+  in.pos = 0;
+  in.len = len;
+  return true;
+}
+
+
+static bool
+refill (void)
+{
+  if (in.lz)
+    return read_chunk ();
+
+  static unsigned char buf[1 << 16];
+  in.len = raw_read (buf, sizeof (buf));
+  in.buf = buf;
+  in.pos = 0;
+  return in.len != 0;
+}
+
+// ----------------------------------------------------------------------------
+//     The line being rendered
+
+static struct
+{
+  char *data;
+  size_t len, size;
+} line;
+
+static void
+line_grow (size_t n_bytes)
+{
+  if (line.len + n_bytes + 1 > line.size)
+    {
+      line.size = 2 * (line.len + n_bytes + 1);
+      line.data = xrealloc (line.data, line.size);
+    }
+}
+
+static void __attribute__((__format__(printf,1,2)))
+line_printf (const char *fmt, ...)
+{
+  va_list args;
+  for (;;)
+    {
+      size_t room = line.size - line.len;
+      va_start (args, fmt);
+      int n = vsnprintf (line.data + line.len, room, fmt, args);
+      va_end (args);
+      if (n < 0)
+        trace_dump_fatal ("bad format string \"%s\"", fmt);
+      if ((size_t) n < room)
+        {
+          line.len += n;
+          return;
+        }
+      line_grow (n);
+    }
+}
+
+// Append literal text S of length LEN where %% stands for %.
+
+static void
+line_literal (const char *s, size_t len)
+{
+  line_grow (len);
+  for (size_t i = 0; i < len; i++)
+    {
+      line.data[line.len++] = s[i];
+      if (s[i] == '%' && i + 1 < len && s[i + 1] == '%')
+        i++;
+    }
+}
+
+// ----------------------------------------------------------------------------
+//     Format strings
+
+typedef union
+{
+  int64_t i;
+  uint64_t u;
+  double d;
+  const char *s;
+} arg_t;
+
+// One conversion together with the literal text that precedes it.
+typedef struct
+{
+  char *spec;
+  int n_kinds;
+  int kinds[3];
+} conv_t;
+
+typedef struct
+{
+  conv_t *convs;
+  int n_convs;
+  // Number of arguments consumed by all conversions.
+  int n_args;
+  // Literal text after the last conversion.
+  char *tail;
+} format_t;
+
+static format_t *formats;
+static size_t n_formats;
+
+static void
+define_format (size_t id, const char *fmt)
+{
+  if (id >= n_formats)
+    {
+      formats = xrealloc (formats, (id + 1) * sizeof (format_t));
+      memset (formats + n_formats, 0, (id + 1 - n_formats) * sizeof (format_t));
+      n_formats = id + 1;
+    }
+
+  format_t *f = & formats[id];
+  const char *pc, *end;
+  conv_t c;
+
+  for (; (pc = trace_scan_format (fmt, c.kinds, &c.n_kinds, &end)); fmt = end)
+    {
+      c.spec = xstrndup (fmt, end - fmt);
+      f->convs = xrealloc (f->convs, (f->n_convs + 1) * sizeof (conv_t));
+      f->convs[f->n_convs++] = c;
+      f->n_args += c.n_kinds;
+    }
+  f->tail = xstrndup (fmt, strlen (fmt));
+}
+
+static const format_t*
+get_format (void)
+{
+  size_t id = get_varint ();
+  if (id >= n_formats || !formats[id].tail)
+    trace_dump_fatal ("%s: undefined format %u", in.name, (unsigned) id);
+  return & formats[id];
+}
+
+
+#define EMIT(V)                                                 \
+  (n_stars == 0 ? line_printf (c->spec, V)                      \
+   : n_stars == 1 ? line_printf (c->spec, w, V)                 \
+   : line_printf (c->spec, w, p, V))
+
+static void
+print_conv (const conv_t *c, const arg_t *a)
+{
+  if (c->n_kinds == 0)
+    {
+      // Unknown conversion.
+      line_literal (c->spec, strlen (c->spec));
+      return;
+    }
+
+  int n_stars = c->n_kinds - 1;
+  int w = n_stars >= 1 ? (int) a[0].i : 0;
+  int p = n_stars >= 2 ? (int) a[1].i : 0;
+  const arg_t *v = & a[n_stars];
+
+  switch (c->kinds[n_stars])
+    {
+    case TK_INT:     EMIT ((int) v->i);                 break;
+    case TK_LONG:    EMIT ((long) v->i);                break;
+    case TK_LLONG:   EMIT ((long long) v->i);           break;
+    case TK_SSIZE:   EMIT ((ptrdiff_t) v->i);           break;
+    case TK_INTMAX:  EMIT ((intmax_t) v->i);            break;
+    case TK_UINT:    EMIT ((unsigned) v->u);            break;
+    case TK_ULONG:   EMIT ((unsigned long) v->u);       break;
+    case TK_ULLONG:  EMIT ((unsigned long long) v->u);  break;
+    case TK_SIZE:    EMIT ((size_t) v->u);              break;
+    case TK_UINTMAX: EMIT ((uintmax_t) v->u);           break;
+    case TK_DOUBLE:  EMIT (v->d);                       break;
+    case TK_LDOUBLE: EMIT ((long double) v->d);         break;
+    case TK_STR:     EMIT (v->s);                       break;
+    case TK_PTR:     EMIT ((void*) (uintptr_t) v->u);   break;
+    }
+}
+
+#undef EMIT
+
+static void
+print_format (const format_t *f, const arg_t *args)
+{
+  for (int i = 0; i < f->n_convs; i++)
+    {
+      print_conv (& f->convs[i], args);
+      args += f->convs[i].n_kinds;
+    }
+  line_literal (f->tail, strlen (f->tail));
+}
+
+// TR_TEXT:  Read the arguments of the format and print it.
+
+static void
+print_text (void)
+{
+  static arg_t *args;
+  static size_t n_alloc;
+  static char **strs;
+  static size_t *str_sizes;
+
+  const format_t *f = get_format ();
+
+  if ((size_t) f->n_args > n_alloc)
+    {
+      n_alloc = f->n_args;
+      args = xrealloc (args, n_alloc * sizeof (arg_t));
+      strs = xrealloc (strs, n_alloc * sizeof (char*));
+      str_sizes = xrealloc (str_sizes, n_alloc * sizeof (size_t));
+      memset (strs, 0, n_alloc * sizeof (char*));
+      memset (str_sizes, 0, n_alloc * sizeof (size_t));
+    }
+
+  arg_t *a = args;
+  for (int i = 0; i < f->n_convs; i++)
+    {
+      const conv_t *c = & f->convs[i];
+      for (int k = 0; k < c->n_kinds; k++, a++)
+        switch (c->kinds[k])
+          {
+          case TK_INT: case TK_LONG: case TK_LLONG:
+          case TK_SSIZE: case TK_INTMAX:
+            a->i = get_svarint ();
+            break;
+          case TK_UINT: case TK_ULONG: case TK_ULLONG:
+          case TK_SIZE: case TK_UINTMAX: case TK_PTR:
+            a->u = get_varint ();
+            break;
+          case TK_DOUBLE: case TK_LDOUBLE:
+            {
+              unsigned char b[sizeof (double)];
+              for (size_t j = 0; j < sizeof (double); j++)
+                b[j] = get_byte ();
+              memcpy (&a->d, b, sizeof (double));
+            }
+            break;
+          case TK_STR:
+            {
+              size_t n = a - args;
+              a->s = get_string (&strs[n], &str_sizes[n]);
+            }
+            break;
+          }
+    }
+
+  print_format (f, args);
+}
+
+// ----------------------------------------------------------------------------
+//     The trace header and the instructions
+
+static struct
+{
+  int strlen_pc;
+  bool has_rampd;
+  unsigned addr_SREG;
+  char s_SREG[9];
+  unsigned n_sfrs;
+  unsigned *sfr_addr;
+  char **sfr_name;
+} head;
+
+static void
+read_header (void)
+{
+  const size_t len = strlen (TRACE_MAGIC);
+  char magic[16];
+
+  for (size_t i = 0; i < len; i++)
+    {
+      int c = get_byte_or_eof ();
+      magic[i] = (char) c;
+      if (c == EOF || magic[i] != TRACE_MAGIC[i])
+        trace_dump_fatal ("%s: not a trace file", in.name);
+    }
+
+  unsigned version = get_byte ();
+  if (version != TRACE_VERSION)
+    trace_dump_fatal ("%s: unsupported trace version %u", in.name, version);
+
+  head.strlen_pc = (int) get_varint ();
+  head.has_rampd = get_byte ();
+  head.addr_SREG = get_varint ();
+  for (int i = 0; i < 8; i++)
+    head.s_SREG[i] = (char) get_byte ();
+
+  head.n_sfrs = get_varint ();
+  head.sfr_addr = xrealloc (NULL, (1 + head.n_sfrs) * sizeof (unsigned));
+  head.sfr_name = xrealloc (NULL, (1 + head.n_sfrs) * sizeof (char*));
+  for (unsigned i = 0; i < head.n_sfrs; i++)
+    {
+      head.sfr_addr[i] = get_varint ();
+      head.sfr_name[i] = get_new_string ();
+    }
+}
+
+
+// TR_MOV:  Same as log_add_data_mov() from logging.c.
+
+static void
+print_mov (void)
+{
+  const format_t *f = get_format ();
+  unsigned addr = get_varint ();
+  unsigned value = get_varint ();
+
+  char name[16];
+  arg_t args[2];
+  args[0].s = name;
+  args[1].i = value;
+
+  if (addr == head.addr_SREG)
+    {
+      char *s = name;
+      for (const char *fl = head.s_SREG; *fl; fl++, value >>= 1)
+        if (value & 1)
+          *s++ = *fl;
+      *s = '\0';
+    }
+  else
+    {
+      unsigned i;
+      for (i = 0; i < head.n_sfrs; i++)
+        if (addr == head.sfr_addr[i])
+          {
+            args[0].s = head.sfr_name[i];
+            break;
+          }
+
+      if (i == head.n_sfrs)
+        {
+          if (addr >= 0x10000 && head.has_rampd)
+            sprintf (name, "%02x:%04x", addr >> 16, addr & 0xffff);
+          else
+            sprintf (name, addr < 256 ? "%02x" : "%04x", addr);
+        }
+    }
+
+  print_format (f, args);
+}
+
+
+// Mnemonics by word address as defined by TR_CODE.
+static char **mnemos;
+static bool *is_undef;
+static size_t n_mnemos;
+
+static void
+define_code (void)
+{
+  size_t pc = get_varint ();
+  (void) get_byte (); // ID
+  bool undef = get_byte ();
+
+  if (pc >= n_mnemos)
+    {
+      size_t n = 2 * pc + 1024;
+      mnemos = xrealloc (mnemos, n * sizeof (char*));
+      is_undef = xrealloc (is_undef, n * sizeof (bool));
+      memset (mnemos + n_mnemos, 0, (n - n_mnemos) * sizeof (char*));
+      n_mnemos = n;
+    }
+
+  free (mnemos[pc]);
+  mnemos[pc] = get_new_string ();
+  is_undef[pc] = undef;
+}
+
+// TR_INSN:  Same as log_add_instr() from logging.c.
+
+static void
+print_insn (unsigned pc)
+{
+  if (pc >= n_mnemos || !mnemos[pc])
+    trace_dump_fatal ("%s: no code for PC 0x%x", in.name, 2 * pc);
+
+  if (is_undef[pc])
+    line_printf ("%0*x: ", head.strlen_pc, pc * 2);
+  else
+    line_printf ("%0*x: %-7s ", head.strlen_pc, pc * 2, mnemos[pc]);
+}
+
+
+// ----------------------------------------------------------------------------
+//     Seeking in a compressed trace
+
+static uint64_t
+mem_varint (const unsigned char **p, const unsigned char *end)
+{
+  uint64_t val = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7)
+    {
+      unsigned c = *(*p)++;
+      val |= (uint64_t) (c & 0x7f) << shift;
+      if (!(c & 0x80))
+        return val;
+    }
+  trace_dump_fatal ("%s: bad index", in.name);
+}
+
+
+/* Use the index of a compressed trace in order to find the chunk where
+   to start according to SEEK.  Plan to read the TZ_DEFS chunks in front
+   of it, then that chunk.  *N_CALLS receives the number of calls to
+   SEEK->func in front of that chunk.  Return false if the trace has no
+   such call.  Without an index, nothing is planned and the trace is
+   read from the start.  */
+
+static bool
+plan_seek (const trace_seek_t *seek, uint64_t *n_calls)
+{
+  unsigned char tail[16];
+  if (!raw_seek (-16, SEEK_END)
+      || raw_read (tail, sizeof (tail)) != sizeof (tail)
+      || memcmp (tail + 8, TRACE_INDEX_MAGIC, 8))
+    {
+      // No index:  The trace is read sequentially.
+      if (in.stream)
+        raw_seek (1 + strlen (TRACE_MAGIC), SEEK_SET);
+      return true;
+    }
+
+  uint64_t offset = 0;
+  for (int i = 7; i >= 0; i--)
+    offset = (offset << 8) | tail[i];
+
+  unsigned char kind;
+  if (!raw_seek ((int64_t) offset, SEEK_SET)
+      || raw_read (&kind, 1) != 1
+      || kind != TZ_INDEX)
+    trace_dump_fatal ("%s: bad index", in.name);
+
+  size_t len = raw_varint ();
+  unsigned char *ix = xrealloc (NULL, len);
+  raw_read_all (ix, len);
+
+  const unsigned char *p = ix, *end = ix + len;
+  // -cycle:  The start chunk so far and the number of TZ_DEFS in front.
+  uint64_t start = 0;
+  size_t n_defs = 0;
+  bool found = false;
+  *n_calls = 0;
+
+  in.plan = xrealloc (NULL, (1 + len) * sizeof (uint64_t));
+  in.n_plan = in.i_plan = 0;
+
+  while (p < end && !found)
+    {
+      kind = *p++;
+      uint64_t off = mem_varint (&p, end);
+
+      if (kind == TZ_DEFS)
+        in.plan[in.n_plan++] = off;
+      else if (kind == TZ_DATA)
+        {
+          uint64_t cycles0 = mem_varint (&p, end);
+          uint64_t n_calls_here = 0;
+          for (uint64_t n = mem_varint (&p, end); n; n--)
+            {
+              uint64_t pc = mem_varint (&p, end);
+              uint64_t count = mem_varint (&p, end);
+              if (2 * pc == seek->func)
+                n_calls_here = count;
+            }
+
+          if (seek->by_cycle)
+            {
+              // The last chunk that starts before the cycle.
+              if (start && cycles0 >= seek->cycle)
+                break;
+              start = off;
+              n_defs = in.n_plan;
+            }
+          else if (*n_calls + n_calls_here >= seek->call)
+            {
+              in.plan[in.n_plan++] = off;
+              found = true;
+            }
+          else
+            *n_calls += n_calls_here;
+        }
+      else
+        trace_dump_fatal ("%s: bad index", in.name);
+    }
+
+  if (seek->by_cycle && start)
+    {
+      in.n_plan = n_defs;
+      in.plan[in.n_plan++] = start;
+      found = true;
+    }
+
+  free (ix);
+  return found;
+}
+
+
+// ----------------------------------------------------------------------------
+
+/* Render the trace from STREAM, or from the LEN bytes at MEM if STREAM is
+   NULL, as text.  NAME is used in diagnostics.  For each line of the log,
+   EMIT is called with the line (without the trailing newline), whether
+   the line belongs to an instruction, its byte address and CTX.  Stop
+   when EMIT returns false.  With SEEK != NULL, start at the instruction
+   described by SEEK, which requires a compressed trace.  */
+
+void
+trace_dump (FILE *stream, const unsigned char *mem, size_t len,
+            const char *name, const trace_seek_t *seek,
+            trace_line_fn emit, void *ctx)
+{
+  in.stream = stream;
+  in.name = name;
+  in.mem = mem;
+  in.mem_pos = 0;
+  in.mem_len = stream ? 0 : len;
+  in.pos = in.len = 0;
+  in.n_plan = in.i_plan = 0;
+
+  // A compressed trace starts with its own magic.  Otherwise, the bytes
+  // read so far belong to the header of a plain trace.
+  static unsigned char magic[16];
+  size_t n_magic = raw_read (magic, 1 + strlen (TRACE_MAGIC));
+  in.lz = (n_magic == 1 + strlen (TRACE_MAGIC)
+           && !memcmp (magic, TRACE_MAGIC, strlen (TRACE_MAGIC))
+           && magic[strlen (TRACE_MAGIC)] == TRACE_VERSION_LZ);
+  if (!in.lz)
+    {
+      in.buf = magic;
+      in.len = n_magic;
+    }
+
+  bool seeking = seek && (seek->by_cycle || seek->by_call);
+  uint64_t n_calls = 0;
+  if (seeking)
+    {
+      if (!in.lz)
+        trace_dump_fatal ("%s: seeking requires a trace written with "
+                          "-trace-compress", in.name);
+      if (!plan_seek (seek, &n_calls))
+        return;
+    }
+
+  read_header ();
+  line_grow (100);
+
+  bool have_pc = false;
+  unsigned pc = 0;
+  int tag;
+
+  while ((tag = get_byte_or_eof ()) != EOF)
+    switch (tag)
+      {
+      default:
+        trace_dump_fatal ("%s: bad record 0x%02x", in.name, tag);
+
+      case TR_FORMAT:
+        {
+          size_t id = get_varint ();
+          char *fmt = get_new_string ();
+          define_format (id, fmt);
+          free (fmt);
+        }
+        break;
+
+      case TR_CODE:   define_code ();  break;
+      case TR_TEXT:   print_text ();   break;
+      case TR_MOV:    print_mov ();    break;
+
+      case TR_STRING:
+        {
+          static char *str;
+          static size_t size;
+          line_printf ("%s", get_string (&str, &size));
+        }
+        break;
+
+      case TR_INSN:
+        pc = get_varint ();
+        print_insn (pc);
+        have_pc = true;
+        break;
+
+      case TR_INSN_DELTA:
+        {
+          uint64_t val = get_varint ();
+          in.pc += 1 + unzigzag (val >> 1);
+          in.cycles += get_varint ();
+          pc = in.pc;
+          print_insn (pc);
+          have_pc = true;
+
+          if (seeking)
+            seeking = (seek->by_cycle
+                       ? in.cycles < seek->cycle
+                       : !((val & 1)
+                           && 2 * pc == seek->func
+                           && ++n_calls == seek->call));
+        }
+        break;
+
+      case TR_EOL:
+        line.data[line.len] = '\0';
+        if (!seeking
+            && !emit (line.data, have_pc, 2 * pc, ctx))
+          return;
+        line.len = 0;
+        have_pc = false;
+        break;
+      }
+}
@@ -0,0 +1,807 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+#define _POSIX_C_SOURCE 200112L // fileno
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "testavr.h"
+#include "options.h"
+#include "logging.h"
+#include "cores.h"
+#include "trace.h"
+
+#ifndef AVRTEST_LOG
+#error no function herein is needed without AVRTEST_LOG
+#endif // AVRTEST_LOG
+
+/* -trace=FILE:  Instead of printing the instruction log as text, write
+   it in the compact binary format from trace.h.  Format strings are
+   interned and only their arguments are written, which saves the
+   vsprintf() calls and most of the output volume.  The text log is
+   recovered by avrtest-tracedump.
+
+   With -trace-compress, complete lines are collected in chunks of about
+   TRACE_CHUNK_SIZE bytes which are packed by trace_lz() and written
+   together with an index, see trace.h.  */
+
+// Initial size of the output buffer.  Only complete lines are written
+// to the file, so the buffer grows if a single line does not fit.
+#define TRACE_BUF_SIZE (1 << 20)
+
+// Size of the direct-mapped cache format string -> format ID.
+#define TRACE_FCACHE_SIZE 256
+
+// Maximal number of arguments consumed by one format string.
+#define TRACE_MAX_KINDS 16
+
+// -trace-compress:  Unpacked size of a chunk.  Matches of the LZ77 pass
+// don't reach back further than 64 KiB, hence larger chunks don't pack
+// better but only make seeking slower.
+#define TRACE_CHUNK_SIZE (1 << 16)
+
+// Number of entries of the LZ77 hash table.
+#define TRACE_LZ_HASH_BITS 14
+
+typedef struct
+{
+  const char *fmt;
+  byte n_kinds;
+  byte kinds[TRACE_MAX_KINDS];
+} tformat_t;
+
+typedef struct
+{
+  byte *buf;
+  size_t size;
+  // Write position in .buf[] and start of the current, incomplete line.
+  size_t pos, line;
+} tbuf_t;
+
+typedef struct
+{
+  FILE *stream;
+  const char *filename;
+
+  // The buffer that is being written.
+  tbuf_t b;
+
+  // -trace-compress:  The header and the definitions.
+  tbuf_t defs;
+
+  // One bit per (word) PC for which TR_CODE has been written.
+  byte *seen_pc;
+
+  /* -trace-compress:  Definitions go to .defs, lines go to .b until a
+     chunk is full.  */
+  bool lz;
+  struct
+  {
+    // PC and cycles of the last instruction that has been dumped, which
+    // is the base of TR_INSN_DELTA, and their values at chunk start.
+    unsigned pc, pc0;
+    uint64_t cycles, cycles0;
+    // Whether that instruction is a call.
+    bool is_call;
+    // The instruction of the current line, if any.
+    bool line_has_insn, line_is_call;
+    unsigned line_pc;
+    uint64_t line_cycles;
+    // Number of calls to word address PC in the current chunk, and the
+    // PCs for which that number is not zero.
+    unsigned *n_calls;
+    unsigned *call_pcs, n_call_pcs;
+    // Bytes written to the file so far.
+    uint64_t offset;
+    tbuf_t packed, index;
+    uint32_t hash[1 << TRACE_LZ_HASH_BITS];
+  } z;
+
+  // Interned format strings, their ID is the index.
+  tformat_t *formats;
+  unsigned n_formats, n_alloc;
+  struct
+  {
+    const char *fmt;
+    unsigned id;
+  } fcache[TRACE_FCACHE_SIZE];
+} trace_t;
+
+static trace_t trace;
+
+
+static void
+trace_write (const byte *buf, size_t n_bytes)
+{
+  if (n_bytes && log_async_active ())
+    log_async_write (fileno (trace.stream), buf, n_bytes, false);
+  else if (n_bytes
+           && fwrite (buf, 1, n_bytes, trace.stream) != n_bytes)
+    leave (LEAVE_FOPEN, "cannot write trace file \"%s\"", trace.filename);
+}
+
+
+// Make room for N_BYTES more bytes in .buf[].  Only complete lines are
+// handed to the file so that a discarded line can still be retracted.
+
+static void
+trace_reserve (size_t n_bytes)
+{
+  if (trace.b.pos + n_bytes <= trace.b.size)
+    return;
+
+  if (!trace.lz)
+    {
+      trace_write (trace.b.buf, trace.b.line);
+      memmove (trace.b.buf, trace.b.buf + trace.b.line,
+               trace.b.pos - trace.b.line);
+      trace.b.pos -= trace.b.line;
+      trace.b.line = 0;
+    }
+
+  while (trace.b.pos + n_bytes > trace.b.size)
+    {
+      trace.b.size *= 2;
+      trace.b.buf = realloc (trace.b.buf, trace.b.size);
+      if (!trace.b.buf)
+        leave (LEAVE_MEMORY, "out of memory");
+    }
+}
+
+
+static INLINE void
+put_byte (unsigned val)
+{
+  trace.b.buf[trace.b.pos++] = (byte) val;
+}
+
+static INLINE void
+put_varint (uint64_t val)
+{
+  while (val >= 0x80)
+    {
+      put_byte (0x80 | (val & 0x7f));
+      val >>= 7;
+    }
+  put_byte (val);
+}
+
+static INLINE void
+put_svarint (int64_t val)
+{
+  put_varint (((uint64_t) val << 1) ^ (uint64_t) (val >> 63));
+}
+
+static void
+put_string (const char *str)
+{
+  size_t len = strlen (str);
+  trace_reserve (10 + len);
+  put_varint (len);
+  memcpy (trace.b.buf + trace.b.pos, str, len);
+  trace.b.pos += len;
+}
+
+
+// Store VAL as varint at P and return the end.
+
+static byte*
+store_varint (byte *p, uint64_t val)
+{
+  for (; val >= 0x80; val >>= 7)
+    *p++ = 0x80 | (val & 0x7f);
+  *p++ = val;
+  return p;
+}
+
+
+// Make room for N_BYTES more bytes in buffer B which is not .b.
+
+static void
+tbuf_reserve (tbuf_t *b, size_t n_bytes)
+{
+  if (b->pos + n_bytes > b->size)
+    {
+      while (b->pos + n_bytes > b->size)
+        b->size = b->size ? 2 * b->size : 1024;
+      b->buf = realloc (b->buf, b->size);
+      if (!b->buf)
+        leave (LEAVE_MEMORY, "out of memory");
+    }
+}
+
+
+static INLINE uint32_t
+lz_hash (const byte *p)
+{
+  uint32_t val;
+  memcpy (&val, p, sizeof (val));
+  return (val * 2654435761u) >> (32 - TRACE_LZ_HASH_BITS);
+}
+
+// Append the length extension of a LEN that doesn't fit a nibble.
+
+static byte*
+lz_length (byte *p, size_t len)
+{
+  for (len -= 15; len >= 255; len -= 255)
+    *p++ = 255;
+  *p++ = len;
+  return p;
+}
+
+static byte*
+lz_sequence (byte *p, const byte *lit, size_t n_lit, size_t offset,
+             size_t len)
+{
+  size_t mlen = len ? len - TRACE_LZ_MIN_MATCH : 0;
+  *p++ = (n_lit < 15 ? n_lit : 15) << 4 | (mlen < 15 ? mlen : 15);
+  if (n_lit >= 15)
+    p = lz_length (p, n_lit);
+  memcpy (p, lit, n_lit);
+  p += n_lit;
+
+  if (len)
+    {
+      *p++ = offset & 0xff;
+      *p++ = offset >> 8;
+      if (mlen >= 15)
+        p = lz_length (p, mlen);
+    }
+  return p;
+}
+
+
+/* Pack the LEN bytes at SRC to .z.packed with a greedy LZ77 that finds
+   matches by means of a hash table of 4-byte prefixes.  Return the
+   packed size.  */
+
+static size_t
+trace_lz (const byte *src, size_t len)
+{
+  trace.z.packed.pos = 0;
+  tbuf_reserve (&trace.z.packed, 16 + len + len / 255);
+  byte *p = trace.z.packed.buf;
+  uint32_t *hash = trace.z.hash;
+
+  // Positions are stored + 1 so that 0 means "none".
+  memset (trace.z.hash, 0, sizeof (trace.z.hash));
+
+  size_t anchor = 0;
+  for (size_t i = 0; i + TRACE_LZ_MIN_MATCH <= len; )
+    {
+      uint32_t *h = & hash[lz_hash (src + i)];
+      size_t cand = *h;
+      *h = 1 + i;
+
+      if (cand-- == 0
+          || i - cand > 0xffff
+          || memcmp (src + cand, src + i, TRACE_LZ_MIN_MATCH))
+        {
+          i++;
+          continue;
+        }
+
+      size_t mlen = TRACE_LZ_MIN_MATCH;
+      while (i + mlen < len && src[cand + mlen] == src[i + mlen])
+        mlen++;
+
+      p = lz_sequence (p, src + anchor, i - anchor, i - cand, mlen);
+      i += mlen;
+      anchor = i;
+    }
+
+  p = lz_sequence (p, src + anchor, len - anchor, 0, 0);
+  return p - trace.z.packed.buf;
+}
+
+
+// Pack the LEN bytes at BUF as a chunk of KIND, write it and add it to
+// the index.
+
+static void
+trace_write_chunk (int kind, const byte *buf, size_t len)
+{
+  if (trace.z.offset == 0)
+    {
+      // The container header.  Not written by trace_init() because
+      // -log-async has not been set up at that time.
+      byte head[] = TRACE_MAGIC "?";
+      head[strlen (TRACE_MAGIC)] = TRACE_VERSION_LZ;
+      trace_write (head, 1 + strlen (TRACE_MAGIC));
+      trace.z.offset = 1 + strlen (TRACE_MAGIC);
+    }
+
+  size_t n_packed = trace_lz (buf, len);
+
+  byte head[1 + 4 * 10], *h = head;
+  *h++ = kind;
+  h = store_varint (h, len);
+  h = store_varint (h, n_packed);
+  if (kind == TZ_DATA)
+    {
+      h = store_varint (h, trace.z.pc0);
+      h = store_varint (h, trace.z.cycles0);
+    }
+
+  tbuf_t *ix = & trace.z.index;
+  tbuf_reserve (ix, 1 + 4 * 10 + 2 * 10 * trace.z.n_call_pcs);
+  byte *p = ix->buf + ix->pos;
+  *p++ = kind;
+  p = store_varint (p, trace.z.offset);
+  if (kind == TZ_DATA)
+    {
+      p = store_varint (p, trace.z.cycles0);
+      p = store_varint (p, trace.z.n_call_pcs);
+      for (unsigned i = 0; i < trace.z.n_call_pcs; i++)
+        {
+          unsigned pc = trace.z.call_pcs[i];
+          p = store_varint (p, pc);
+          p = store_varint (p, trace.z.n_calls[pc]);
+          trace.z.n_calls[pc] = 0;
+        }
+      trace.z.n_call_pcs = 0;
+    }
+  ix->pos = p - ix->buf;
+
+  trace_write (head, h - head);
+  trace_write (trace.z.packed.buf, n_packed);
+  trace.z.offset += (h - head) + n_packed;
+}
+
+
+// -trace-compress:  Write the pending definitions and the complete lines
+// as chunks.
+
+static void
+trace_chunk (void)
+{
+  if (trace.defs.pos)
+    {
+      trace_write_chunk (TZ_DEFS, trace.defs.buf, trace.defs.pos);
+      trace.defs.pos = trace.defs.line = 0;
+    }
+
+  if (trace.b.line)
+    {
+      trace_write_chunk (TZ_DATA, trace.b.buf, trace.b.line);
+      memmove (trace.b.buf, trace.b.buf + trace.b.line,
+               trace.b.pos - trace.b.line);
+      trace.b.pos -= trace.b.line;
+      trace.b.line = 0;
+    }
+
+  trace.z.pc0 = trace.z.pc;
+  trace.z.cycles0 = trace.z.cycles;
+}
+
+
+// -trace-compress:  Write the index and the trailer.
+
+static void
+trace_write_index (void)
+{
+  uint64_t offset = trace.z.offset;
+  byte head[1 + 10], *h = head;
+  *h++ = TZ_INDEX;
+  h = store_varint (h, trace.z.index.pos);
+  trace_write (head, h - head);
+  trace_write (trace.z.index.buf, trace.z.index.pos);
+
+  byte tail[8 + 8];
+  for (int i = 0; i < 8; i++)
+    tail[i] = (byte) (offset >> (8 * i));
+  memcpy (tail + 8, TRACE_INDEX_MAGIC, 8);
+  trace_write (tail, sizeof (tail));
+}
+
+
+static void
+trace_flush (void)
+{
+  if (trace.stream)
+    {
+      // Whatever is pending has not been dumped by log_dump_line.
+      if (trace.lz)
+        {
+          trace_chunk ();
+          trace_write_index ();
+        }
+      else
+        trace_write (trace.b.buf, trace.b.line);
+      fclose (trace.stream);
+      trace.stream = NULL;
+    }
+}
+
+
+static void
+swap_tbuf (tbuf_t *a, tbuf_t *b)
+{
+  tbuf_t t = *a;
+  *a = *b;
+  *b = t;
+}
+
+
+void
+trace_init (const char *filename)
+{
+  trace.lz = options.do_trace_compress;
+
+  if (cores.id)
+    {
+      // -cores: Each core writes to its own FILE.ID.
+      char *name = get_mem (strlen (filename) + 12, sizeof (char),
+                            "trace file name");
+      sprintf (name, "%s.%d", filename, cores.id);
+      filename = name;
+    }
+
+  trace.filename = filename;
+  trace.stream = fopen (filename, "wb");
+  if (!trace.stream)
+    leave (LEAVE_FOPEN, "cannot open trace file \"%s\" for writing",
+           filename);
+
+  trace.b.size = trace.lz ? 1024 : TRACE_BUF_SIZE;
+  trace.b.buf = get_mem (trace.b.size, sizeof (byte), "trace buffer");
+  trace.seen_pc = get_mem (1 + program.pc_mask / 8, sizeof (byte),
+                           "trace PC bitmap");
+
+  if (trace.lz)
+    {
+      trace.z.n_calls = get_mem (1 + program.pc_mask, sizeof (unsigned),
+                                 "trace call counts");
+      trace.z.call_pcs = get_mem (1 + program.pc_mask, sizeof (unsigned),
+                                  "trace call counts");
+    }
+
+  // File header.
+
+  trace_reserve (100);
+  memcpy (trace.b.buf, TRACE_MAGIC, strlen (TRACE_MAGIC));
+  trace.b.pos = strlen (TRACE_MAGIC);
+  put_byte (TRACE_VERSION);
+  put_varint (cpu.strlen_pc);
+  put_byte (arch.has_rampd);
+  put_varint (addr_SREG);
+  memcpy (trace.b.buf + trace.b.pos, s_SREG, 8);
+  trace.b.pos += 8;
+
+  unsigned n_sfrs = 0;
+  for (const sfr_t *sfr = named_sfr; sfr->name; sfr++)
+    n_sfrs += sfr->pon == NULL || *sfr->pon;
+  put_varint (n_sfrs);
+
+  for (const sfr_t *sfr = named_sfr; sfr->name; sfr++)
+    if (sfr->pon == NULL || *sfr->pon)
+      {
+        trace_reserve (10);
+        put_varint (sfr->addr);
+        put_string (sfr->name);
+      }
+
+  trace.b.line = trace.b.pos;
+
+  if (trace.lz)
+    {
+      swap_tbuf (&trace.b, &trace.defs);
+      trace.b.size = TRACE_CHUNK_SIZE + 1024;
+      trace.b.buf = get_mem (trace.b.size, sizeof (byte), "trace buffer");
+    }
+
+  atexit (trace_flush);
+}
+
+
+/* Definitions like TR_FORMAT and TR_CODE are inserted in front of the
+   current line so that they survive when the line is discarded.
+   begin_definition() moves the current line out of the way by GAP bytes,
+   which must be enough for the definition, and end_definition() moves
+   it back behind the definition.  */
+
+static size_t
+begin_definition (size_t gap)
+{
+  if (trace.lz)
+    {
+      // Definitions go to .defs which is never discarded.
+      swap_tbuf (&trace.b, &trace.defs);
+      trace_reserve (gap);
+      return 0;
+    }
+
+  trace_reserve (gap);
+  memmove (trace.b.buf + trace.b.line + gap, trace.b.buf + trace.b.line,
+           trace.b.pos - trace.b.line);
+  size_t pos = trace.b.pos;
+  trace.b.pos = trace.b.line;
+  return pos;
+}
+
+static void
+end_definition (size_t pos, size_t gap)
+{
+  if (trace.lz)
+    {
+      trace.b.line = trace.b.pos;
+      swap_tbuf (&trace.b, &trace.defs);
+      return;
+    }
+
+  size_t n_def = trace.b.pos - trace.b.line;
+  memmove (trace.b.buf + trace.b.pos, trace.b.buf + trace.b.line + gap,
+           pos - trace.b.line);
+  trace.b.pos = pos + n_def;
+  trace.b.line += n_def;
+}
+
+
+// Return the ID of format string FMT.  The first time FMT is seen,
+// also write its TR_FORMAT record.
+
+static const tformat_t*
+trace_format (const char *fmt)
+{
+  unsigned hash = (unsigned) (((uintptr_t) fmt >> 3) % TRACE_FCACHE_SIZE);
+
+  if (trace.fcache[hash].fmt == fmt)
+    return & trace.formats[trace.fcache[hash].id];
+
+  unsigned id;
+  for (id = 0; id < trace.n_formats; id++)
+    if (trace.formats[id].fmt == fmt)
+      break;
+
+  if (id == trace.n_formats)
+    {
+      if (trace.n_formats == trace.n_alloc)
+        {
+          trace.n_alloc = trace.n_alloc ? 2 * trace.n_alloc : 64;
+          trace.formats = realloc (trace.formats,
+                                   trace.n_alloc * sizeof (tformat_t));
+          if (!trace.formats)
+            leave (LEAVE_MEMORY, "out of memory");
+        }
+
+      tformat_t *tf = & trace.formats[trace.n_formats++];
+      int kinds[3], n;
+      const char *end;
+
+      tf->fmt = fmt;
+      tf->n_kinds = 0;
+      for (const char *f = fmt;
+           trace_scan_format (f, kinds, &n, &end); f = end)
+        for (int i = 0; i < n; i++)
+          {
+            if (tf->n_kinds == TRACE_MAX_KINDS)
+              leave (LEAVE_FATAL, "too many arguments for trace: \"%s\"",
+                     fmt);
+            tf->kinds[tf->n_kinds++] = kinds[i];
+          }
+
+      size_t gap = strlen (fmt) + 32;
+      size_t pos = begin_definition (gap);
+      put_byte (TR_FORMAT);
+      put_varint (id);
+      put_string (fmt);
+      end_definition (pos, gap);
+    }
+
+  trace.fcache[hash].fmt = fmt;
+  trace.fcache[hash].id = id;
+
+  return & trace.formats[id];
+}
+
+
+// log_append() and log_append_va(): Write the format and its arguments.
+
+void
+trace_text (const char *fmt, va_list args)
+{
+  const tformat_t *tf = trace_format (fmt);
+
+  trace_reserve (1 + 10 + 10 * tf->n_kinds);
+  put_byte (TR_TEXT);
+  put_varint (tf - trace.formats);
+
+  for (int i = 0; i < tf->n_kinds; i++)
+    switch (tf->kinds[i])
+      {
+      case TK_INT:     put_svarint (va_arg (args, int));           break;
+      case TK_LONG:    put_svarint (va_arg (args, long));          break;
+      case TK_LLONG:   put_svarint (va_arg (args, long long));     break;
+      case TK_SSIZE:   put_svarint (va_arg (args, ptrdiff_t));     break;
+      case TK_INTMAX:  put_svarint (va_arg (args, intmax_t));      break;
+      case TK_UINT:    put_varint (va_arg (args, unsigned));       break;
+      case TK_ULONG:   put_varint (va_arg (args, unsigned long));  break;
+      case TK_ULLONG:  put_varint (va_arg (args, unsigned long long)); break;
+      case TK_SIZE:    put_varint (va_arg (args, size_t));         break;
+      case TK_UINTMAX: put_varint (va_arg (args, uintmax_t));      break;
+      case TK_PTR:     put_varint ((uintptr_t) va_arg (args, void*)); break;
+
+      case TK_DOUBLE:
+      case TK_LDOUBLE:
+        {
+          double d = tf->kinds[i] == TK_DOUBLE
+            ? va_arg (args, double)
+            : (double) va_arg (args, long double);
+          memcpy (trace.b.buf + trace.b.pos, &d, sizeof (double));
+          trace.b.pos += sizeof (double);
+        }
+        break;
+
+      case TK_STR:
+        {
+          const char *s = va_arg (args, const char*);
+          put_string (s ? s : "(null)");
+          trace_reserve (10 * (tf->n_kinds - i));
+        }
+        break;
+      }
+}
+
+
+// log_va() from other modules may use format strings that are composed
+// at run time.  Don't intern them but write the formatted text.
+
+void
+trace_string (const char *fmt, va_list args)
+{
+  char str[1000];
+  vsnprintf (str, sizeof (str), fmt, args);
+  trace_reserve (1);
+  put_byte (TR_STRING);
+  put_string (str);
+}
+
+
+void
+trace_mov (const char *fmt, int addr, int value)
+{
+  const tformat_t *tf = trace_format (fmt);
+
+  trace_reserve (1 + 3 * 10);
+  put_byte (TR_MOV);
+  put_varint (tf - trace.formats);
+  put_varint ((unsigned) addr);
+  put_varint ((unsigned) value);
+}
+
+
+// Whether the instruction at word address PC is executed for the first
+// time.  If so, trace_insn() must be supplied with its mnemonic.
+
+bool
+trace_new_pc (unsigned pc)
+{
+  byte *seen = & trace.seen_pc[pc / 8];
+  byte mask = 1u << (pc % 8);
+  bool is_new = !(*seen & mask);
+  *seen |= mask;
+  return is_new;
+}
+
+
+// Start a new line for the instruction with ID at word address PC.
+
+void
+trace_insn (unsigned pc, int id, const char *mnemo)
+{
+  if (mnemo)
+    {
+      size_t gap = strlen (mnemo) + 32;
+      size_t pos = begin_definition (gap);
+      put_byte (TR_CODE);
+      put_varint (pc);
+      put_byte (id);
+      put_byte (id == ID_UNDEF);
+      put_string (mnemo);
+      end_definition (pos, gap);
+    }
+
+  if (trace.lz)
+    {
+      int64_t dpc = (int64_t) pc - trace.z.pc - 1;
+      trace_reserve (1 + 2 * 10);
+      put_byte (TR_INSN_DELTA);
+      put_varint ((((uint64_t) dpc << 1) ^ (uint64_t) (dpc >> 63)) << 1
+                  | trace.z.is_call);
+      put_varint (program.n_cycles - trace.z.cycles);
+
+      trace.z.line_has_insn = true;
+      trace.z.line_is_call = (id == ID_CALL || id == ID_RCALL
+                              || id == ID_ICALL || id == ID_EICALL);
+      trace.z.line_pc = pc;
+      trace.z.line_cycles = program.n_cycles;
+      return;
+    }
+
+  trace_reserve (1 + 10);
+  put_byte (TR_INSN);
+  put_varint (pc);
+}
+
+
+// -trace-compress:  The current line is being dumped.  Its instruction
+// becomes the base of the next TR_INSN_DELTA.
+
+static void
+trace_commit_insn (void)
+{
+  if (!trace.z.line_has_insn)
+    return;
+
+  unsigned pc = trace.z.line_pc;
+
+  if (trace.z.is_call
+      && trace.z.n_calls[pc]++ == 0)
+    trace.z.call_pcs[trace.z.n_call_pcs++] = pc;
+
+  trace.z.pc = pc;
+  trace.z.cycles = trace.z.line_cycles;
+  trace.z.is_call = trace.z.line_is_call;
+  trace.z.line_has_insn = false;
+}
+
+
+// Number of bytes written for the current line, for log_position().
+
+int
+trace_position (void)
+{
+  return (int) (trace.b.pos - trace.b.line);
+}
+
+
+// log_dump_line(): Commit resp. retract the current line.
+
+void
+trace_eol (bool dump)
+{
+  if (dump)
+    {
+      trace_reserve (1);
+      put_byte (TR_EOL);
+      trace.b.line = trace.b.pos;
+
+      if (trace.lz)
+        {
+          trace_commit_insn ();
+          if (trace.b.line >= TRACE_CHUNK_SIZE)
+            trace_chunk ();
+        }
+    }
+  else
+    {
+      trace.b.pos = trace.b.line;
+      trace.z.line_has_insn = false;
+    }
+}
+
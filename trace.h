@@ -0,0 +1,234 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Binary instruction trace as written by avrtest_log -trace=FILE and
+   rendered by avrtest-tracedump.  This header is shared by both and must
+   not depend on the rest of avrtest.
+
+   The file starts with the header
+       "AVRTRACE"      magic
+       byte            TRACE_VERSION
+       varint          length of printed PCs (cpu.strlen_pc)
+       byte            whether addresses >= 0x10000 are printed as RAMPD:addr
+       varint          address of SREG
+       8 bytes         the flag names from s_SREG[]
+       varint N        number of named SFRs, followed by N times
+       varint, string  address and name of the SFR
+
+   followed by records which start with one of the TR_xxx tag bytes.
+   Unsigned values are LEB128 varints, signed values are zigzag encoded
+   varints.  A string is a varint length followed by the characters.
+
+   With -trace-compress, the file is a container that starts with
+       "AVRTRACE"      magic
+       byte            TRACE_VERSION_LZ
+   followed by chunks of the form
+       byte            TZ_DEFS or TZ_DATA
+       varint          size of the chunk when unpacked
+       varint          size of the packed chunk
+       varint, varint  TZ_DATA only:  PC and cycles of the instruction
+                       that precedes the chunk, see TR_INSN_DELTA
+       bytes           the packed chunk
+   Unpacked and concatenated, the chunks are a trace like above, except
+   that instructions are TR_INSN_DELTA instead of TR_INSN.  TZ_DEFS chunks
+   hold the header and the TR_FORMAT and TR_CODE definitions, TZ_DATA
+   chunks hold complete lines.  Hence a TZ_DATA chunk can be rendered
+   on its own once the TZ_DEFS chunks in front of it have been read.
+
+   The chunks are followed by the index
+       byte            TZ_INDEX
+       varint          size of the entries
+       entries         one per chunk:  byte kind, varint file offset;
+                       TZ_DATA only:  varint cycles like in the chunk
+                       header, varint N, N times varint PC and varint how
+                       many calls to word address PC the chunk has
+       8 bytes         file offset of the TZ_INDEX byte, little endian
+       "AVRTRIDX"      TRACE_INDEX_MAGIC
+   which allows to seek to some cycle or call without unpacking the
+   chunks in front of it.  When the trace is incomplete because avrtest
+   has been killed, the index is missing and readers have to unpack all
+   chunks.
+
+   The chunks are packed with an LZ77 variant that is a sequence of
+       byte            token:  number of literals in the high nibble,
+                       length of the match minus TRACE_LZ_MIN_MATCH in
+                       the low nibble
+       bytes           continues the number of literals if it is 15:
+                       bytes 255 to be added, and a terminating byte < 255
+       bytes           the literals
+       2 bytes         offset of the match, little endian
+       bytes           continues the match length like for the literals
+   The last sequence consists of literals only.  */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TRACE_MAGIC   "AVRTRACE"
+#define TRACE_VERSION 1
+#define TRACE_VERSION_LZ 2
+#define TRACE_INDEX_MAGIC "AVRTRIDX"
+
+// Minimal length of an LZ77 match.
+#define TRACE_LZ_MIN_MATCH 4
+
+enum
+  {
+    // Instruction at word address PC (varint) starts a new line.
+    TR_INSN = 1,
+    // Must precede the first TR_INSN with that PC:  varint PC, byte
+    // instruction ID, byte whether the instruction is undefined, string
+    // with the mnemonic as printed.
+    TR_CODE,
+    // Define the format string with ID (varint) for TR_TEXT and TR_MOV.
+    TR_FORMAT,
+    // varint format ID followed by the arguments of the format.
+    TR_TEXT,
+    // Data move:  varint format ID, varint address, varint value.  The
+    // format expects the name of the address and the value, or just the
+    // flags string when the address is SREG.
+    TR_MOV,
+    // A string that has been formatted by avrtest.
+    TR_STRING,
+    // End of the log line.
+    TR_EOL,
+    // Instruction like TR_INSN, for compressed traces:  varint V, where
+    // V >> 1 is the zigzag encoded difference of PC to the previous
+    // PC + 1, and V & 1 is set when the previous instruction was a call.
+    // Followed by varint cycles since the previous instruction.
+    TR_INSN_DELTA
+  };
+
+// Kinds of chunks in a compressed trace.
+enum
+  {
+    TZ_DEFS = 1,
+    TZ_DATA,
+    TZ_INDEX
+  };
+
+// How to encode the arguments of a format string.
+enum
+  {
+    TK_INT, TK_LONG, TK_LLONG, TK_SSIZE, TK_INTMAX,
+    TK_UINT, TK_ULONG, TK_ULLONG, TK_SIZE, TK_UINTMAX,
+    TK_DOUBLE, TK_LDOUBLE,
+    TK_STR, TK_PTR
+  };
+
+/* Scan format F for the next conversion and return a pointer to its '%',
+   or NULL if there is none.  *KINDS receives the TK_xxx kinds of the
+   arguments consumed by that conversion (1 to 3 of them with '*' field
+   widths and precisions), *N_KINDS their number and *END points past
+   the conversion.  %% consumes no argument.  */
+
+static inline const char*
+trace_scan_format (const char *f, int *kinds, int *n_kinds, const char **end)
+{
+  const char *pc;
+
+  for (;;)
+    {
+      pc = strchr (f, '%');
+      if (!pc)
+        return NULL;
+      if (pc[1] != '%')
+        break;
+      f = pc + 2;
+    }
+
+  const char *s = pc + 1;
+  int n = 0;
+
+  // Flags, width and precision.
+  for (; strchr ("-+ #0123456789.*'", *s); s++)
+    if (*s == '*')
+      kinds[n++] = TK_INT;
+
+  // Length modifier.
+  int len = 0;
+  if (s[0] == 'h')
+    s += 1 + (s[1] == 'h');
+  else if (s[0] == 'l' && s[1] == 'l')
+    s += 2, len = 2;
+  else if (s[0] == 'l' || s[0] == 'q')
+    s += 1, len = 1;
+  else if (s[0] == 'z' || s[0] == 't')
+    s += 1, len = 3;
+  else if (s[0] == 'j')
+    s += 1, len = 4;
+  else if (s[0] == 'L')
+    s += 1, len = 5;
+
+  switch (*s)
+    {
+    case 'd': case 'i':
+      kinds[n++] = (len == 5 ? TK_LLONG : TK_INT + len);
+      break;
+    case 'u': case 'x': case 'X': case 'o': case 'c':
+      kinds[n++] = (len == 5 ? TK_ULLONG : TK_UINT + len);
+      break;
+    case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G': case 'a': case 'A':
+      kinds[n++] = len == 5 ? TK_LDOUBLE : TK_DOUBLE;
+      break;
+    case 's':
+      kinds[n++] = TK_STR;
+      break;
+    case 'p':
+      kinds[n++] = TK_PTR;
+      break;
+    default:
+      // Unknown conversion:  Print it as is.
+      break;
+    }
+
+  *n_kinds = n;
+  *end = *s ? s + 1 : s;
+  return pc;
+}
+
+// Where to start rendering a compressed trace:  At the first instruction
+// that starts at cycle .cycle or later, or at the .call-th call (counting
+// from 1) of the function at byte address .func.
+typedef struct
+{
+  bool by_cycle, by_call;
+  uint64_t cycle, call;
+  unsigned func;
+} trace_seek_t;
+
+// Rendering of a trace as text from trace-dump.c.
+typedef bool (*trace_line_fn)(const char *line, bool has_pc, unsigned addr,
+                              void *ctx);
+extern void trace_dump (FILE*, const unsigned char*, size_t, const char*,
+                        const trace_seek_t*, trace_line_fn, void *ctx);
+
+// To be supplied by the user of trace-dump.c.
+extern void trace_dump_fatal (const char *fmt, ...)
+  __attribute__((__noreturn__,__format__(printf,1,2)));
+
+#endif // TRACE_H
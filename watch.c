@@ -0,0 +1,204 @@
+/*
+  This file is part of AVRtest -- A simple simulator for the
+  AVR family of 8-bit microcontrollers designed to test the compiler.
+
+  Copyright (C) 2026 Free Software Foundation, Inc.
+
+  AVRtest is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  AVRtest is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with AVRtest; see the file COPYING.  If not, write to
+  the Free Software Foundation, 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.  */
+
+/* -watch=ITEMS:  Report accesses to data objects given by their ELF
+   symbol or by ADDR:LEN.
+
+   data_read_byte() and data_write_byte() test the bit of the accessed
+   256-byte page in watch_pages[] and only call watch_hit() when the page
+   holds a watched object.  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include "testavr.h"
+#include "options.h"
+#include "graph.h"
+
+#ifndef AVRTEST_LOG
+#error no function herein is needed without AVRTEST_LOG
+#endif // AVRTEST_LOG
+
+// Offset of RAM addresses in the ELF address space.
+#define DATA_VMA 0x800000
+
+// Pages of 256 bytes in the 24-bit address space of RAMPD devices.
+#define WATCH_N_PAGES (0x1000000 >> WATCH_PAGE_SHIFT)
+
+byte watch_pages[WATCH_N_PAGES / 8];
+
+typedef struct
+{
+  // Symbol name or NULL for ADDR:LEN.
+  const char *name;
+  // Data address and size in bytes.
+  unsigned addr, size;
+} watch_t;
+
+static struct
+{
+  // The watched objects.
+  watch_t *items;
+  int n_items;
+  // STT_OBJECT symbols in RAM from the ELF file.
+  watch_t *syms;
+  int n_syms, n_syms_alloc;
+} watch;
+
+
+/* Called by the ELF loader for each STT_OBJECT symbol.  Collect the ones
+   in RAM for -watch=SYMBOL.  */
+
+void
+watch_data_symbol (const char *name, int addr, unsigned size)
+{
+  if (!options.do_watch
+      || addr < DATA_VMA
+      || addr >= DATA_VMA + 0x10000)
+    return;
+
+  if (watch.n_syms == watch.n_syms_alloc)
+    {
+      watch.n_syms_alloc = watch.n_syms_alloc ? 2 * watch.n_syms_alloc : 256;
+      watch.syms = realloc (watch.syms, watch.n_syms_alloc * sizeof (watch_t));
+      if (!watch.syms)
+        leave (LEAVE_MEMORY, "out of memory allocating %u bytes for %s",
+               (unsigned) (watch.n_syms_alloc * sizeof (watch_t)),
+               "-watch symbols");
+    }
+
+  watch_t *w = & watch.syms[watch.n_syms++];
+  w->name = name;
+  w->addr = addr - DATA_VMA;
+  w->size = size;
+}
+
+
+// Turn the item S from -watch=ITEMS into W.
+
+static void
+watch_parse (watch_t *w, const char *s)
+{
+  if (isdigit (*s))
+    {
+      // ADDR:LEN or ADDR.
+      char *end;
+      unsigned long addr = strtoul (s, &end, 0);
+      unsigned long len = 1;
+      if (*end == ':')
+        len = strtoul (end + 1, &end, 0);
+      if (*end || len == 0)
+        leave (LEAVE_USAGE, "-watch: expecting SYMBOL or ADDR:LEN but "
+               "found '%s'", s);
+      if (addr >= DATA_VMA && addr < DATA_VMA + 0x10000)
+        addr -= DATA_VMA;
+      if (addr + len > (unsigned long) cpu.ram_valid_mask + 1)
+        leave (LEAVE_USAGE, "-watch: '%s' is outside of RAM", s);
+
+      w->name = NULL;
+      w->addr = addr;
+      w->size = len;
+      return;
+    }
+
+  for (int i = 0; i < watch.n_syms; i++)
+    if (str_eq (s, watch.syms[i].name))
+      {
+        *w = watch.syms[i];
+        // Objects with unknown size:  Watch the first byte.
+        if (w->size == 0)
+          w->size = 1;
+        return;
+      }
+
+  leave (LEAVE_USAGE, "-watch: data object '%s' not found", s);
+}
+
+
+void
+watch_init (void)
+{
+  if (!options.do_watch)
+    return;
+
+  char **items = comma_list_to_array (options.s_watch, &watch.n_items);
+  watch.items = get_mem (watch.n_items, sizeof (watch_t), "-watch items");
+
+  for (int i = 0; i < watch.n_items; i++)
+    {
+      watch_t *w = & watch.items[i];
+      watch_parse (w, items[i]);
+
+      for (unsigned a = w->addr; a < w->addr + w->size; a++)
+        {
+          unsigned page = a >> WATCH_PAGE_SHIFT;
+          watch_pages[page / 8] |= 1u << (page % 8);
+        }
+    }
+}
+
+
+/* The instruction at old_PC reads VALUE from resp. writes VALUE to data
+   address ADDR, which lives on a watched page.  OLD is the value before
+   the access.  */
+
+void
+watch_hit (int addr, int old, int value, bool write)
+{
+  if (!write && !options.do_watch_read)
+    return;
+
+  const watch_t *w = NULL;
+  for (int i = 0; i < watch.n_items && !w; i++)
+    if ((unsigned) addr - watch.items[i].addr < watch.items[i].size)
+      w = & watch.items[i];
+  if (!w)
+    return;
+
+  char where[100];
+  unsigned offset = addr - w->addr;
+  if (w->name && offset)
+    snprintf (where, sizeof (where), "%s+%u", w->name, offset);
+  else if (w->name)
+    snprintf (where, sizeof (where), "%s", w->name);
+  else
+    snprintf (where, sizeof (where), "0x%04x", addr);
+
+  const char *func = graph_current_function ();
+
+  log_async_sync ();
+  printf ("*** watch %0*x%s%s%s: %s %s", cpu.strlen_pc, 2 * old_PC,
+          func ? " (" : "", func ? func : "", func ? ")" : "",
+          write ? "write" : "read", where);
+  if (w->name)
+    printf (" (%04x)", addr);
+  if (write)
+    printf (": %02x -> %02x\n", old & 0xff, value & 0xff);
+  else
+    printf (": %02x\n", value & 0xff);
+
+  if (options.do_watch_abort)
+    leave (LEAVE_CODE, "-watch: %s %s", write ? "write to" : "read from",
+           where);
+}